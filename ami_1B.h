@@ -46,13 +46,57 @@ typedef enum {
 
 } _1B_LENGHTS;
 
+// Verdict of the header-only check of a 1B file (ami_1B_check.c), the 
+// exit code of ami_1b_splitter --check
+//
+typedef enum {
+	CHECK_OK = 0,
+	CHECK_UNREADABLE = 1,	// the file can't be opened or read
+	CHECK_TRUNCATED = 2,	// shorter than its header or components
+	CHECK_BAD_HEADER_INFO = 3,	// invalid component count or header length
+	CHECK_BAD_LENGTH = 4,	// component beyond the 32-bit address space
+	CHECK_FILE_OVERLAP = 5,	// components overlap in the file
+	CHECK_PHYSICAL_OVERLAP = 6,	// present components overlap in memory
+	CHECK_SIZE_MISMATCH = 7,	// data after the last component
+	CHECK_BAD_STRINGS = 8,	// corrupted component string table
+} CHECK_VERDICT;
+
 // Function return value code
 //
 typedef enum {
+	MISMATCH = -2,		// verified data doesn't match (see verify_1B_output())
 	ERROR = -1,
 	SUCCESS = 0,
 } STATUS;
 
+// Manifest verification mode
+//
+typedef enum {
+	VERIFY_FIRST_MISMATCH = 0,	// stop at the first mismatch
+	VERIFY_ALL = 1,		// report every mismatch
+} VERIFY_MODE;
+
+// Component files output mode
+//
+typedef enum {
+	OUTPUT_ALL = 0,		// write every component file
+	OUTPUT_CHANGED = 1,	// only rewrite the component files which changed
+} OUTPUT_MODE;
+
+// Ownership of a buffer passed to the library
+//
+typedef enum {
+	BUFFER_COPY = 0,	// the library copies the buffer, the caller keeps it
+	BUFFER_TAKE = 1,	// the library takes the (malloc()-ed) buffer and frees it
+} BUFFER_OWNERSHIP;
+
+// How the 1B files are read
+//
+typedef enum {
+	READ_BUFFERED = 0,	// through the page cache
+	READ_DIRECT = 1,	// bypassing the page cache (O_DIRECT or dropping the cached pages)
+} READ_MODE;
+
 // Header string presence flag
 //
 typedef enum {
@@ -72,31 +116,66 @@ typedef enum {
 typedef unsigned char u8_t;
 typedef unsigned short u16_t;
 typedef unsigned int u32_t;
+typedef unsigned long long u64_t;
 
 typedef signed char s8_t;
 typedef signed short s16_t;
 typedef signed int s32_t;
+typedef signed long long s64_t;
 
 // Hidden structures
 //
 struct _1B_HEADER_S;
 struct _1B_COMPONENT_S;
 struct _1B_DATA_S;
+struct _1B_TAR_S;
+struct _1B_MANIFEST_S;
+struct _1B_PACK_S;
+struct _1B_SEARCH_S;
+struct _1B_ADDRESS_INDEX_S;
+struct _1B_PARSER_S;
+struct _1B_WATCH_S;
+struct _1B_SIMILAR_S;
 
 typedef struct _1B_HEADER_S _1B_HEADER_T;
 typedef struct _1B_COMPONENT_S _1B_COMPONENT_T;
 typedef struct _1B_DATA_S _1B_DATA_T;
+typedef struct _1B_TAR_S _1B_TAR_T;
+typedef struct _1B_MANIFEST_S _1B_MANIFEST_T;
+typedef struct _1B_PACK_S _1B_PACK_T;
+typedef struct _1B_SEARCH_S _1B_SEARCH_T;
+typedef struct _1B_ADDRESS_INDEX_S _1B_ADDRESS_INDEX_T;
+typedef struct _1B_PARSER_S _1B_PARSER_T;
+typedef struct _1B_WATCH_S _1B_WATCH_T;
+typedef struct _1B_SIMILAR_S _1B_SIMILAR_T;
 
 // Exported functions
 //
 _1B_DATA_T *init_1B_data(const char *in_filename);
 
+// Only reads the header, the components data buffers are not allocated
+_1B_DATA_T *init_1B_header(const char *in_filename);
+
+// Applies to all 1B files read afterwards (ami_1B_direct.c)
+void set_1B_read_mode(READ_MODE mode);
+
+READ_MODE get_1B_read_mode(void);
+
 void cleanup_1B_data(_1B_DATA_T * p_data);
 
 STATUS write_1B_data_to_file(_1B_DATA_T * p_data, const char *filename);
 
+// Re-read the output of the last write_1B_data_to_file() bypassing the page 
+// cache and compare it with the digests computed while writing it 
+// (ami_1B_verify.c)
+STATUS verify_1B_output(_1B_DATA_T * p_data);
+
 const char *get_1B_filename(_1B_DATA_T * p_data);
 
+off_t get_1B_size(_1B_DATA_T * p_data);
+
+const char *get_header_variant(_1B_DATA_T * p_data);
+
 STATUS list_components(_1B_DATA_T * p_data);
 
 // NOTE: Component count starts from 1 (even if component position starts from 0)
@@ -109,13 +188,196 @@ _1B_COMPONENT_T *get_component_from_file_offset(_1B_DATA_T * p_data,
 _1B_COMPONENT_T *get_component_from_position(_1B_DATA_T * p_data,
 					     u16_t position);
 
+_1B_COMPONENT_T *get_component_from_name(_1B_DATA_T * p_data,
+					 const char *name);
+
 STATUS write_component_data_to_file(_1B_COMPONENT_T * p_component);
 
 STATUS replace_component_data(_1B_DATA_T * p_data,
 			      _1B_COMPONENT_T * p_component,
 			      const char *filename);
 
+STATUS replace_component_data_from_buffer(_1B_DATA_T * p_data,
+					  _1B_COMPONENT_T * p_component,
+					  void *p_buf, u32_t len,
+					  BUFFER_OWNERSHIP ownership);
+
+STATUS patch_component_data(_1B_DATA_T * p_data,
+			    _1B_COMPONENT_T * p_component, u32_t offset,
+			    const void *p_buf, u32_t len);
+
 COMPONENT_DATA_PRESENCE is_component_data_present(_1B_COMPONENT_T *
 						  p_component);
 
+STATUS write_memory_image(_1B_DATA_T * p_data, const char *filename);
+
+// In-kernel component copy (ami_1B_copy.c)
+//
+STATUS copy_component_data_to_file(_1B_DATA_T * p_data,
+				   _1B_COMPONENT_T * p_component,
+				   const char *filename);
+
+// Header-only check (ami_1B_check.c)
+//
+CHECK_VERDICT check_1B_file(const char *filename);
+
+const char *get_check_verdict_name(CHECK_VERDICT verdict);
+
+// Copy-on-write variants of one 1B file (ami_1B_variant.c)
+//
+_1B_DATA_T *clone_1B_data(_1B_DATA_T * p_data);
+
+STATUS write_1B_variants(_1B_DATA_T * p_variants[],
+			 const char *filenames[], u32_t count);
+
+// Same component replacement in many 1B files (ami_1B_batch.c)
+//
+s32_t replace_component_batch(const char *filenames[], u32_t count,
+			      const char *component_name,
+			      const char *component_filename, int verify);
+
+// Re-insert components when their extracted files change (ami_1B_watch.c)
+//
+_1B_WATCH_T *init_1B_watch(_1B_DATA_T * p_data, const char *component_dir);
+
+s32_t wait_1B_watch(_1B_WATCH_T * p_watch);
+
+void cleanup_1B_watch(_1B_WATCH_T * p_watch);
+
+// Bulk component output (ami_1B_output.c)
+//
+STATUS write_all_components_batch(_1B_DATA_T * p_data[],
+				  const char *dir_names[], u32_t count,
+				  OUTPUT_MODE mode);
+
+// Golden manifest (ami_1B_manifest.c)
+//
+char *create_1B_manifest(_1B_DATA_T * p_data, u32_t * p_len);
+
+_1B_MANIFEST_T *init_1B_manifest(const char *filename);
+
+void cleanup_1B_manifest(_1B_MANIFEST_T * p_manifest);
+
+// Returns the number of mismatches, or ERROR
+s32_t verify_1B_file(_1B_MANIFEST_T * p_manifest, const char *filename,
+		     VERIFY_MODE mode);
+
+// Near-duplicate components across 1B files (ami_1B_similar.c)
+//
+char *create_1B_fingerprints(_1B_DATA_T * p_data, u32_t * p_len);
+
+_1B_SIMILAR_T *init_1B_similar(const char *filename);
+
+// component_name = NULL queries all present components
+s32_t find_similar_components(_1B_SIMILAR_T * p_similar, _1B_DATA_T * p_data,
+			      const char *component_name, u32_t max_count);
+
+void cleanup_1B_similar(_1B_SIMILAR_T * p_similar);
+
+// Tar archive output (ami_1B_tar.c)
+//
+_1B_TAR_T *init_1B_tar(const char *filename);
+
+STATUS write_1B_data_to_tar(_1B_TAR_T * p_tar, _1B_DATA_T * p_data);
+
+STATUS close_1B_tar(_1B_TAR_T * p_tar);
+
+// Pack file of many 1B files (ami_1B_pack.c)
+//
+_1B_PACK_T *init_1B_pack(const char *filename);
+
+STATUS write_1B_data_to_pack(_1B_PACK_T * p_pack, _1B_DATA_T * p_data);
+
+_1B_PACK_T *open_1B_pack(const char *filename);
+
+u32_t get_pack_image_count(_1B_PACK_T * p_pack);
+
+const char *get_pack_image_name(_1B_PACK_T * p_pack, u32_t index);
+
+s32_t find_pack_image(_1B_PACK_T * p_pack, const char *name);
+
+_1B_DATA_T *init_1B_data_from_pack(_1B_PACK_T * p_pack, u32_t index);
+
+STATUS close_1B_pack(_1B_PACK_T * p_pack);
+
+// Component statistics (ami_1B_stats.c)
+//
+STATUS print_component_stats(_1B_DATA_T * p_data);
+
+// Multi-pattern search (ami_1B_search.c)
+//
+_1B_SEARCH_T *init_1B_search(const char *filename);
+
+s32_t search_1B_data(_1B_SEARCH_T * p_search, _1B_DATA_T * p_data);
+
+void cleanup_1B_search(_1B_SEARCH_T * p_search);
+
+// Physical address to component translation (ami_1B_address.c)
+//
+_1B_ADDRESS_INDEX_T *init_1B_address_index(_1B_DATA_T * p_data);
+
+u32_t lookup_1B_address(_1B_ADDRESS_INDEX_T * p_index, u32_t address,
+			_1B_COMPONENT_T * pp_component[], u32_t max_count);
+
+u32_t print_1B_address(_1B_ADDRESS_INDEX_T * p_index, u32_t address);
+
+void cleanup_1B_address_index(_1B_ADDRESS_INDEX_T * p_index);
+
+// Far call/jump reference graph of the components (ami_1B_xref.c)
+//
+STATUS print_reference_graph(_1B_DATA_T * p_data);
+
+// ACPI tables in ACPITBL_SEG (ami_1B_acpi.c)
+//
+STATUS list_acpi_tables(_1B_DATA_T * p_data);
+
+STATUS extract_acpi_table(_1B_DATA_T * p_data, const char *signature,
+			  const char *filename);
+
+STATUS replace_acpi_table(_1B_DATA_T * p_data, const char *signature,
+			  const void *p_buf, u32_t len);
+
+STATUS replace_acpi_table_from_file(_1B_DATA_T * p_data,
+				    const char *signature,
+				    const char *filename);
+
+// Push parser fed with chunks of a 1B file (ami_1B_parser.c)
+//
+typedef enum {
+	PARSER_HEADER = 0,	// the header is parsed, p_component is NULL
+	PARSER_COMPONENT = 1,	// the data of p_component is complete
+	PARSER_DONE = 2,	// all present components are complete
+} PARSER_EVENT;
+
+// Return ERROR to stop the parser
+typedef STATUS(*PARSER_CALLBACK) (PARSER_EVENT event, _1B_DATA_T * p_data,
+				  _1B_COMPONENT_T * p_component,
+				  void *p_context);
+
+_1B_PARSER_T *init_1B_parser(const char *name, PARSER_CALLBACK callback,
+			     void *p_context);
+
+STATUS feed_1B_parser(_1B_PARSER_T * p_parser, const void *p_buf,
+		      size_t len);
+
+_1B_DATA_T *finish_1B_parser(_1B_PARSER_T * p_parser);
+
+void cleanup_1B_parser(_1B_PARSER_T * p_parser);
+
+// Undo journal of the 1B file edits (ami_1B_journal.c)
+//
+#define JOURNAL_SUFFIX	".journal"	// default journal filename: 1B filename + suffix
+
+// Call before writing the modified 1B data back to its 1B file
+STATUS append_1B_journal(_1B_DATA_T * p_data, const char *journal_filename);
+
+// count = 0 undoes all journaled edits
+STATUS undo_1B_journal(const char *filename, const char *journal_filename,
+		       u32_t count);
+
+// 1B file assembly from component files (ami_1B_build.c)
+//
+STATUS build_1B_file(const char *filename, const char *template_filename,
+		     const char *component_dir);
+
 #endif				//__AMI_1B_H__
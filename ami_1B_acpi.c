@@ -0,0 +1,569 @@
+/*
+ * ami_1B_acpi.c
+ *
+ * Walk the ACPI tables stored in the ACPITBL_SEG component, extract a table
+ * or replace it by signature. Replacing a table only touches the component
+ * buffer in memory; the table checksum is fixed up and the 1B file is
+ * written once by the caller.
+ *
+ * A table is recognized by its header: the RSDP ("RSD PTR "), the FACS
+ * (no checksum) and system description tables (signature, length and
+ * checksum; tables whose checksum is filled at runtime are recognized by
+ * their printable OEM ID). A table is selected by its signature, followed
+ * by ":<n>" to select the n-th table (from 0) with that signature, e.g.
+ * "SSDT:1".
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "ami_1B_internal.h"
+
+#define ACPI_COMPONENT_NAME	"ACPITBL_SEG"	// component holding the ACPI tables
+
+#define MAX_ACPI_TABLE		256	// maximum number of tables in the component
+
+#define ACPI_SIGNATURE_LENGTH	4
+
+#define ACPI_HEADER_LENGTH	36	// system description table header
+
+#define ACPI_CHECKSUM_OFFSET	9
+
+#define ACPI_OEM_ID_OFFSET	10
+
+#define ACPI_OEM_ID_LENGTH	6
+
+#define ACPI_OEM_TABLE_ID_OFFSET	16
+
+#define ACPI_OEM_TABLE_ID_LENGTH	8
+
+#define ACPI_FACS_MIN_LENGTH	64
+
+#define RSDP_SIGNATURE		"RSD PTR "
+
+#define RSDP_V1_LENGTH		20	// length covered by the RSDP checksum
+
+#define RSDP_V2_LENGTH		36
+
+#define RSDP_CHECKSUM_OFFSET	8
+
+#define RSDP_REVISION_OFFSET	15
+
+#define RSDP_LENGTH_OFFSET	20
+
+#define RSDP_EXT_CHECKSUM_OFFSET	32
+
+// Kind of ACPI table, determines how its checksum is calculated
+//
+typedef enum {
+	ACPI_SDT = 0,		// system description table, checksum at offset 9
+	ACPI_FACS = 1,		// no checksum
+	ACPI_RSDP = 2,		// checksum over 20 bytes and extended checksum
+} ACPI_TABLE_KIND;
+
+// ACPI table found in the component
+//
+typedef struct {
+	char signature[ACPI_SIGNATURE_LENGTH + 1];
+	u32_t offset;		// offset in the component
+	u32_t length;
+	ACPI_TABLE_KIND kind;
+} ACPI_TABLE_T;
+
+
+static u8_t acpi_sum(const u8_t * p_buf, u32_t len)
+{
+	u8_t sum = 0;
+
+	while (len-- > 0)
+		sum += *p_buf++;
+
+	return sum;
+}
+
+
+static int is_acpi_signature(const u8_t * p)
+{
+	u32_t i;
+
+	for (i = 0; i < ACPI_SIGNATURE_LENGTH; i++) {
+		if ((!isupper(p[i])) && (!isdigit(p[i])) && (p[i] != '_'))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+static int is_printable(const u8_t * p, u32_t len)
+{
+	while (len-- > 0) {
+		if ((*p < 0x20) || (*p > 0x7E))
+			return 0;
+		p++;
+	}
+
+	return 1;
+}
+
+
+/*
+ * Check whether a table starts at p_buf (len bytes available)
+ *
+ * output:
+ * 	p_table		the table, if found
+ *
+ * return value:
+ * 	non-zero if a table starts at p_buf
+ */
+static int parse_acpi_table(const u8_t * p_buf, u32_t len,
+			    ACPI_TABLE_T * p_table)
+{
+	u32_t length;
+
+	if ((len >= RSDP_V1_LENGTH) &&
+	    (!memcmp(p_buf, RSDP_SIGNATURE, strlen(RSDP_SIGNATURE)))) {
+		length = RSDP_V1_LENGTH;
+		if ((p_buf[RSDP_REVISION_OFFSET] >= 2) &&
+		    (len >= RSDP_V2_LENGTH))
+			length = *((u32_t *) (p_buf + RSDP_LENGTH_OFFSET));
+
+		if ((length < RSDP_V1_LENGTH) || (length > len))
+			return 0;
+
+		strcpy(p_table->signature, "RSDP");
+		p_table->length = length;
+		p_table->kind = ACPI_RSDP;
+		return 1;
+	}
+
+	if ((len < ACPI_HEADER_LENGTH) || (!is_acpi_signature(p_buf)))
+		return 0;
+
+	length = *((u32_t *) (p_buf + ACPI_SIGNATURE_LENGTH));
+	if ((length < ACPI_HEADER_LENGTH) || (length > len))
+		return 0;
+
+	if (!memcmp(p_buf, "FACS", ACPI_SIGNATURE_LENGTH)) {
+		if (length < ACPI_FACS_MIN_LENGTH)
+			return 0;
+		p_table->kind = ACPI_FACS;
+	} else if ((acpi_sum(p_buf, length) == 0) ||
+		   is_printable(p_buf + ACPI_OEM_ID_OFFSET,
+				ACPI_OEM_ID_LENGTH)) {
+		p_table->kind = ACPI_SDT;
+	} else {
+		return 0;
+	}
+
+	memcpy(p_table->signature, p_buf, ACPI_SIGNATURE_LENGTH);
+	p_table->signature[ACPI_SIGNATURE_LENGTH] = '\0';
+	p_table->length = length;
+	return 1;
+}
+
+
+/*
+ * Walk the ACPI tables of the component data. Bytes which don't start a
+ * table (padding) are skipped.
+ *
+ * return value:
+ * 	number of tables found
+ */
+static u32_t walk_acpi_tables(const u8_t * p_buf, u32_t len,
+			      ACPI_TABLE_T * p_table)
+{
+	u32_t offset = 0, count = 0;
+
+	while ((offset < len) && (count < MAX_ACPI_TABLE)) {
+		if (parse_acpi_table(p_buf + offset, len - offset,
+				     &p_table[count])) {
+			p_table[count].offset = offset;
+			offset += p_table[count].length;
+			count++;
+		} else {
+			offset++;
+		}
+	}
+
+	return count;
+}
+
+
+/*
+ * Check the checksum(s) of the table
+ *
+ * return value:
+ * 	non-zero if the checksum is valid (always for the FACS)
+ */
+static int is_acpi_checksum_valid(const u8_t * p_buf, ACPI_TABLE_T * p_table)
+{
+	const u8_t *p = p_buf + p_table->offset;
+
+	switch (p_table->kind) {
+	case ACPI_RSDP:
+		if (acpi_sum(p, RSDP_V1_LENGTH) != 0)
+			return 0;
+		return (p_table->length < RSDP_V2_LENGTH) ||
+		    (acpi_sum(p, p_table->length) == 0);
+
+	case ACPI_SDT:
+		return acpi_sum(p, p_table->length) == 0;
+
+	default:
+		return 1;
+	}
+}
+
+
+/*
+ * Fix the checksum(s) of the table in p_buf (the table starts at p_buf).
+ * The checksum byte is adjusted by the current sum of the table, so the
+ * table is read once.
+ */
+static void fix_acpi_checksum(u8_t * p_buf, u32_t len, ACPI_TABLE_KIND kind)
+{
+	switch (kind) {
+	case ACPI_RSDP:
+		p_buf[RSDP_CHECKSUM_OFFSET] -= acpi_sum(p_buf, RSDP_V1_LENGTH);
+		if (len >= RSDP_V2_LENGTH)
+			p_buf[RSDP_EXT_CHECKSUM_OFFSET] -= acpi_sum(p_buf, len);
+		break;
+
+	case ACPI_SDT:
+		p_buf[ACPI_CHECKSUM_OFFSET] -= acpi_sum(p_buf, len);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static _1B_COMPONENT_T *get_acpi_component(_1B_DATA_T * p_data)
+{
+	u16_t i;
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		if ((!strcmp(p_data->component[i].name, ACPI_COMPONENT_NAME))
+		    && (p_data->component[i].data_presence == DATA_PRESENT)
+		    && (p_data->component[i].p_buf != NULL))
+			return &(p_data->component[i]);
+	}
+
+	printf("ERROR: component %s not present or not loaded\n",
+	       ACPI_COMPONENT_NAME);
+	return NULL;
+}
+
+
+/*
+ * Find the table selected by signature ("SIGN" or "SIGN:<n>")
+ *
+ * return value:
+ * 	-1		if not found
+ * 	table position	on success
+ */
+static s32_t find_acpi_table(ACPI_TABLE_T * p_table, u32_t count,
+			     const char *signature)
+{
+	char sig[ACPI_SIGNATURE_LENGTH + 1];
+	unsigned int n = 0;
+	u32_t i;
+
+	memset(sig, 0, sizeof(sig));
+	strncpy(sig, signature, ACPI_SIGNATURE_LENGTH);
+	if ((strlen(signature) > ACPI_SIGNATURE_LENGTH) &&
+	    ((signature[ACPI_SIGNATURE_LENGTH] != ':') ||
+	     (sscanf(signature + ACPI_SIGNATURE_LENGTH + 1, "%u", &n) != 1))) {
+		printf("ERROR: invalid ACPI table signature %s\n", signature);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (strcmp(p_table[i].signature, sig))
+			continue;
+		if (n-- == 0)
+			return i;
+	}
+
+	printf("ERROR: ACPI table %s not found in %s\n", signature,
+	       ACPI_COMPONENT_NAME);
+	return -1;
+}
+
+
+/*
+ * List the ACPI tables in the ACPITBL_SEG component of the 1B file. The
+ * components data must be loaded (see init_1B_data()).
+ *
+ * input:
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS list_acpi_tables(_1B_DATA_T * p_data)
+{
+	ACPI_TABLE_T table[MAX_ACPI_TABLE];
+	_1B_COMPONENT_T *p_comp = NULL;
+	char oem_id[ACPI_OEM_ID_LENGTH + 1];
+	char oem_table_id[ACPI_OEM_TABLE_ID_LENGTH + 1];
+	const u8_t *p = NULL;
+	u32_t i, count;
+
+	if (p_data == NULL) {
+		printf("ERROR: 1B data structure is NULL\n");
+		return ERROR;
+	}
+
+	p_comp = get_acpi_component(p_data);
+	if (p_comp == NULL)
+		return ERROR;
+
+	count = walk_acpi_tables(p_comp->p_buf, p_comp->length, table);
+	printf("ACPI tables in %s (0x%X):\n", ACPI_COMPONENT_NAME, count);
+
+	for (i = 0; i < count; i++) {
+		p = (const u8_t *) p_comp->p_buf + table[i].offset;
+
+		memset(oem_id, 0, sizeof(oem_id));
+		memset(oem_table_id, 0, sizeof(oem_table_id));
+		if (table[i].kind == ACPI_SDT) {
+			memcpy(oem_id, p + ACPI_OEM_ID_OFFSET,
+			       ACPI_OEM_ID_LENGTH);
+			memcpy(oem_table_id, p + ACPI_OEM_TABLE_ID_OFFSET,
+			       ACPI_OEM_TABLE_ID_LENGTH);
+		}
+
+		printf("%s: Offset: 0x%X, Physical address: 0x%X, "
+		       "Length: 0x%X, OEM: \"%s\" \"%s\", Checksum: %s\n",
+		       table[i].signature, table[i].offset,
+		       p_comp->physical_address + table[i].offset,
+		       table[i].length, oem_id, oem_table_id,
+		       (table[i].kind == ACPI_FACS) ? "none" :
+		       is_acpi_checksum_valid(p_comp->p_buf, &table[i]) ?
+		       "OK" : "BAD");
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Write the ACPI table selected by signature to file filename
+ *
+ * input:
+ * 	p_data		pointer to initialized _1B_DATA_T
+ * 	signature	table signature, optionally followed by ":<n>"
+ * 	filename	name of the output file
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS extract_acpi_table(_1B_DATA_T * p_data, const char *signature,
+			  const char *filename)
+{
+	ACPI_TABLE_T table[MAX_ACPI_TABLE];
+	_1B_COMPONENT_T *p_comp = NULL;
+	u32_t count;
+	s32_t i;
+
+	if ((p_data == NULL) || (signature == NULL) || (filename == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	p_comp = get_acpi_component(p_data);
+	if (p_comp == NULL)
+		return ERROR;
+
+	count = walk_acpi_tables(p_comp->p_buf, p_comp->length, table);
+	i = find_acpi_table(table, count, signature);
+	if (i < 0)
+		return ERROR;
+
+	printf("%s: Writing ACPI table %s (0x%X bytes) to %s\n", __func__,
+	       table[i].signature, table[i].length, filename);
+	return write_data_to_named_file(filename,
+					p_comp->p_buf + table[i].offset,
+					table[i].length);
+}
+
+
+/*
+ * Replace the ACPI table selected by signature with the table in p_buf
+ * and fix its checksum. The new table is written over the old one if it
+ * fits into the old table and the zero padding after it, the tables which
+ * follow are moved otherwise. Only the component buffer is modified, call
+ * write_1B_data_to_file() to write the 1B file.
+ *
+ * input:
+ * 	p_data		pointer to initialized _1B_DATA_T
+ * 	signature	table signature, optionally followed by ":<n>"
+ * 	p_buf		the new table
+ * 	len		length of the new table
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS replace_acpi_table(_1B_DATA_T * p_data, const char *signature,
+			  const void *p_buf, u32_t len)
+{
+	ACPI_TABLE_T table[MAX_ACPI_TABLE], new_table;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u8_t *p_new = NULL, *p_comp_buf = NULL;
+	u32_t count, end, limit, new_length;
+	s32_t i;
+
+	if ((p_data == NULL) || (signature == NULL) || (p_buf == NULL) ||
+	    (len == 0)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	p_comp = get_acpi_component(p_data);
+	if (p_comp == NULL)
+		return ERROR;
+
+	count = walk_acpi_tables(p_comp->p_buf, p_comp->length, table);
+	i = find_acpi_table(table, count, signature);
+	if (i < 0)
+		return ERROR;
+
+	// The new table must be a table of the same kind, with its length
+	// field matching the data
+	//
+	if ((!parse_acpi_table(p_buf, len, &new_table)) ||
+	    (new_table.length != len) ||
+	    (strcmp(new_table.signature, table[i].signature))) {
+		printf("ERROR: the new table is not a valid %s table\n",
+		       table[i].signature);
+		return ERROR;
+	}
+
+	p_new = (u8_t *) malloc(len);
+	if (p_new == NULL) {
+		printf("ERROR: function %s() unable to allocate table "
+		       "buffer\n", __func__);
+		return ERROR;
+	}
+	memcpy(p_new, p_buf, len);
+	fix_acpi_checksum(p_new, len, new_table.kind);
+
+	// Zero padding available after the old table
+	//
+	p_comp_buf = (u8_t *) p_comp->p_buf;
+	end = table[i].offset + table[i].length;
+	limit = (i + 1 < (s32_t) count) ? table[i + 1].offset : p_comp->length;
+	while ((end < limit) && (p_comp_buf[end] == 0))
+		end++;
+
+	if (table[i].offset + len <= end) {
+		// Overwrite in place, clear the rest of the old table
+		//
+		if (patch_component_data(p_data, p_comp, table[i].offset,
+					 p_new, len) == ERROR) {
+			free(p_new);
+			return ERROR;
+		}
+
+		if (len < table[i].length) {
+			memset(p_new, 0, table[i].length - len);
+			if (patch_component_data(p_data, p_comp,
+						 table[i].offset + len, p_new,
+						 table[i].length - len) ==
+			    ERROR) {
+				free(p_new);
+				return ERROR;
+			}
+		}
+		free(p_new);
+
+		printf("%s: Replaced ACPI table %s in place\n", __func__,
+		       table[i].signature);
+		return SUCCESS;
+	}
+	// Move the rest of the component after the new table
+	//
+	new_length = p_comp->length - table[i].length + len;
+	p_comp_buf = (u8_t *) malloc(new_length);
+	if (p_comp_buf == NULL) {
+		printf("ERROR: function %s() unable to allocate component "
+		       "buffer\n", __func__);
+		free(p_new);
+		return ERROR;
+	}
+
+	end = table[i].offset + table[i].length;
+	memcpy(p_comp_buf, p_comp->p_buf, table[i].offset);
+	memcpy(p_comp_buf + table[i].offset, p_new, len);
+	memcpy(p_comp_buf + table[i].offset + len, p_comp->p_buf + end,
+	       p_comp->length - end);
+	free(p_new);
+
+	if (i + 1 < (s32_t) count)
+		printf("Warning: the ACPI tables after %s moved by 0x%X "
+		       "bytes\n", table[i].signature, len - table[i].length);
+
+	if (replace_component_data_from_buffer(p_data, p_comp, p_comp_buf,
+					       new_length,
+					       BUFFER_TAKE) == ERROR) {
+		free(p_comp_buf);
+		return ERROR;
+	}
+
+	printf("%s: Replaced ACPI table %s, %s length is now 0x%X\n",
+	       __func__, table[i].signature, ACPI_COMPONENT_NAME,
+	       new_length);
+	return SUCCESS;
+}
+
+
+/*
+ * Replace the ACPI table selected by signature with the table in file
+ * filename, see replace_acpi_table()
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS replace_acpi_table_from_file(_1B_DATA_T * p_data,
+				    const char *signature,
+				    const char *filename)
+{
+	struct stat f_stat;
+	void *p_buf = NULL;
+	STATUS status;
+
+	if (filename == NULL) {
+		printf("ERROR: %s() invalid input parameter\n", __func__);
+		return ERROR;
+	}
+
+	if ((stat(filename, &f_stat) != 0) || (f_stat.st_size == 0)) {
+		printf("ERROR: %s() unable to get ACPI table file %s "
+		       "statistics\n", __func__, filename);
+		return ERROR;
+	}
+
+	p_buf = init_file_chunk_buffer(filename, 0, f_stat.st_size);
+	if (p_buf == NULL)
+		return ERROR;
+
+	status = replace_acpi_table(p_data, signature, p_buf, f_stat.st_size);
+	free(p_buf);
+	return status;
+}
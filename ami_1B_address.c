@@ -0,0 +1,222 @@
+/*
+ * ami_1B_address.c
+ *
+ * Physical address index of the 1B components: the target physical address
+ * ranges of all components (present or not) sorted by start address, with
+ * the running maximum of the range ends. A lookup is a binary search for the
+ * last range starting at or below the address, followed by a backward walk
+ * which stops as soon as no earlier range can reach the address, so
+ * overlapping components are all found.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+// Physical address range of one component
+//
+typedef struct {
+	u64_t start;
+	u64_t end;		// exclusive
+	u64_t max_end;		// maximum end of this and all preceding ranges
+	_1B_COMPONENT_T *p_component;
+} ADDRESS_RANGE_T;
+
+struct _1B_ADDRESS_INDEX_S {
+
+	ADDRESS_RANGE_T *p_range;	// ranges sorted by start address
+
+	u32_t count;		// number of ranges
+
+};
+
+
+static int compare_range_start(const void *p_a, const void *p_b)
+{
+	const ADDRESS_RANGE_T *p_range_a = (const ADDRESS_RANGE_T *) p_a;
+	const ADDRESS_RANGE_T *p_range_b = (const ADDRESS_RANGE_T *) p_b;
+
+	if (p_range_a->start < p_range_b->start)
+		return -1;
+	if (p_range_a->start > p_range_b->start)
+		return 1;
+	return 0;
+}
+
+
+/*
+ * Build the physical address index of all components of the 1B file. The
+ * components data isn't needed (see init_1B_header()).
+ *
+ * NOTE: You must call cleanup_1B_address_index() when you're finished
+ * 	 using the index, before cleaning up p_data.
+ *
+ * input:
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * return value:
+ * 	NULL 					on error
+ * 	pointer to _1B_ADDRESS_INDEX_T		on success
+ */
+_1B_ADDRESS_INDEX_T *init_1B_address_index(_1B_DATA_T * p_data)
+{
+	_1B_ADDRESS_INDEX_T *p_index = NULL;
+	ADDRESS_RANGE_T *p_range = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u64_t max_end = 0;
+	u32_t i;
+
+	if (p_data == NULL) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return NULL;
+	}
+
+	p_index = (_1B_ADDRESS_INDEX_T *) malloc(sizeof(_1B_ADDRESS_INDEX_T));
+	if (p_index == NULL) {
+		printf("ERROR: unable to allocate memory for address index\n");
+		return NULL;
+	}
+	p_index->count = 0;
+
+	p_index->p_range = (ADDRESS_RANGE_T *)
+	    malloc((p_data->header.component_info_count + 1) *
+		   sizeof(ADDRESS_RANGE_T));
+	if (p_index->p_range == NULL) {
+		printf("ERROR: unable to allocate memory for address index\n");
+		free(p_index);
+		return NULL;
+	}
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if (p_comp->length == 0)
+			continue;
+
+		p_range = &(p_index->p_range[p_index->count++]);
+		p_range->start = p_comp->physical_address;
+		p_range->end = (u64_t) p_comp->physical_address +
+		    p_comp->length;
+		p_range->p_component = p_comp;
+	}
+
+	qsort(p_index->p_range, p_index->count, sizeof(ADDRESS_RANGE_T),
+	      compare_range_start);
+
+	for (i = 0; i < p_index->count; i++) {
+		if (p_index->p_range[i].end > max_end)
+			max_end = p_index->p_range[i].end;
+		p_index->p_range[i].max_end = max_end;
+	}
+
+	return p_index;
+}
+
+
+void cleanup_1B_address_index(_1B_ADDRESS_INDEX_T * p_index)
+{
+	if (p_index == NULL)
+		return;
+
+	free(p_index->p_range);
+	free(p_index);
+}
+
+
+/*
+ * Find the components whose physical address range contains address
+ *
+ * input:
+ * 	p_index		pointer to the index created by init_1B_address_index()
+ * 	address		physical address
+ * 	max_count	number of entries in pp_component
+ *
+ * output:
+ * 	pp_component	the matching components, highest start address first
+ *
+ * return value:
+ * 	number of matching components (may be more than max_count)
+ */
+u32_t lookup_1B_address(_1B_ADDRESS_INDEX_T * p_index, u32_t address,
+			_1B_COMPONENT_T * pp_component[], u32_t max_count)
+{
+	u32_t low, high, mid, count = 0;
+	s64_t i;
+
+	if ((p_index == NULL) || (p_index->count == 0))
+		return 0;
+
+	// Number of ranges which start at or below address
+	//
+	low = 0;
+	high = p_index->count;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (p_index->p_range[mid].start <= address)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (i = (s64_t) low - 1;
+	     (i >= 0) && (p_index->p_range[i].max_end > address); i--) {
+		if (p_index->p_range[i].end <= address)
+			continue;
+
+		if ((pp_component != NULL) && (count < max_count))
+			pp_component[count] = p_index->p_range[i].p_component;
+		count++;
+	}
+
+	return count;
+}
+
+
+/*
+ * Print the components containing physical address address, with the
+ * offset of the address in each component and its 1B file offset (for
+ * the components present in the 1B file). The output is one line:
+ *
+ * 	0x<address>: <name> + 0x<offset>, file offset 0x<file_offset>[; ...]
+ *
+ * input:
+ * 	p_index		pointer to the index created by init_1B_address_index()
+ * 	address		physical address
+ *
+ * return value:
+ * 	number of components containing the address
+ */
+u32_t print_1B_address(_1B_ADDRESS_INDEX_T * p_index, u32_t address)
+{
+	_1B_COMPONENT_T *p_component[MAX_COMPONENT];
+	u32_t i, count, offset;
+
+	count = lookup_1B_address(p_index, address, p_component,
+				  MAX_COMPONENT);
+
+	printf("0x%X: ", address);
+	if (count == 0)
+		printf("no component");
+
+	for (i = 0; (i < count) && (i < MAX_COMPONENT); i++) {
+		offset = address - p_component[i]->physical_address;
+
+		if (i > 0)
+			printf("; ");
+		printf("%s + 0x%X", p_component[i]->name, offset);
+
+		if (p_component[i]->data_presence == DATA_PRESENT)
+			printf(", file offset 0x%lX",
+			       p_component[i]->file_offset + offset);
+		else
+			printf(", not present in 1B");
+	}
+	printf("\n");
+
+	return count;
+}
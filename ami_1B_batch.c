@@ -0,0 +1,403 @@
+/*
+ * ami_1B_batch.c
+ *
+ * Batch replace: the same component replacement applied to many 1B files,
+ * e.g. a fixed SMI_BSPCSEG rolled out to every board image. The new
+ * component data is read once, the 1B files are processed concurrently and
+ * the component is located by name in each of them. Each 1B file is
+ * written safely: the modified 1B file is written to a new temporary file
+ * next to it (an in-kernel copy with only the changed components rewritten),
+ * flushed to disk and renamed over the 1B file, so a failure never leaves a
+ * half-written 1B file behind. A report with the result of each 1B file is
+ * printed at the end.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+// Result of one 1B file
+//
+typedef struct {
+	STATUS status;
+	const char *p_reason;	// why the 1B file failed (NULL on success)
+	u32_t old_length;	// length of the replaced component
+	off_t new_size;		// size of the modified 1B file
+} BATCH_RESULT_T;
+
+// Identity of a 1B file on disk
+//
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	u32_t index;		// position in the batch
+} BATCH_FILE_ID_T;
+
+// State shared by the worker threads
+//
+typedef struct {
+	const char **filenames;
+	const char *component_name;
+	void *p_buf;		// the new component data
+	u32_t len;
+	int verify;
+	BATCH_RESULT_T *p_result;	// one result per 1B file
+} BATCH_JOB_T;
+
+
+/*
+ * Flush the file to disk
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS sync_file(const char *filename)
+{
+#ifndef _WIN32
+	int fd;
+	STATUS status = SUCCESS;
+
+	fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return ERROR;
+	if (fsync(fd) != 0)
+		status = ERROR;
+	close(fd);
+
+	return status;
+#else
+	return SUCCESS;
+#endif
+}
+
+
+static int compare_file_id(const void *p_a, const void *p_b)
+{
+	const BATCH_FILE_ID_T *p_id_a = (const BATCH_FILE_ID_T *) p_a;
+	const BATCH_FILE_ID_T *p_id_b = (const BATCH_FILE_ID_T *) p_b;
+
+	if (p_id_a->dev != p_id_b->dev)
+		return (p_id_a->dev < p_id_b->dev) ? -1 : 1;
+	if (p_id_a->ino != p_id_b->ino)
+		return (p_id_a->ino < p_id_b->ino) ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * Check that no 1B file is in the batch twice (under any name), two
+ * threads would replace it at once
+ *
+ * return value:
+ * 	ERROR 	if a 1B file is in the batch twice
+ * 	SUCCESS	on success
+ */
+static STATUS check_duplicate_files(const char *filenames[], u32_t count)
+{
+	BATCH_FILE_ID_T *p_id = NULL;
+	struct stat f_stat;
+	u32_t i, ids = 0;
+	STATUS status = SUCCESS;
+
+	p_id = (BATCH_FILE_ID_T *) malloc(count * sizeof(BATCH_FILE_ID_T));
+	if (p_id == NULL) {
+		printf("ERROR: function %s() unable to allocate memory\n",
+		       __func__);
+		return ERROR;
+	}
+
+	// 1B files which don't exist are reported by replace_in_file()
+	//
+	for (i = 0; i < count; i++) {
+		if (stat(filenames[i], &f_stat) != 0)
+			continue;
+		p_id[ids].dev = f_stat.st_dev;
+		p_id[ids].ino = f_stat.st_ino;
+		p_id[ids].index = i;
+		ids++;
+	}
+
+	qsort(p_id, ids, sizeof(BATCH_FILE_ID_T), compare_file_id);
+	for (i = 1; i < ids; i++) {
+		if (compare_file_id(&p_id[i - 1], &p_id[i]) == 0) {
+			printf("ERROR: 1B file %s is the same file as %s\n",
+			       filenames[p_id[i].index],
+			       filenames[p_id[i - 1].index]);
+			status = ERROR;
+			break;
+		}
+	}
+
+	free(p_id);
+	return status;
+}
+
+
+/*
+ * Replace the component in one 1B file and write it through a temporary
+ * file which is renamed over it
+ *
+ * input:
+ * 	path		resolved path of the 1B file (no symbolic link)
+ * 	p_f_stat	statistics of the 1B file
+ *
+ * output:
+ * 	p_result	result of the 1B file
+ */
+static void replace_in_path(BATCH_JOB_T * p_job, const char *path,
+			    const struct stat *p_f_stat,
+			    BATCH_RESULT_T * p_result)
+{
+	char tmp_filename[MAX_PATH + 8];
+	_1B_DATA_T *p_data = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	STATUS status;
+	int fd;
+
+	p_data = init_1B_data(path);
+	if (p_data == NULL) {
+		p_result->p_reason = "unable to read 1B file";
+		return;
+	}
+
+	p_comp = get_component_from_name(p_data, p_job->component_name);
+	if ((p_comp == NULL) || (p_comp->data_presence != DATA_PRESENT)) {
+		p_result->p_reason = "component not present";
+		cleanup_1B_data(p_data);
+		return;
+	}
+	p_result->old_length = p_comp->length;
+
+	if (replace_component_data_from_buffer(p_data, p_comp, p_job->p_buf,
+					       p_job->len,
+					       BUFFER_COPY) == ERROR) {
+		p_result->p_reason = "unable to replace component";
+		cleanup_1B_data(p_data);
+		return;
+	}
+
+	// A unique temporary file next to the 1B file, an existing file is
+	// never overwritten. It gets the owner and mode of the 1B file.
+	//
+	if (snprintf(tmp_filename, sizeof(tmp_filename), "%s.XXXXXX", path) >=
+	    (int) sizeof(tmp_filename)) {
+		p_result->p_reason = "1B file path too long";
+		cleanup_1B_data(p_data);
+		return;
+	}
+	fd = mkstemp(tmp_filename);
+	if (fd < 0) {
+		p_result->p_reason = "unable to create temporary file";
+		cleanup_1B_data(p_data);
+		return;
+	}
+#ifndef _WIN32
+	if ((fchown(fd, p_f_stat->st_uid, p_f_stat->st_gid) != 0) ||
+	    (fchmod(fd, p_f_stat->st_mode & 0777) != 0)) {
+		p_result->p_reason = "unable to keep the owner and mode of "
+		    "1B file";
+		close(fd);
+		remove(tmp_filename);
+		cleanup_1B_data(p_data);
+		return;
+	}
+#endif
+	close(fd);
+
+	if (write_1B_data_to_copy(p_data, tmp_filename) == ERROR) {
+		p_result->p_reason = "unable to write 1B file";
+		remove(tmp_filename);
+		cleanup_1B_data(p_data);
+		return;
+	}
+
+	if (sync_file(tmp_filename) == ERROR) {
+		p_result->p_reason = "unable to flush 1B file";
+		remove(tmp_filename);
+		cleanup_1B_data(p_data);
+		return;
+	}
+
+	// Only a 1B file which made it to the disk intact replaces the old one
+	//
+	if (p_job->verify) {
+		status = verify_1B_output(p_data);
+		if (status != SUCCESS) {
+			p_result->p_reason = (status == MISMATCH) ?
+			    "verification failed" :
+			    "unable to verify 1B file";
+			remove(tmp_filename);
+			cleanup_1B_data(p_data);
+			return;
+		}
+	}
+
+	if (rename(tmp_filename, path) != 0) {
+		p_result->p_reason = "unable to rename temporary file";
+		remove(tmp_filename);
+		cleanup_1B_data(p_data);
+		return;
+	}
+
+	p_result->status = SUCCESS;
+	p_result->p_reason = NULL;
+	p_result->new_size = p_data->calculated_size;
+	cleanup_1B_data(p_data);
+}
+
+
+/*
+ * Replace the component in one 1B file. A symbolic link is followed, the
+ * file it points to is replaced. A 1B file with other hard links is
+ * rejected, renaming over it would split them.
+ *
+ * output:
+ * 	p_result	result of the 1B file
+ */
+static void replace_in_file(BATCH_JOB_T * p_job, const char *filename,
+			    BATCH_RESULT_T * p_result)
+{
+	struct stat f_stat;
+	char *p_path = NULL;
+
+	p_result->status = ERROR;
+	p_result->old_length = 0;
+	p_result->new_size = 0;
+
+#ifndef _WIN32
+	p_path = realpath(filename, NULL);
+#else
+	p_path = strdup(filename);
+#endif
+	if ((p_path == NULL) || (stat(p_path, &f_stat) != 0)) {
+		p_result->p_reason = "1B file not found";
+		free(p_path);
+		return;
+	}
+
+	if (!S_ISREG(f_stat.st_mode))
+		p_result->p_reason = "not a regular file";
+	else if (f_stat.st_nlink > 1)
+		p_result->p_reason = "1B file has other hard links";
+	else
+		replace_in_path(p_job, p_path, &f_stat, p_result);
+
+	free(p_path);
+}
+
+
+/*
+ * Work item of the worker pool: replaces the component in 1B file index
+ */
+static void batch_work(void *p_context, u32_t index)
+{
+	BATCH_JOB_T *p_job = (BATCH_JOB_T *) p_context;
+
+	replace_in_file(p_job, p_job->filenames[index],
+			&(p_job->p_result[index]));
+}
+
+
+/*
+ * Replace the component named component_name in each of the 1B files with
+ * the contents of component_filename. The 1B files are processed
+ * concurrently; each one is written to a temporary file which is flushed
+ * (and verified with verify set) before it's renamed over the 1B file, so
+ * a failed 1B file is left unmodified. A report with the result of each
+ * 1B file is printed when all are done.
+ *
+ * input:
+ * 	filenames		names of the 1B files
+ * 	count			number of 1B files
+ * 	component_name		name of the component to be replaced
+ * 	component_filename	name of the file with the new component data
+ * 	verify			non-zero to verify each 1B file before
+ * 				replacing it
+ *
+ * return value:
+ * 	ERROR 				on error, e.g. a 1B file given twice
+ * 					(nothing was modified)
+ * 	number of failed 1B files	on success (0 if all were modified)
+ */
+s32_t replace_component_batch(const char *filenames[], u32_t count,
+			      const char *component_name,
+			      const char *component_filename, int verify)
+{
+	BATCH_JOB_T job;
+	struct stat f_stat;
+	u32_t i;
+	s32_t failed = 0;
+
+	if ((filenames == NULL) || (count == 0) || (component_name == NULL) ||
+	    (component_filename == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	if (check_duplicate_files(filenames, count) == ERROR)
+		return ERROR;
+
+	// Read the new component data once for all 1B files
+	//
+	if ((stat(component_filename, &f_stat) != 0) || (f_stat.st_size == 0)) {
+		printf("ERROR: function %s() unable to get new component file "
+		       "statistics\n", __func__);
+		return ERROR;
+	}
+
+	job.len = f_stat.st_size;
+	job.p_buf = init_file_chunk_buffer(component_filename, 0, job.len);
+	job.p_result = (BATCH_RESULT_T *) malloc(count *
+						 sizeof(BATCH_RESULT_T));
+	if ((job.p_buf == NULL) || (job.p_result == NULL)) {
+		printf("ERROR: function %s() unable to read new component "
+		       "file %s\n", __func__, component_filename);
+		free(job.p_buf);
+		free(job.p_result);
+		return ERROR;
+	}
+
+	job.filenames = filenames;
+	job.component_name = component_name;
+	job.verify = verify;
+	run_worker_pool(count, batch_work, &job);
+
+	// Report
+	//
+	printf("\nReplacing %s with %s (0x%X bytes):\n", component_name,
+	       component_filename, job.len);
+	for (i = 0; i < count; i++) {
+		if (job.p_result[i].status == SUCCESS) {
+			printf("OK      %s: component 0x%X -> 0x%X bytes, 1B "
+			       "file 0x%lX bytes\n", filenames[i],
+			       job.p_result[i].old_length, job.len,
+			       job.p_result[i].new_size);
+		} else {
+			printf("FAILED  %s: %s\n", filenames[i],
+			       job.p_result[i].p_reason);
+			failed++;
+		}
+	}
+	printf("%u of %u 1B files modified, %d failed\n", count - failed,
+	       count, failed);
+
+	free(job.p_buf);
+	free(job.p_result);
+
+	return failed;
+}
@@ -0,0 +1,358 @@
+/*
+ * ami_1B_build.c
+ *
+ * Assemble a complete 1B file from a header template and a directory of
+ * component files (as written by ami_1b_splitter --extract-all). The
+ * template is either a raw 1B header (e.g. the _1B_header entry of a tar
+ * archive), a 1B file whose header is reused, or a manifest which contains
+ * the raw header. The output is written in a single pass: the header
+ * followed by the present components in header order.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+#define BUILD_CHUNK_SIZE	0x10000	// size of the component copy buffer
+
+#define MANIFEST_SIGNATURE	"# 1B file:"	// first line of a manifest
+
+
+/*
+ * Read the header template. A manifest template must contain the raw
+ * header, a 1B file or raw header template provides it directly.
+ *
+ * NOTE: Caller must free the returned buffer and cleanup *pp_manifest.
+ *
+ * input:
+ * 	filename	name of the template file
+ *
+ * output:
+ * 	p_header_len		length of the header
+ * 	p_component_info_count	number of component info in the header
+ * 	pp_manifest		the manifest, NULL if the template isn't one
+ *
+ * return value:
+ * 	NULL 			on error
+ * 	pointer to header	on success
+ */
+static u8_t *read_header_template(const char *filename, u16_t * p_header_len,
+				  u16_t * p_component_info_count,
+				  _1B_MANIFEST_T ** pp_manifest)
+{
+	FILE *f_in = NULL;
+	u8_t info[HEADER_INFO_LENGTH];
+	char signature[sizeof(MANIFEST_SIGNATURE)];
+	char sha256[SHA256_HEX_LENGTH + 1];
+	u8_t *p_header = NULL;
+	_1B_MANIFEST_T *p_manifest = NULL;
+	u16_t hdr_len;
+
+	*pp_manifest = NULL;
+
+	f_in = fopen(filename, "rb");
+	if (f_in == NULL) {
+		printf("ERROR: function %s() unable to open template %s\n",
+		       __func__, filename);
+		return NULL;
+	}
+
+	memset(signature, 0, sizeof(signature));
+	if ((fread(signature, 1, sizeof(signature) - 1, f_in) ==
+	     sizeof(signature) - 1) &&
+	    (!strcmp(signature, MANIFEST_SIGNATURE))) {
+		fclose(f_in);
+
+		p_manifest = init_1B_manifest(filename);
+		if (p_manifest == NULL)
+			return NULL;
+
+		if (p_manifest->p_header == NULL) {
+			printf("ERROR: function %s() manifest %s doesn't "
+			       "contain the raw header\n", __func__, filename);
+			cleanup_1B_manifest(p_manifest);
+			return NULL;
+		}
+
+		sha256_buffer_to_hex(p_manifest->p_header,
+				     p_manifest->header_length, sha256);
+		if (strcmp(sha256, p_manifest->header_sha256)) {
+			printf("ERROR: function %s() manifest %s header "
+			       "doesn't match its digest\n", __func__,
+			       filename);
+			cleanup_1B_manifest(p_manifest);
+			return NULL;
+		}
+
+		// Hand the header buffer over to the caller
+		//
+		p_header = p_manifest->p_header;
+		p_manifest->p_header = NULL;
+
+		*p_header_len = p_manifest->header_length;
+		*p_component_info_count = *((u16_t *)
+					    (p_header + COMPONENT_COUNT_OFFSET));
+		*pp_manifest = p_manifest;
+		return p_header;
+	}
+
+	if ((fseek(f_in, 0, SEEK_SET) != 0) ||
+	    (fread(info, 1, HEADER_INFO_LENGTH, f_in) != HEADER_INFO_LENGTH)) {
+		printf("ERROR: function %s() unable to read header info from "
+		       "%s\n", __func__, filename);
+		fclose(f_in);
+		return NULL;
+	}
+
+	hdr_len = *((u16_t *) (info + HEADER_LENGTH_OFFSET));
+	*p_component_info_count = *((u16_t *) (info + COMPONENT_COUNT_OFFSET));
+
+	if ((hdr_len < HEADER_CONTENTS_OFFSET) ||
+	    (*p_component_info_count == 0)) {
+		printf("ERROR: function %s() invalid header info in %s\n",
+		       __func__, filename);
+		fclose(f_in);
+		return NULL;
+	}
+
+	p_header = (u8_t *) malloc(hdr_len);
+	if (p_header == NULL) {
+		printf("ERROR: function %s() unable to allocate header "
+		       "buffer\n", __func__);
+		fclose(f_in);
+		return NULL;
+	}
+
+	if ((fseek(f_in, 0, SEEK_SET) != 0) ||
+	    (fread(p_header, 1, hdr_len, f_in) != hdr_len)) {
+		printf("ERROR: function %s() template %s is shorter than its "
+		       "header length 0x%X\n", __func__, filename, hdr_len);
+		free(p_header);
+		fclose(f_in);
+		return NULL;
+	}
+	fclose(f_in);
+
+	*p_header_len = hdr_len;
+	return p_header;
+}
+
+
+/*
+ * Append the contents of component file path to f_out. The file length is
+ * checked against the header table before and while it's copied.
+ *
+ * input:
+ * 	f_out		the output 1B file
+ * 	p_component	pointer to the component to be written
+ * 	path		name of the component file
+ * 	p_buf		copy buffer (BUILD_CHUNK_SIZE bytes)
+ *
+ * output:
+ * 	p_hex		SHA-256 digest of the component data
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS append_component_file(FILE * f_out,
+				    _1B_COMPONENT_T * p_component,
+				    const char *path, u8_t * p_buf, char *p_hex)
+{
+	FILE *f_in = NULL;
+	struct stat f_stat;
+	SHA256_CTX_T ctx;
+	u8_t digest[SHA256_DIGEST_LENGTH];
+	u32_t copied = 0;
+	size_t read_size;
+
+	if (stat(path, &f_stat) != 0) {
+		printf("ERROR: component file %s not found\n", path);
+		return ERROR;
+	}
+
+	if (f_stat.st_size != p_component->length) {
+		printf("ERROR: component file %s length 0x%lX doesn't match "
+		       "header table length 0x%X\n", path, f_stat.st_size,
+		       p_component->length);
+		return ERROR;
+	}
+
+	f_in = fopen(path, "rb");
+	if (f_in == NULL) {
+		printf("ERROR: unable to open component file %s\n", path);
+		return ERROR;
+	}
+
+	sha256_init(&ctx);
+	while (copied < p_component->length) {
+		read_size = p_component->length - copied;
+		if (read_size > BUILD_CHUNK_SIZE)
+			read_size = BUILD_CHUNK_SIZE;
+
+		if (fread(p_buf, 1, read_size, f_in) != read_size)
+			break;
+
+		sha256_update(&ctx, p_buf, read_size);
+		if (write_buffer_to_file(f_out, p_buf, read_size) == ERROR) {
+			fclose(f_in);
+			return ERROR;
+		}
+		copied += read_size;
+	}
+
+	// The file may have changed since it was checked
+	//
+	if ((copied != p_component->length) || (fgetc(f_in) != EOF)) {
+		printf("ERROR: component file %s length changed while "
+		       "building\n", path);
+		fclose(f_in);
+		return ERROR;
+	}
+	fclose(f_in);
+
+	sha256_final(&ctx, digest);
+	sha256_digest_to_hex(digest, p_hex);
+	return SUCCESS;
+}
+
+
+/*
+ * Build 1B file filename from header template template_filename and the
+ * component files in directory component_dir. Each present component is
+ * read from <component_dir>/<component_name> and must have the length
+ * recorded in the header table. If the template is a manifest, the
+ * components which differ from the manifest are reported.
+ *
+ * The output is written to a temporary file which replaces filename once
+ * it's complete.
+ *
+ * input:
+ * 	filename		name of the 1B file to be created
+ * 	template_filename	1B header, 1B file or manifest
+ * 	component_dir		directory containing the component files
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS build_1B_file(const char *filename, const char *template_filename,
+		     const char *component_dir)
+{
+	_1B_DATA_T *p_data = NULL;
+	_1B_MANIFEST_T *p_manifest = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	MANIFEST_ENTRY_T *p_entry = NULL;
+	char path[MAX_PATH + MAX_COMPONENT_NAME];
+	char tmp_filename[MAX_PATH + 8];
+	char sha256[SHA256_HEX_LENGTH + 1];
+	u8_t *p_buf = NULL;
+	u16_t hdr_len, component_cnt, i;
+	FILE *f_out = NULL;
+	STATUS status = SUCCESS;
+
+	if ((filename == NULL) || (template_filename == NULL) ||
+	    (component_dir == NULL) || (strlen(filename) >= MAX_PATH)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	p_data = (_1B_DATA_T *) malloc(sizeof(_1B_DATA_T));
+	if (p_data == NULL) {
+		printf("ERROR: unable to allocate memory for 1B "
+		       "file data\n");
+		return ERROR;
+	}
+	p_data->header.component_info_count = 0;
+
+	p_data->header.p_buf = read_header_template(template_filename,
+						    &hdr_len, &component_cnt,
+						    &p_manifest);
+	if ((p_data->header.p_buf == NULL) ||
+	    (parse_header(p_data, hdr_len, component_cnt) == ERROR)) {
+		printf("ERROR: Unable to parse header template %s\n",
+		       template_filename);
+		cleanup_1B_manifest(p_manifest);
+		cleanup_1B_data(p_data);
+		return ERROR;
+	}
+	strcpy(p_data->filename, filename);
+
+	p_buf = (u8_t *) malloc(BUILD_CHUNK_SIZE);
+	if (p_buf == NULL) {
+		printf("ERROR: function %s() unable to allocate copy "
+		       "buffer\n", __func__);
+		cleanup_1B_manifest(p_manifest);
+		cleanup_1B_data(p_data);
+		return ERROR;
+	}
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+	f_out = fopen(tmp_filename, "wb");
+	if (f_out == NULL) {
+		printf("ERROR: Unable to create output file %s for writing\n",
+		       tmp_filename);
+		free(p_buf);
+		cleanup_1B_manifest(p_manifest);
+		cleanup_1B_data(p_data);
+		return ERROR;
+	}
+
+	status = write_buffer_to_file(f_out, p_data->header.p_buf, hdr_len);
+
+	for (i = 0; (status == SUCCESS) && (i < component_cnt); i++) {
+		p_comp = &(p_data->component[i]);
+
+		if (p_comp->data_presence != DATA_PRESENT)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", component_dir,
+			 p_comp->name);
+		status = append_component_file(f_out, p_comp, path, p_buf,
+					       sha256);
+		if (status == ERROR)
+			break;
+
+		printf("%s: Added component %s at offset 0x%lX\n", __func__,
+		       p_comp->name, p_comp->file_offset);
+
+		if (p_manifest == NULL)
+			continue;
+
+		p_entry = &(p_manifest->entry[i]);
+		if (strcmp(p_entry->sha256, sha256))
+			printf("%s: Component %s differs from the manifest\n",
+			       __func__, p_comp->name);
+	}
+
+	if (fclose(f_out) != 0)
+		status = ERROR;
+
+	if ((status == SUCCESS) && (rename(tmp_filename, filename) != 0)) {
+		printf("ERROR: function %s() unable to rename %s to %s\n",
+		       __func__, tmp_filename, filename);
+		status = ERROR;
+	}
+
+	if (status == ERROR) {
+		printf("ERROR: Failed building 1B file %s\n", filename);
+		remove(tmp_filename);
+	} else {
+		printf("%s: Wrote 1B file %s (0x%lX bytes)\n", __func__,
+		       filename, p_data->calculated_size);
+	}
+
+	free(p_buf);
+	cleanup_1B_manifest(p_manifest);
+	cleanup_1B_data(p_data);
+	return status;
+}
@@ -0,0 +1,272 @@
+/*
+ * ami_1B_check.c
+ *
+ * Header-only triage of 1B files. Only the header (the first header.length
+ * bytes) is read and checked: the header info, the component entries, the
+ * layout of the components in the file and in physical memory, the file
+ * size and the component string table. Nothing is allocated per component
+ * and no component data is read, so truncated downloads, files which are
+ * not AMIBIOS8 1B files and corrupted headers are rejected in a few
+ * microseconds each, before init_1B_data() spends time on them.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+#define MAX_HEADER_LENGTH	0xFFFF	// the header length is a 16-bit field
+
+#define CHECK_BUFFER_PAD	8	// zeroed bytes after the data read
+
+#define MAX_PHYSICAL_ADDRESS	0x100000000ULL	// end of the 32-bit address space
+
+// Physical memory range of a present component
+//
+typedef struct {
+	u32_t start;
+	u32_t length;
+} CHECK_RANGE_T;
+
+
+const char *get_check_verdict_name(CHECK_VERDICT verdict)
+{
+	static const char *verdict_name[] = {
+		"OK", "UNREADABLE", "TRUNCATED", "BAD_HEADER_INFO",
+		"BAD_LENGTH", "FILE_OVERLAP", "PHYSICAL_OVERLAP",
+		"SIZE_MISMATCH", "BAD_STRINGS",
+	};
+
+	if ((verdict < CHECK_OK) || (verdict > CHECK_BAD_STRINGS))
+		return "UNKNOWN";
+
+	return verdict_name[verdict];
+}
+
+
+static int compare_range_start(const void *p_a, const void *p_b)
+{
+	const CHECK_RANGE_T *p_range_a = (const CHECK_RANGE_T *) p_a;
+	const CHECK_RANGE_T *p_range_b = (const CHECK_RANGE_T *) p_b;
+
+	if (p_range_a->start < p_range_b->start)
+		return -1;
+	if (p_range_a->start > p_range_b->start)
+		return 1;
+	return 0;
+}
+
+
+/*
+ * Check that the component string table holds one NUL-terminated, printable
+ * name per component inside the header, i.e. that a header with a string
+ * table is decoded by one of the string table decoders
+ */
+static CHECK_VERDICT check_string_table(const u8_t * p_header,
+					u16_t header_len, u16_t count)
+{
+	STRING_TABLE_T table;
+	u16_t offset;
+
+	if (find_string_table(p_header, header_len, count, &offset) !=
+	    STRING_PRESENT)
+		return CHECK_OK;
+
+	if (detect_header_variant(p_header, header_len, count,
+				  &table)->string_status != STRING_PRESENT)
+		return CHECK_BAD_STRINGS;
+
+	return CHECK_OK;
+}
+
+
+/*
+ * Check the 1B header in buffer p_buf against the size of its 1B file.
+ *
+ * NOTE: p_buf must be readable for at least CHECK_BUFFER_PAD bytes beyond
+ * 	 len (check_1B_file() takes care of it).
+ *
+ * input:
+ * 	p_buf		pointer to the start of the 1B file
+ * 	len		number of bytes in p_buf (at least the header length,
+ * 			unless the file is shorter)
+ * 	file_size	size of the 1B file
+ *
+ * return value:
+ * 	the verdict, CHECK_OK if the header is consistent
+ */
+static CHECK_VERDICT check_1B_header(const u8_t * p_buf, size_t len,
+				     off_t file_size)
+{
+	CHECK_RANGE_T range[MAX_COMPONENT];
+	u16_t header_len, count, ranges = 0, i;
+	u32_t address, length;
+	u64_t file_offset;
+	CHECK_VERDICT verdict;
+
+	if ((file_size < HEADER_INFO_LENGTH) || (len < HEADER_INFO_LENGTH))
+		return CHECK_TRUNCATED;
+
+	count = *((u16_t *) (p_buf + COMPONENT_COUNT_OFFSET));
+	header_len = *((u16_t *) (p_buf + HEADER_LENGTH_OFFSET));
+
+	if ((count == 0) || (count > MAX_COMPONENT) ||
+	    (header_len < HEADER_CONTENTS_OFFSET +
+	     (u32_t) count * COMPONENT_INFO_LENGTH))
+		return CHECK_BAD_HEADER_INFO;
+
+	if ((file_size < header_len) || (len < header_len))
+		return CHECK_TRUNCATED;
+
+	// Component entries: every component must fit the 32-bit address
+	// space
+	//
+	file_offset = header_len;
+	for (i = 0; i < count; i++) {
+		address = *((u32_t *) (p_buf + HEADER_CONTENTS_OFFSET +
+				       i * COMPONENT_INFO_LENGTH));
+		length = *((u32_t *) (p_buf + HEADER_CONTENTS_OFFSET +
+				      i * COMPONENT_INFO_LENGTH + 4));
+
+		if ((u64_t) address + (length & ~COMPONENT_PRESENT_BITMASK) >
+		    MAX_PHYSICAL_ADDRESS)
+			return CHECK_BAD_LENGTH;
+
+		if (!(length & COMPONENT_PRESENT_BITMASK))
+			continue;
+
+		// A component which doesn't fit the file is checked with the
+		// total below, a download cut short is TRUNCATED
+		//
+		length &= ~COMPONENT_PRESENT_BITMASK;
+
+		// The 32-bit file offsets would wrap around onto the header
+		// and the preceding components
+		//
+		file_offset += length;
+		if (file_offset > 0xFFFFFFFFULL)
+			return CHECK_FILE_OVERLAP;
+
+		if (length > 0) {
+			range[ranges].start = address;
+			range[ranges].length = length;
+			ranges++;
+		}
+	}
+
+	if ((off_t) file_offset > file_size)
+		return CHECK_TRUNCATED;
+	if ((off_t) file_offset < file_size)
+		return CHECK_SIZE_MISMATCH;
+
+	verdict = check_string_table(p_buf, header_len, count);
+	if (verdict != CHECK_OK)
+		return verdict;
+
+	// Present components are placed at their physical addresses, they
+	// must not overlap
+	//
+	qsort(range, ranges, sizeof(CHECK_RANGE_T), compare_range_start);
+	for (i = 1; i < ranges; i++) {
+		if ((u64_t) range[i - 1].start + range[i - 1].length >
+		    range[i].start)
+			return CHECK_PHYSICAL_OVERLAP;
+	}
+
+	return CHECK_OK;
+}
+
+
+/*
+ * Check the header of 1B file filename without parsing the whole file.
+ * Only the header is read (usually in one read).
+ *
+ * input:
+ * 	filename	name of the 1B file
+ *
+ * return value:
+ * 	CHECK_OK		if the 1B file looks valid
+ * 	CHECK_UNREADABLE	if the file can't be read
+ * 	CHECK_TRUNCATED		if the file is shorter than its header or
+ * 				components
+ * 	CHECK_BAD_HEADER_INFO	if the component count or header length is
+ * 				invalid (e.g. not a 1B file)
+ * 	CHECK_BAD_LENGTH	if a component doesn't fit the 32-bit address
+ * 				space
+ * 	CHECK_FILE_OVERLAP	if the components overlap in the file
+ * 	CHECK_PHYSICAL_OVERLAP	if present components overlap in memory
+ * 	CHECK_SIZE_MISMATCH	if there's data after the last component
+ * 	CHECK_BAD_STRINGS	if the component string table is corrupted
+ */
+CHECK_VERDICT check_1B_file(const char *filename)
+{
+	CHECK_VERDICT verdict;
+	struct stat f_stat;
+	u8_t *buf = NULL;
+	ssize_t read_size;
+	size_t len = 0, want;
+	u16_t header_len;
+	int fd;
+
+	if (filename == NULL)
+		return CHECK_UNREADABLE;
+
+	fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return CHECK_UNREADABLE;
+
+	buf = (u8_t *) malloc(MAX_HEADER_LENGTH + CHECK_BUFFER_PAD);
+	if ((buf == NULL) || (fstat(fd, &f_stat) != 0)) {
+		free(buf);
+		close(fd);
+		return CHECK_UNREADABLE;
+	}
+
+	// Read the first page, which holds the whole header of most 1B
+	// files, then the rest of a longer header
+	//
+	want = (f_stat.st_size < 4096) ? f_stat.st_size : 4096;
+	while (1) {
+		while (len < want) {
+			read_size = read(fd, buf + len, want - len);
+			if (read_size < 0) {
+				free(buf);
+				close(fd);
+				return CHECK_UNREADABLE;
+			}
+			if (read_size == 0)
+				break;
+			len += read_size;
+		}
+
+		if (len < HEADER_INFO_LENGTH)
+			break;
+
+		header_len = *((u16_t *) (buf + HEADER_LENGTH_OFFSET));
+		if ((header_len <= len) || (want >= (size_t) f_stat.st_size) ||
+		    (len < want))
+			break;
+
+		want = ((off_t) header_len < f_stat.st_size) ?
+		    header_len : (size_t) f_stat.st_size;
+	}
+	close(fd);
+
+	memset(buf + len, 0, CHECK_BUFFER_PAD);
+
+	verdict = check_1B_header(buf, len, f_stat.st_size);
+	free(buf);
+	return verdict;
+}
@@ -8,19 +8,85 @@
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include "ami_1B.h"
 
 typedef enum {
 	LIST,
 	REPLACE_COMPONENT,
+	BUILD,
+	ACPI_REPLACE,
+	UNDO,
+	VARIANTS,
+	WATCH,
 } ACTION;
 
+#define MAX_SPEC_LINE	(MAX_PATH * 16)	// maximum length of a variant spec line
+
+// Exit code of the variants which verify the written 1B file, the same as
+// the manifest verification of ami_1b_splitter
+//
+typedef enum {
+	VERIFY_EXIT_MATCH = 0,
+	VERIFY_EXIT_MISMATCH = 1,
+	VERIFY_EXIT_ERROR = 2,
+} VERIFY_EXIT_CODE;
+
+/*
+ * Write the modified 1B data back to its 1B file and optionally verify the 
+ * file against the digests computed while writing it. If journal_filename 
+ * is given, the undo entry of the modification is appended to the journal 
+ * first.
+ *
+ *  input: 
+ *
+ *  p_data 		pointer to _1B_DATA_T structure representing the 1B file 
+ *
+ *  journal_filename	name of the undo journal, NULL for no journal
+ *
+ *  verify		non-zero to read the 1B file back (uncached) and verify it
+ *
+ *  return value:
+ *   SUCCESS 	on success
+ *   ERROR	on error
+ *   MISMATCH	if the 1B file on disk doesn't match the written data
+ *   
+ */
+static STATUS write_modified_1B_file(_1B_DATA_T * p_data,
+				     const char *journal_filename, int verify)
+{
+	STATUS status;
+
+	if ((journal_filename != NULL) &&
+	    (append_1B_journal(p_data, journal_filename) == ERROR)) {
+		printf("ERROR: Unable to journal the modification, "
+		       "1B file not modified\n");
+		return ERROR;
+	}
+
+	if (write_1B_data_to_file(p_data, get_1B_filename(p_data)) != 0) {
+		printf("ERROR: Failed writing modified 1B file\n");
+		return ERROR;
+	}
+	printf("Successfully writing modified 1B file\n");
+
+	if (!verify)
+		return SUCCESS;
+
+	status = verify_1B_output(p_data);
+	if (status == MISMATCH)
+		printf("ERROR: Modified 1B file doesn't match the written "
+		       "data\n");
+	return status;
+}
+
 /*
  * Insert 1B component from input file named component_filename to 
  * the 1B file represented by p_1b_data starting at file offset  
@@ -34,14 +100,20 @@ typedef enum {
  *
  *  component_filename	name of the component file to be inserted into the 1B file
  *
+ *  journal_filename	name of the undo journal, NULL for no journal
+ *
+ *  verify		non-zero to verify the 1B file after writing it
+ *
  *  return value:
  *   SUCCESS 	on success
  *   ERROR	on error
+ *   MISMATCH	if the verification of the 1B file fails
  *   
  */
 static STATUS
 replace_component(_1B_DATA_T * p_data, off_t component_offset,
-		  char *component_filename)
+		  char *component_filename, const char *journal_filename,
+		  int verify)
 {
 	_1B_COMPONENT_T *p_comp = NULL;
 	STATUS status;
@@ -79,27 +151,367 @@ replace_component(_1B_DATA_T * p_data, off_t component_offset,
 	}
 	// Write the modified 1B file buffer to its original file
 	//
-	if (write_1B_data_to_file(p_data, get_1B_filename(p_data)) == 0) {
-		printf("Successfully writing modified 1B file\n");
-		return SUCCESS;
-	} else {
-		printf("ERROR: Failed writing modified 1B file\n");
+	return write_modified_1B_file(p_data, journal_filename, verify);
+
+}
+
+/*
+ * Replace ACPI tables in the ACPITBL_SEG component of the 1B file. All 
+ * tables are replaced in memory first, then the 1B file is written once.
+ *
+ *  input: 
+ *
+ *  p_data 	pointer to _1B_DATA_T structure representing the 1B file 
+ *
+ *  count	number of tables to replace
+ *
+ *  args	pairs of table signature and name of the new table file
+ *
+ *  journal_filename	name of the undo journal, NULL for no journal
+ *
+ *  verify	non-zero to verify the 1B file after writing it
+ *
+ *  return value:
+ *   SUCCESS 	on success
+ *   ERROR	on error
+ *   MISMATCH	if the verification of the 1B file fails
+ *   
+ */
+static STATUS replace_acpi_tables(_1B_DATA_T * p_data, int count,
+				  char *args[], const char *journal_filename,
+				  int verify)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (replace_acpi_table_from_file(p_data, args[i * 2],
+						 args[i * 2 + 1]) == ERROR) {
+			printf("ERROR: Unable to replace ACPI table %s, "
+			       "1B file not modified\n", args[i * 2]);
+			return ERROR;
+		}
+	}
+
+	return write_modified_1B_file(p_data, journal_filename, verify);
+}
+
+/*
+ * Check whether filename_a and filename_b name the same file, by device
+ * and inode. A file which doesn't exist yet is identified by its directory
+ * and its name in it.
+ *
+ * return value:
+ * 	non-zero	if both names refer to the same file
+ * 	0		otherwise
+ */
+static int is_same_file(const char *filename_a, const char *filename_b)
+{
+	char dir_a[MAX_PATH], dir_b[MAX_PATH];
+	const char *p_name_a = NULL, *p_name_b = NULL;
+	struct stat stat_a, stat_b;
+	int exists_a, exists_b;
+
+	exists_a = (stat(filename_a, &stat_a) == 0);
+	exists_b = (stat(filename_b, &stat_b) == 0);
+	if (exists_a || exists_b)
+		return exists_a && exists_b && (stat_a.st_dev == stat_b.st_dev) &&
+		    (stat_a.st_ino == stat_b.st_ino);
+
+	p_name_a = strrchr(filename_a, '/');
+	p_name_b = strrchr(filename_b, '/');
+	snprintf(dir_a, sizeof(dir_a), "%.*s", (p_name_a == NULL) ? 1 :
+		 (int) (p_name_a - filename_a + 1),
+		 (p_name_a == NULL) ? "." : filename_a);
+	snprintf(dir_b, sizeof(dir_b), "%.*s", (p_name_b == NULL) ? 1 :
+		 (int) (p_name_b - filename_b + 1),
+		 (p_name_b == NULL) ? "." : filename_b);
+	p_name_a = (p_name_a == NULL) ? filename_a : p_name_a + 1;
+	p_name_b = (p_name_b == NULL) ? filename_b : p_name_b + 1;
+
+	return (!strcmp(p_name_a, p_name_b)) && (stat(dir_a, &stat_a) == 0) &&
+	    (stat(dir_b, &stat_b) == 0) && (stat_a.st_dev == stat_b.st_dev) &&
+	    (stat_a.st_ino == stat_b.st_ino);
+}
+
+/*
+ * Create the variants of the 1B file listed in the variant spec file and 
+ * write them concurrently. Each line of the spec file is the output 
+ * filename of one variant followed by component_name=component_filename 
+ * pairs, the components to be replaced in that variant. Empty lines and 
+ * lines starting with '#' are ignored. The variants share the data of the 
+ * components they don't replace with the base 1B file.
+ *
+ *  input: 
+ *
+ *  p_data 		pointer to _1B_DATA_T structure representing the base 1B file 
+ *
+ *  spec_filename	name of the variant spec file
+ *
+ *  verify		non-zero to verify each variant after writing it
+ *
+ *  return value:
+ *   SUCCESS 	on success
+ *   ERROR	on error
+ *   MISMATCH	if the verification of a variant fails
+ *   
+ */
+static STATUS write_variants(_1B_DATA_T * p_data, const char *spec_filename,
+			     int verify)
+{
+	FILE *f_spec = NULL;
+	char line[MAX_SPEC_LINE];
+	char *p_token, *p_file;
+	_1B_DATA_T **p_variants = NULL, **p_grown_variants = NULL;
+	char **filenames = NULL, **p_grown_filenames = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u32_t count = 0, line_number = 0, i;
+	STATUS status = SUCCESS;
+
+	f_spec = fopen(spec_filename, "r");
+	if (f_spec == NULL) {
+		printf("ERROR: Unable to open variant spec file %s\n",
+		       spec_filename);
+		return ERROR;
+	}
+
+	while ((status == SUCCESS) &&
+	       (fgets(line, sizeof(line), f_spec) != NULL)) {
+		line_number++;
+
+		p_token = strtok(line, " \t\r\n");
+		if ((p_token == NULL) || (p_token[0] == '#'))
+			continue;
+
+		if (is_same_file(p_token, get_1B_filename(p_data))) {
+			printf("ERROR: line %u: variant would overwrite the "
+			       "base 1B file\n", line_number);
+			status = ERROR;
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (is_same_file(p_token, filenames[i])) {
+				printf("ERROR: line %u: variant %s is the same "
+				       "file as variant %s\n", line_number,
+				       p_token, filenames[i]);
+				status = ERROR;
+				break;
+			}
+		}
+		if (status == ERROR)
+			break;
+
+		p_grown_variants = (_1B_DATA_T **)
+		    realloc(p_variants, (count + 1) * sizeof(_1B_DATA_T *));
+		if (p_grown_variants != NULL)
+			p_variants = p_grown_variants;
+		p_grown_filenames = (char **)
+		    realloc(filenames, (count + 1) * sizeof(char *));
+		if (p_grown_filenames != NULL)
+			filenames = p_grown_filenames;
+		if ((p_grown_variants == NULL) || (p_grown_filenames == NULL)) {
+			printf("ERROR: Not enough memory for the variants\n");
+			status = ERROR;
+			break;
+		}
+
+		p_variants[count] = clone_1B_data(p_data);
+		filenames[count] = strdup(p_token);
+		if ((p_variants[count] == NULL) || (filenames[count] == NULL)) {
+			cleanup_1B_data(p_variants[count]);
+			free(filenames[count]);
+			status = ERROR;
+			break;
+		}
+		count++;
+
+		// Replace the components of this variant
+		//
+		while ((p_token = strtok(NULL, " \t\r\n")) != NULL) {
+			p_file = strchr(p_token, '=');
+			if ((p_file == NULL) || (p_file == p_token) ||
+			    (p_file[1] == '\0')) {
+				printf("ERROR: line %u: expected "
+				       "component_name=component_filename, "
+				       "found %s\n", line_number, p_token);
+				status = ERROR;
+				break;
+			}
+			*p_file++ = '\0';
+
+			p_comp = get_component_from_name(p_variants[count - 1],
+							 p_token);
+			if ((p_comp == NULL) ||
+			    (is_component_data_present(p_comp) !=
+			     DATA_PRESENT)) {
+				printf("ERROR: line %u: component %s not "
+				       "present in the 1B file\n", line_number,
+				       p_token);
+				status = ERROR;
+				break;
+			}
+
+			if (replace_component_data(p_variants[count - 1], p_comp,
+						   p_file) == ERROR) {
+				printf("ERROR: line %u: unable to replace "
+				       "component %s\n", line_number, p_token);
+				status = ERROR;
+				break;
+			}
+		}
+	}
+	fclose(f_spec);
+
+	if ((status == SUCCESS) && (count == 0)) {
+		printf("ERROR: No variant in %s\n", spec_filename);
+		status = ERROR;
+	}
+
+	if (status == SUCCESS) {
+		printf("Writing %u variants of %s ..\n", count,
+		       get_1B_filename(p_data));
+		status = write_1B_variants(p_variants,
+					   (const char **) filenames, count);
+	}
+
+	for (i = 0; (i < count) && (status == SUCCESS) && verify; i++) {
+		status = verify_1B_output(p_variants[i]);
+		if (status == MISMATCH)
+			printf("ERROR: Variant %s doesn't match the written "
+			       "data\n", filenames[i]);
+	}
+
+	for (i = 0; i < count; i++) {
+		cleanup_1B_data(p_variants[i]);
+		free(filenames[i]);
+	}
+	free(p_variants);
+	free(filenames);
+
+	if (status == SUCCESS)
+		printf("Successfully writing %u variants\n", count);
+	return status;
+}
+
+/*
+ * Keep the 1B data resident and re-insert the components whose files in 
+ * component_dir change, writing the 1B file incrementally after each 
+ * change. Runs until an error occurs (or the program is interrupted).
+ *
+ *  input: 
+ *
+ *  p_data 		pointer to _1B_DATA_T structure representing the 1B file 
+ *
+ *  component_dir	directory with the component files, named after the components
+ *
+ *  journal_filename	name of the undo journal, NULL for no journal
+ *
+ *  verify		non-zero to verify the 1B file after each write
+ *
+ *  return value:
+ *   ERROR	on error
+ *   MISMATCH	if the verification of the 1B file fails
+ *   
+ */
+static STATUS watch_components(_1B_DATA_T * p_data, const char *component_dir,
+			       const char *journal_filename, int verify)
+{
+	_1B_WATCH_T *p_watch = NULL;
+	struct timespec start, end;
+	STATUS status = SUCCESS;
+	s32_t replaced;
+
+	p_watch = init_1B_watch(p_data, component_dir);
+	if (p_watch == NULL)
 		return ERROR;
+
+	printf("Watching component files in %s, press Ctrl-C to stop\n",
+	       component_dir);
+	fflush(stdout);
+
+	while (status == SUCCESS) {
+		replaced = wait_1B_watch(p_watch);
+		if (replaced == ERROR) {
+			status = ERROR;
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		status = write_modified_1B_file(p_data, journal_filename, verify);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (status == SUCCESS)
+			printf("Updated %s with %d component(s) in %.1f ms\n",
+			       get_1B_filename(p_data), replaced,
+			       (end.tv_sec - start.tv_sec) * 1000.0 +
+			       (end.tv_nsec - start.tv_nsec) / 1000000.0);
+		fflush(stdout);
 	}
 
+	cleanup_1B_watch(p_watch);
+	return status;
+}
+
+/*
+ * Return the exit code of a variant which verifies the written 1B file
+ */
+static int get_verify_exit_code(STATUS status)
+{
+	if (status == SUCCESS)
+		return VERIFY_EXIT_MATCH;
+	if (status == MISMATCH)
+		return VERIFY_EXIT_MISMATCH;
+	return VERIFY_EXIT_ERROR;
 }
 
 static void show_help(char *argv[])
 {
 	printf("Usage:\n"
-	       "%s --replace  1B_filename  component_filename  component_offset \n"
-	       "%s --list   1B_filename \n\n"
+	       "%s [--verify] [--journal] --replace  1B_filename  component_filename  component_offset \n"
+	       "%s --list   1B_filename \n"
+	       "%s --build  1B_filename  template_filename  component_dir \n"
+	       "%s [--verify] [--journal] --acpi-replace  1B_filename  table_signature  table_filename [table_signature  table_filename ...] \n"
+	       "%s --undo  1B_filename [count] \n"
+	       "%s [--verify] --variants  1B_filename  spec_filename \n"
+	       "%s [--verify] --batch-replace  component_name  component_filename  1B_filename [1B_filename ...] \n"
+	       "%s [--verify] [--journal] --watch  1B_filename  component_dir \n\n"
 	       "In the first variant, this program will replace the component named component_filename\n"
 	       "in the 1B file starting at offset component offset. The program checks \n"
 	       "the replaced component size and start offset, if the program found the start offset\n"
 	       "is incorrect, it will bail out with error message.\n\n"
 	       "In the second variant, this program only lists the components inside the 1B file\n"
-	       "along with their information\n", argv[0], argv[0]);
+	       "along with their information\n\n"
+	       "In the third variant, this program assembles a new 1B file from the component files\n"
+	       "in component_dir (as written by ami_1b_splitter --extract-all). template_filename is\n"
+	       "the raw 1B header, the original 1B file or its manifest. The length of each component\n"
+	       "file must match the length in the header.\n\n"
+	       "In the fourth variant, this program replaces the ACPI tables table_signature (e.g. DSDT,\n"
+	       "or SSDT:1 for the second SSDT) in the ACPITBL_SEG component with the tables in\n"
+	       "table_filename, fixes their checksums and writes the 1B file once.\n\n"
+	       "With --verify, the first and fourth variants read the 1B file back bypassing the page\n"
+	       "cache and compare it with the SHA-256 digests computed while writing it. The exit code\n"
+	       "of these variants is 0 on success, 1 if the verification fails and 2 on error.\n\n"
+	       "With --journal, the first and fourth variants append the old header and the old data\n"
+	       "of the modified components to the undo journal 1B_filename" JOURNAL_SUFFIX " before\n"
+	       "writing the 1B file.\n\n"
+	       "In the fifth variant, this program undoes the last count (default: all) journaled\n"
+	       "modifications of the 1B file, newest first, and removes them from the journal.\n\n"
+	       "In the sixth variant, this program writes one variant of the 1B file per line of\n"
+	       "spec_filename. Each line is the variant filename followed by component_name=filename\n"
+	       "pairs of the components replaced in that variant. The variants are written concurrently,\n"
+	       "each as an in-kernel copy of the 1B file with only the replaced components rewritten.\n"
+	       "With --verify, each variant is verified after writing it.\n\n"
+	       "In the seventh variant, this program replaces the component component_name in all the\n"
+	       "1B files with component_filename, processing the 1B files in parallel. Each 1B file is\n"
+	       "written to a temporary file which is flushed (and verified with --verify) and renamed\n"
+	       "over the 1B file. A report of each 1B file is printed at the end, the exit code is 1\n"
+	       "if any 1B file failed.\n\n"
+	       "In the eighth variant, this program keeps the 1B file in memory and watches the component\n"
+	       "files in component_dir (as written by ami_1b_splitter --extract-all). When a component\n"
+	       "file changes, only that component is re-inserted and the 1B file is updated in place.\n"
+	       "With --verify and --journal, each update is verified and journaled as in the first variant.\n",
+	       argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+	       argv[0]);
 }
 
 
@@ -107,8 +519,14 @@ int main(int argc, char *argv[])
 {
 /*
  * Program Invocation:  
- *  	./ami_1B_combiner  --replace  1B_filename  component_filename  component_offset
+ *  	./ami_1B_combiner  [--verify] [--journal] --replace  1B_filename  component_filename  component_offset
  *  	./ami_1B_combiner  --list   1B_filename 
+ *  	./ami_1B_combiner  --build  1B_filename  template_filename  component_dir
+ *  	./ami_1B_combiner  [--verify] [--journal] --acpi-replace  1B_filename  table_signature  table_filename [...]
+ *  	./ami_1B_combiner  --undo  1B_filename [count]
+ *  	./ami_1B_combiner  [--verify] --variants  1B_filename  spec_filename
+ *  	./ami_1B_combiner  [--verify] --batch-replace  component_name  component_filename  1B_filename [...]
+ *  	./ami_1B_combiner  [--verify] [--journal] --watch  1B_filename  component_dir
  *
  *  In the first variant, this program will replace the component named component_filename 
  *  in the 1B file starting at offset component offset. The program checks the replaced component 
@@ -118,13 +536,79 @@ int main(int argc, char *argv[])
  *  In the second variant, this program only lists the components inside the 1B file along with 
  *  their information
  *
+ *  In the third variant, this program assembles a new 1B file from the component files in 
+ *  component_dir in a single pass. The header is taken from template_filename, i.e. the raw 
+ *  1B header, the original 1B file or its manifest. The program bails out with error message 
+ *  if the length of a component file doesn't match the length in the header. 
+ *
+ *  In the fourth variant, this program replaces ACPI tables in the ACPITBL_SEG component by 
+ *  signature, fixes their checksums in memory and writes the 1B file once. 
+ *
+ *  With --verify, the first and fourth variants re-read the written 1B file bypassing the 
+ *  page cache and compare it with the SHA-256 digests of the header and components computed 
+ *  while writing them. The exit code of these variants is 0 on success, 1 if the 
+ *  verification fails and 2 on error. 
+ *
+ *  With --journal, the first and fourth variants append an undo entry to the journal 
+ *  1B_filename.journal before writing the 1B file. The entry holds only the old header and 
+ *  the old data of the modified components. 
+ *
+ *  In the fifth variant, this program undoes the last count (default: all) journaled 
+ *  modifications of the 1B file, newest first, without a backup copy of the 1B file. 
+ *
+ *  In the sixth variant, this program creates one variant of the 1B file per line of 
+ *  spec_filename ("variant_filename component_name=component_filename ..."). The variants 
+ *  share the unmodified components with the 1B file in memory, and each variant file is an 
+ *  in-kernel (reflink where supported) copy of the 1B file with only its replaced 
+ *  components written, so the cost of a variant scales with its differences. 
+ *
+ *  In the seventh variant, this program rolls out one component replacement to many 1B 
+ *  files. The new component data is read once, the component is located by name in each 
+ *  1B file and the 1B files are processed by a pool of threads. Each 1B file is written to 
+ *  a temporary file which is flushed to disk (and verified with --verify) before it's 
+ *  renamed over the 1B file, so a failed 1B file is never left half-written. 
+ *
+ *  In the eighth variant, this program parses the 1B file once and watches the extracted 
+ *  component files in component_dir (inotify). Each time a component file changes, only 
+ *  that component is re-inserted and the 1B file is rewritten incrementally, so the 
+ *  edit-to-image latency is a few milliseconds instead of a full run of --replace. 
+ *
  */
 	off_t component_offset = 0;
 	_1B_DATA_T *p_1b_data;
 	ACTION act;
 	char path[MAX_PATH];
+	char journal_path[MAX_PATH];
+	const char *journal_filename = NULL;
+	int verify = 0, journal = 0, exit_code = 0;
+	u32_t count = 0;
+	STATUS status;
 
-	if ((argc != 3) && (argc != 5)) {
+	// Strip the --verify and --journal options, keeping argv[0] for 
+	// the help text
+	//
+	while ((argc > 1) && ((!strcmp(argv[1], "--verify")) ||
+			      (!strcmp(argv[1], "--journal")))) {
+		if (!strcmp(argv[1], "--verify"))
+			verify = 1;
+		else
+			journal = 1;
+
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
+
+	// The journal of a 1B file is named after it
+	//
+	if (argc >= 3) {
+		snprintf(journal_path, sizeof(journal_path), "%s%s", argv[2],
+			 JOURNAL_SUFFIX);
+		if (journal)
+			journal_filename = journal_path;
+	}
+
+	if (argc < 3) {
 		show_help(argv);
 		return 0;
 	}
@@ -135,6 +619,53 @@ int main(int argc, char *argv[])
 		printf("argc = 3, --list\n");
 #endif
 		act = LIST;
+	} else if ((argc == 5) && (!strcmp(argv[1], "--build"))) {
+#ifdef DEBUG
+		printf("argc = 5, --build\n");
+#endif
+		// The 1B file doesn't exist yet, build it right away
+		//
+		return (build_1B_file(argv[2], argv[3], argv[4]) == SUCCESS) ?
+		    0 : 1;
+	} else if (((argc == 3) || (argc == 4)) &&
+		   (!strcmp(argv[1], "--undo"))) {
+#ifdef DEBUG
+		printf("argc = %d, --undo\n", argc);
+#endif
+		if ((argc == 4) && (sscanf(argv[3], "%u", &count) != 1)) {
+			printf("count is incorrect\n");
+			return 1;
+		}
+
+		// undo_1B_journal() reads the 1B file itself, undo right away
+		//
+		return (undo_1B_journal(argv[2], journal_path, count) ==
+			SUCCESS) ? 0 : 1;
+	} else if ((argc >= 5) && (!strcmp(argv[1], "--batch-replace"))) {
+#ifdef DEBUG
+		printf("argc = %d, --batch-replace\n", argc);
+#endif
+		// Each 1B file is read by the worker threads, replace right away
+		//
+		return (replace_component_batch((const char **) &argv[4],
+						argc - 4, argv[2], argv[3],
+						verify) == 0) ? 0 : 1;
+	} else if ((argc == 4) && (!strcmp(argv[1], "--watch"))) {
+#ifdef DEBUG
+		printf("argc = 4, --watch\n");
+#endif
+		act = WATCH;
+	} else if ((argc == 4) && (!strcmp(argv[1], "--variants"))) {
+#ifdef DEBUG
+		printf("argc = 4, --variants\n");
+#endif
+		act = VARIANTS;
+	} else if ((argc >= 5) && (argc % 2) &&
+		   (!strcmp(argv[1], "--acpi-replace"))) {
+#ifdef DEBUG
+		printf("argc = %d, --acpi-replace\n", argc);
+#endif
+		act = ACPI_REPLACE;
 	} else if ((argc == 5) && (!strcmp(argv[1], "--replace"))) {
 #ifdef DEBUG
 		printf("argc = 5, --replace\n");
@@ -175,8 +706,33 @@ int main(int argc, char *argv[])
 		case REPLACE_COMPONENT:
 			// replace component file to 1B and write the result to the 1B file 
 			//
-			replace_component(p_1b_data, component_offset,
-					  path);
+			status = replace_component(p_1b_data, component_offset,
+						   path, journal_filename, verify);
+			exit_code = get_verify_exit_code(status);
+			break;
+
+		case ACPI_REPLACE:
+			// Replace the ACPI tables and write the 1B file once
+			//
+			status = replace_acpi_tables(p_1b_data, (argc - 3) / 2,
+						     &argv[3], journal_filename,
+						     verify);
+			exit_code = get_verify_exit_code(status);
+			break;
+
+		case WATCH:
+			// Re-insert the changed components until stopped
+			//
+			status = watch_components(p_1b_data, argv[3],
+						  journal_filename, verify);
+			exit_code = get_verify_exit_code(status);
+			break;
+
+		case VARIANTS:
+			// Write the variants of the 1B file concurrently
+			//
+			status = write_variants(p_1b_data, argv[3], verify);
+			exit_code = get_verify_exit_code(status);
 			break;
 
 		case LIST:
@@ -194,5 +750,5 @@ int main(int argc, char *argv[])
 		cleanup_1B_data(p_1b_data);
 	}
 
-	return 0;
+	return exit_code;
 }
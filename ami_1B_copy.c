@@ -0,0 +1,296 @@
+/*
+ * ami_1B_copy.c
+ *
+ * Extract a component by copying its byte range out of the 1B file
+ * in-kernel, without reading the component data into a user-space buffer.
+ * The range is cloned (reflink) when the filesystem supports it (btrfs,
+ * XFS), otherwise it is copied with copy_file_range(). A small bounce
+ * buffer is used when neither is available. Whole 1B files are copied the
+ * same way to start the files of 1B variants (see ami_1B_variant.c).
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE		/** Required for copy_file_range() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>		/** Required for FICLONERANGE */
+#endif
+
+#include "ami_1B_internal.h"
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+#define COPY_BUFFER_SIZE	0x10000	// size of the bounce buffer used when
+					// the range can't be copied in-kernel
+
+// Method used to copy a component range
+//
+typedef enum {
+	COPY_REFLINK = 0,
+	COPY_FILE_RANGE = 1,
+	COPY_BUFFER = 2,
+} COPY_METHOD;
+
+
+/*
+ * Copy len bytes starting at offset of file fd_in to the start of file
+ * fd_out through a bounce buffer.
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS copy_range_buffered(int fd_in, off_t offset, int fd_out,
+				  off_t copied, u32_t len)
+{
+	u8_t *p_buf = NULL;
+	ssize_t read_size, written_size, chunk_written;
+
+	p_buf = (u8_t *) malloc(COPY_BUFFER_SIZE);
+	if (p_buf == NULL) {
+		printf("ERROR: function %s() unable to allocate copy "
+		       "buffer\n", __func__);
+		return ERROR;
+	}
+
+	if ((lseek(fd_in, offset + copied, SEEK_SET) < 0) ||
+	    (lseek(fd_out, copied, SEEK_SET) < 0)) {
+		free(p_buf);
+		return ERROR;
+	}
+
+	while (copied < len) {
+		read_size = len - copied;
+		if (read_size > COPY_BUFFER_SIZE)
+			read_size = COPY_BUFFER_SIZE;
+
+		read_size = read(fd_in, p_buf, read_size);
+		if (read_size <= 0) {
+			free(p_buf);
+			return ERROR;
+		}
+
+		chunk_written = 0;
+		while (chunk_written < read_size) {
+			written_size = write(fd_out, p_buf + chunk_written,
+					     read_size - chunk_written);
+			if (written_size <= 0) {
+				free(p_buf);
+				return ERROR;
+			}
+			chunk_written += written_size;
+		}
+
+		copied += read_size;
+	}
+
+	free(p_buf);
+	return SUCCESS;
+}
+
+
+/*
+ * Copy len bytes starting at offset of file fd_in to the start of file
+ * fd_out, in-kernel if possible.
+ *
+ * output:
+ * 	p_method	the method used to copy the range
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS copy_range(int fd_in, off_t offset, int fd_out, u32_t len,
+			 COPY_METHOD * p_method)
+{
+	off_t copied = 0;
+#ifdef __linux__
+	struct file_clone_range clone;
+	loff_t off_in, off_out;
+	ssize_t copy_size = 0;
+
+	// Share the extents of the range with the output file. Only works
+	// if the range is aligned to the filesystem block size or ends at
+	// the end of the 1B file.
+	//
+	clone.src_fd = fd_in;
+	clone.src_offset = offset;
+	clone.src_length = len;
+	clone.dest_offset = 0;
+	if (ioctl(fd_out, FICLONERANGE, &clone) == 0) {
+		*p_method = COPY_REFLINK;
+		return SUCCESS;
+	}
+
+	off_in = offset;
+	off_out = 0;
+	while (copied < len) {
+		copy_size = copy_file_range(fd_in, &off_in, fd_out, &off_out,
+					    len - copied, 0);
+		if (copy_size <= 0)
+			break;
+
+		copied += copy_size;
+	}
+
+	if (copied == len) {
+		*p_method = COPY_FILE_RANGE;
+		return SUCCESS;
+	}
+	// Bail out on I/O errors. Otherwise copy_file_range() isn't 
+	// supported between these files (e.g. old kernel or different 
+	// filesystems), finish the copy through the bounce buffer.
+	//
+	if ((copy_size < 0) && (errno != EXDEV) && (errno != ENOSYS) &&
+	    (errno != EINVAL) && (errno != EOPNOTSUPP))
+		return ERROR;
+#endif
+
+	*p_method = COPY_BUFFER;
+	return copy_range_buffered(fd_in, offset, fd_out, copied, len);
+}
+
+
+/*
+ * Copy the data of component p_component from the 1B file to output file
+ * filename without reading the data into a buffer. The component data in
+ * the 1B file on disk is used, so p_data may come from init_1B_header().
+ * Components modified since they were read are written from their buffer.
+ *
+ * input:
+ * 	p_data		pointer to initialized _1B_DATA_T
+ * 	p_component	pointer to the component to be copied
+ * 	filename	name of the output file, NULL to use the component name
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS copy_component_data_to_file(_1B_DATA_T * p_data,
+				   _1B_COMPONENT_T * p_component,
+				   const char *filename)
+{
+	static const char *method_name[] = {
+		"reflink", "copy_file_range", "read/write"
+	};
+	COPY_METHOD method = COPY_BUFFER;
+	int fd_in, fd_out;
+	STATUS status;
+
+	if ((p_data == NULL) || (p_component == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	if ((p_component->data_presence != DATA_PRESENT) ||
+	    (p_component->length == 0)) {
+		printf("ERROR: function %s() component data not present\n",
+		       __func__);
+		return ERROR;
+	}
+
+	if (filename == NULL)
+		filename = p_component->name;
+
+	// The 1B file on disk doesn't contain the modified data
+	//
+	if (p_component->data_state == DATA_DIRTY) {
+		printf("%s: Writing component data to %s ..\n", __func__,
+		       filename);
+		return write_data_to_named_file(filename, p_component->p_buf,
+						p_component->length);
+	}
+
+	fd_in = open(p_data->filename, O_RDONLY | O_BINARY);
+	if (fd_in < 0) {
+		printf("ERROR: function %s() unable to open 1B file %s\n",
+		       __func__, p_data->filename);
+		return ERROR;
+	}
+
+	fd_out = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+		      0644);
+	if (fd_out < 0) {
+		printf("ERROR: Unable to create output file"
+		       " for writing\n");
+		close(fd_in);
+		return ERROR;
+	}
+
+	status = copy_range(fd_in, p_component->disk_offset, fd_out,
+			    p_component->length, &method);
+	if (status == ERROR)
+		printf("%s: Error copying component data to %s\n", __func__,
+		       filename);
+	else
+		printf("%s: Copied component data to %s (%s)\n", __func__,
+		       filename, method_name[method]);
+
+	if (close(fd_out) != 0)
+		status = ERROR;
+	close(fd_in);
+
+	return status;
+}
+
+
+/*
+ * Copy the first len bytes of file filename_in to file filename_out (created
+ * or truncated) in-kernel if possible. On reflink-capable filesystems the
+ * copy shares all extents with filename_in.
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS copy_file_data(const char *filename_in, const char *filename_out,
+		      u32_t len)
+{
+	COPY_METHOD method = COPY_BUFFER;
+	int fd_in, fd_out;
+	STATUS status;
+
+	fd_in = open(filename_in, O_RDONLY | O_BINARY);
+	if (fd_in < 0) {
+		printf("ERROR: function %s() unable to open %s\n", __func__,
+		       filename_in);
+		return ERROR;
+	}
+
+	fd_out = open(filename_out, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+		      0644);
+	if (fd_out < 0) {
+		printf("ERROR: function %s() unable to create %s\n",
+		       __func__, filename_out);
+		close(fd_in);
+		return ERROR;
+	}
+
+	status = copy_range(fd_in, 0, fd_out, len, &method);
+	if (status == ERROR)
+		printf("%s: Error copying %s to %s\n", __func__, filename_in,
+		       filename_out);
+
+	if (close(fd_out) != 0)
+		status = ERROR;
+	close(fd_in);
+
+	return status;
+}
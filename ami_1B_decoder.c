@@ -0,0 +1,295 @@
+/*
+ * ami_1B_decoder.c
+ *
+ * Header variant decoders. AMIBIOS8 revisions differ in the layout of the
+ * component string table which follows the component entries in the 1B
+ * header (version 4.00 headers pad the names to 5 bytes more than their
+ * length, newer ones to 4 bytes, some headers have no names at all). The
+ * variant of each 1B file is detected once, by trying the decoders of the
+ * registry below in order until one of them accepts the whole string table,
+ * and the chosen decoder then names all components in one pass. Support for
+ * a new layout is added by adding its decoder to the registry.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+#define STRING_TABLE_MARKER	"RUN_"	// start of the name of the first
+					// component (RUN_CSEG)
+
+#define STRING_VERSION_OFFSET	2	// "00" of version 4.00 headers, relative
+					// to the end of the component entries
+
+/*
+ * Find the first byte c in p[start..end) testing 8 bytes per step
+ *
+ * return value:
+ * 	end			if not found
+ * 	offset of the byte	on success
+ */
+static u32_t find_byte(const u8_t * p, u32_t start, u32_t end, u8_t c)
+{
+	const u64_t pattern = SWAR_ONES * c;
+	u64_t v;
+	u32_t i = start;
+
+	while (i + 8 <= end) {
+		memcpy(&v, p + i, 8);
+		if (SWAR_HAS_ZERO(v ^ pattern))
+			break;
+		i += 8;
+	}
+
+	for (; i < end; i++) {
+		if (p[i] == c)
+			return i;
+	}
+
+	return end;
+}
+
+
+/*
+ * Find the start of the component string table, i.e. the name of the first
+ * component, after the component entries
+ *
+ * output:
+ * 	p_offset	offset of the string table in the header
+ *
+ * return value:
+ * 	STRING_ABSENT	if the header has no string table
+ * 	STRING_PRESENT	on success
+ */
+STRING_PRESENCE find_string_table(const u8_t * p_header, u16_t header_len,
+				  u16_t count, u16_t * p_offset)
+{
+	const size_t marker_len = strlen(STRING_TABLE_MARKER);
+	u32_t offset;
+
+	// The names follow the entries and the version bytes
+	//
+	offset = HEADER_CONTENTS_OFFSET + (u32_t) count * COMPONENT_INFO_LENGTH +
+	    4;
+
+	while (offset + marker_len <= header_len) {
+		offset = find_byte(p_header, offset, header_len - marker_len + 1,
+				   STRING_TABLE_MARKER[0]);
+		if (offset + marker_len > header_len)
+			break;
+
+		if (!memcmp(p_header + offset, STRING_TABLE_MARKER, marker_len)) {
+			*p_offset = offset;
+			return STRING_PRESENT;
+		}
+		offset++;
+	}
+
+	return STRING_ABSENT;
+}
+
+
+/*
+ * Split the string table starting at offset into count names, each one a
+ * printable, NUL-terminated string inside the header followed by pad_length
+ * bytes (including its NUL) before the next one
+ *
+ * return value:
+ * 	ERROR 	if the string table doesn't have this layout
+ * 	SUCCESS	on success
+ */
+static STATUS split_string_table(const u8_t * p_header, u16_t header_len,
+				 u16_t count, u32_t offset, u16_t pad_length,
+				 STRING_TABLE_T * p_table)
+{
+	u32_t end, c;
+	u16_t i;
+
+	for (i = 0; i < count; i++) {
+		if (offset >= header_len)
+			return ERROR;
+
+		end = find_byte(p_header, offset, header_len, '\0');
+		if ((end == header_len) || (end == offset) ||
+		    (end - offset >= MAX_COMPONENT_NAME))
+			return ERROR;
+
+		for (c = offset; c < end; c++) {
+			if ((p_header[c] < 0x21) || (p_header[c] > 0x7E))
+				return ERROR;
+		}
+
+		p_table->offset[i] = offset;
+		p_table->length[i] = end - offset;
+
+		offset = end + pad_length;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Names padded to string_pad_length bytes more than their length, any
+ * header version
+ */
+static STATUS detect_padded_names(const HEADER_DECODER_T * p_decoder,
+				  const u8_t * p_header, u16_t header_len,
+				  u16_t count, STRING_TABLE_T * p_table)
+{
+	u16_t offset;
+
+	if (find_string_table(p_header, header_len, count, &offset) ==
+	    STRING_ABSENT)
+		return ERROR;
+
+	return split_string_table(p_header, header_len, count, offset,
+				  p_decoder->string_pad_length, p_table);
+}
+
+
+/*
+ * Version 4.00 header ("00" after the component entries) with names padded
+ * to 5 bytes more than their length
+ */
+static STATUS detect_v400_names(const HEADER_DECODER_T * p_decoder,
+				const u8_t * p_header, u16_t header_len,
+				u16_t count, STRING_TABLE_T * p_table)
+{
+	u32_t version = HEADER_CONTENTS_OFFSET +
+	    (u32_t) count * COMPONENT_INFO_LENGTH + STRING_VERSION_OFFSET;
+
+	if ((version + 2 > header_len) ||
+	    (memcmp(p_header + version, "00", 2)))
+		return ERROR;
+
+	return detect_padded_names(p_decoder, p_header, header_len, count,
+				   p_table);
+}
+
+
+/*
+ * No string table (or one which doesn't match any known layout), accepts
+ * every header
+ */
+static STATUS detect_no_names(const HEADER_DECODER_T * p_decoder,
+			      const u8_t * p_header, u16_t header_len,
+			      u16_t count, STRING_TABLE_T * p_table)
+{
+	return SUCCESS;
+}
+
+
+static void decode_table_names(_1B_DATA_T * p_data,
+			       const STRING_TABLE_T * p_table)
+{
+	u16_t i;
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		memcpy(p_data->component[i].name,
+		       p_data->header.p_buf + p_table->offset[i],
+		       p_table->length[i]);
+		p_data->component[i].name[p_table->length[i]] = '\0';
+	}
+}
+
+
+static void decode_generated_names(_1B_DATA_T * p_data,
+				   const STRING_TABLE_T * p_table)
+{
+	u16_t i;
+
+	for (i = 0; i < p_data->header.component_info_count; i++)
+		snprintf(p_data->component[i].name, MAX_COMPONENT_NAME,
+			 "_1B_component_%02Xh", i);
+}
+
+
+// Decoder registry, tried in order. The last decoder accepts any header.
+//
+static const HEADER_DECODER_T decoder_registry[] = {
+	{"AMIBIOS8 v4.00 header, 5-byte name pad", STRING_PRESENT, 5,
+	 detect_v400_names, decode_table_names},
+	{"AMIBIOS8 header, 4-byte name pad", STRING_PRESENT, 4,
+	 detect_padded_names, decode_table_names},
+	{"AMIBIOS8 header without component names", STRING_ABSENT, 0,
+	 detect_no_names, decode_generated_names},
+};
+
+#define DECODER_COUNT	(sizeof(decoder_registry) / sizeof(decoder_registry[0]))
+
+
+/*
+ * Detect the header variant of the 1B header in p_header by trying the
+ * decoders of the registry in order
+ *
+ * input:
+ * 	p_header	pointer to the header
+ * 	header_len	length of the header
+ * 	count		number of component entries in the header
+ *
+ * output:
+ * 	p_table		the split string table (if the variant has one)
+ *
+ * return value:
+ * 	the decoder of the header variant (never NULL)
+ */
+const HEADER_DECODER_T *detect_header_variant(const u8_t * p_header,
+					      u16_t header_len, u16_t count,
+					      STRING_TABLE_T * p_table)
+{
+	u32_t i;
+
+	for (i = 0; i < DECODER_COUNT - 1; i++) {
+		if (decoder_registry[i].detect(&decoder_registry[i], p_header,
+					       header_len, count,
+					       p_table) == SUCCESS)
+			break;
+	}
+
+	return &decoder_registry[i];
+}
+
+
+/*
+ * Detect the header variant of the parsed 1B header and name all
+ * components with its decoder
+ *
+ * input:
+ * 	p_data	pointer to 1B data with the header in p_data->header.p_buf,
+ * 		header.length and header.component_info_count set
+ */
+void decode_component_names(_1B_DATA_T * p_data)
+{
+	STRING_TABLE_T table;
+	const HEADER_DECODER_T *p_decoder = NULL;
+
+	p_decoder = detect_header_variant(p_data->header.p_buf,
+					  p_data->header.length,
+					  p_data->header.component_info_count,
+					  &table);
+
+	p_data->header.p_decoder = p_decoder;
+	p_data->header.string_status = p_decoder->string_status;
+	p_data->header.string_pad_length = p_decoder->string_pad_length;
+
+	p_decoder->decode_names(p_data, &table);
+}
+
+
+/*
+ * Return the name of the header variant detected when the 1B file was
+ * parsed
+ */
+const char *get_header_variant(_1B_DATA_T * p_data)
+{
+	if ((p_data == NULL) || (p_data->header.p_decoder == NULL))
+		return "unknown";
+
+	return p_data->header.p_decoder->name;
+}
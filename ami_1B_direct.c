@@ -0,0 +1,317 @@
+/*
+ * ami_1B_direct.c
+ *
+ * Reading 1B files without going through the page cache, for scans of
+ * large archives where each 1B file is read once and caching it would only
+ * evict the data other processes need. On Linux the files are read with
+ * O_DIRECT into aligned buffers, in large reads covering whole aligned
+ * blocks; the header and components start at arbitrary (unaligned) file
+ * offsets, so they're cut out of the aligned blocks. On filesystems which
+ * don't support O_DIRECT, the files are read normally and their pages are
+ * dropped from the page cache afterwards.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE		/** Required for O_DIRECT */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ami_1B_internal.h"
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+#define DIRECT_READ_SIZE	(4 * 1024 * 1024)	// largest single read
+
+#define ALIGN_DOWN(x)	((x) & ~((off_t) DIRECT_IO_ALIGNMENT - 1))
+
+#define ALIGN_UP(x)	ALIGN_DOWN((x) + DIRECT_IO_ALIGNMENT - 1)
+
+static READ_MODE read_mode = READ_BUFFERED;
+
+
+/*
+ * Select how the library reads 1B files (init_1B_data(), init_1B_header()
+ * and the functions using them). The default is READ_BUFFERED.
+ */
+void set_1B_read_mode(READ_MODE mode)
+{
+	read_mode = mode;
+}
+
+
+READ_MODE get_1B_read_mode(void)
+{
+	return read_mode;
+}
+
+
+/*
+ * Allocate a buffer suitable for O_DIRECT reads, release it with free()
+ */
+void *alloc_aligned_buffer(size_t size)
+{
+#ifdef _WIN32
+	return malloc(size);
+#else
+	void *p_buf = NULL;
+
+	if (posix_memalign(&p_buf, DIRECT_IO_ALIGNMENT, size) != 0)
+		return NULL;
+	return p_buf;
+#endif
+}
+
+
+/*
+ * Open filename for reading without going through the page cache.
+ *
+ * input:
+ * 	filename	name of the file
+ * 	direct		non-zero to try O_DIRECT first
+ *
+ * output:
+ * 	p_direct	non-zero if the file was opened with O_DIRECT
+ *
+ * return value:
+ * 	-1		on error
+ * 	file descriptor	on success
+ */
+int open_uncached_file(const char *filename, int direct, int *p_direct)
+{
+	int fd;
+
+	*p_direct = 0;
+
+#if defined(__linux__) && defined(O_DIRECT)
+	if (direct) {
+		fd = open(filename, O_RDONLY | O_DIRECT);
+		if (fd >= 0) {
+			*p_direct = 1;
+			return fd;
+		}
+	}
+#endif
+
+	fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return -1;
+
+	// Write back the dirty pages so they can be dropped, then drop them
+	//
+#ifndef _WIN32
+	fsync(fd);
+#endif
+	drop_cached_file(fd);
+
+	return fd;
+}
+
+
+/*
+ * Drop the cached pages of the file from the page cache
+ */
+void drop_cached_file(int fd)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+
+/*
+ * Read len bytes at file offset offset (both multiples of
+ * DIRECT_IO_ALIGNMENT) into the aligned buffer p_buf. Retries the read
+ * without O_DIRECT if the filesystem refuses it.
+ *
+ * return value:
+ * 	-1		on error
+ * 	bytes read	on success (less than len at the end of the file)
+ */
+static ssize_t read_aligned(const char *filename, int *p_fd, int *p_direct,
+			    void *p_buf, off_t offset, size_t len)
+{
+	ssize_t read_size, done = 0;
+
+	while ((size_t) done < len) {
+		if (lseek(*p_fd, offset + done, SEEK_SET) != offset + done)
+			return -1;
+
+		read_size = read(*p_fd, p_buf + done, len - done);
+
+		// The filesystem accepted O_DIRECT on open but not on read
+		//
+		if ((read_size < 0) && (errno == EINVAL) && *p_direct) {
+			close(*p_fd);
+			*p_fd = open_uncached_file(filename, 0, p_direct);
+			if (*p_fd < 0)
+				return -1;
+			continue;
+		}
+
+		if (read_size < 0)
+			return -1;
+		if (read_size == 0)
+			break;
+
+		done += read_size;
+	}
+
+	return done;
+}
+
+
+/*
+ * Read size bytes starting at file offset start_offset of file filename,
+ * bypassing the page cache. The range is read in one aligned read covering
+ * it, start_offset and size don't have to be aligned.
+ *
+ * return value:
+ * 	NULL		on error
+ * 	pointer to malloc()-ed buffer holding the range on success
+ */
+void *read_file_chunk_direct(const char *filename, off_t start_offset,
+			     size_t size)
+{
+	void *p_chunk = NULL, *p_block = NULL;
+	off_t block_start = ALIGN_DOWN(start_offset);
+	size_t block_len = ALIGN_UP(start_offset + (off_t) size) -
+	    block_start;
+	ssize_t read_size;
+	int fd, direct;
+
+	p_chunk = malloc(size);
+	p_block = alloc_aligned_buffer(block_len);
+	if ((p_chunk == NULL) || (p_block == NULL)) {
+		printf("ERROR: Unable to allocate memory for file chunk\n");
+		free(p_chunk);
+		free(p_block);
+		return NULL;
+	}
+
+	fd = open_uncached_file(filename, 1, &direct);
+	if (fd < 0) {
+		printf("ERROR: Unable to open input file\n");
+		free(p_chunk);
+		free(p_block);
+		return NULL;
+	}
+
+	read_size = read_aligned(filename, &fd, &direct, p_block, block_start,
+				 block_len);
+	if (read_size < (ssize_t) (start_offset - block_start + size)) {
+		printf("ERROR reading from input file\n");
+		free(p_chunk);
+		p_chunk = NULL;
+	} else {
+		memcpy(p_chunk, p_block + (start_offset - block_start), size);
+	}
+
+	if (fd >= 0) {
+		if (!direct)
+			drop_cached_file(fd);
+		close(fd);
+	}
+	free(p_block);
+	return p_chunk;
+}
+
+
+/*
+ * Read the whole 1B file bypassing the page cache and parse it. The file is
+ * read sequentially in large aligned reads (a single read for most 1B
+ * files), which are fed to the push parser to cut the header and the
+ * components out of them.
+ *
+ * NOTE: You must call cleanup cleanup_1B_data() when you're finished using
+ * 	 the dynamic data structures created by this function.
+ *
+ * input:
+ * 	filename	1B filename string
+ *
+ * returns:
+ * 	NULL	on error
+ * 	Pointer to initialized _1B_DATA_T on success
+ */
+_1B_DATA_T *init_1B_data_direct(const char *filename)
+{
+	_1B_PARSER_T *p_parser = NULL;
+	_1B_DATA_T *p_data = NULL;
+	struct stat f_stat;
+	void *p_block = NULL;
+	size_t block_len;
+	ssize_t read_size;
+	off_t offset = 0;
+	int fd, direct;
+	STATUS status = SUCCESS;
+
+	if (stat(filename, &f_stat) != 0) {
+		printf("ERROR: unable to get 1B input file statistics\n");
+		return NULL;
+	}
+
+	if (f_stat.st_size < HEADER_INFO_LENGTH) {
+		printf("ERROR: Invalid 1B input file\n");
+		return NULL;
+	}
+
+	block_len = ALIGN_UP(f_stat.st_size);
+	if (block_len > DIRECT_READ_SIZE)
+		block_len = DIRECT_READ_SIZE;
+
+	p_block = alloc_aligned_buffer(block_len);
+	p_parser = init_1B_parser(filename, NULL, NULL);
+	if ((p_block == NULL) || (p_parser == NULL)) {
+		printf("ERROR: unable to allocate memory for 1B "
+		       "file data\n");
+		free(p_block);
+		cleanup_1B_parser(p_parser);
+		return NULL;
+	}
+
+	fd = open_uncached_file(filename, 1, &direct);
+	if (fd < 0) {
+		printf("ERROR: Unable to open input file\n");
+		free(p_block);
+		cleanup_1B_parser(p_parser);
+		return NULL;
+	}
+
+	while ((offset < f_stat.st_size) && (status == SUCCESS)) {
+		read_size = read_aligned(filename, &fd, &direct, p_block,
+					 offset, block_len);
+		if (read_size <= 0) {
+			printf("ERROR reading from input file\n");
+			status = ERROR;
+			break;
+		}
+
+		status = feed_1B_parser(p_parser, p_block, read_size);
+		offset += read_size;
+	}
+
+	if (fd >= 0) {
+		if (!direct)
+			drop_cached_file(fd);
+		close(fd);
+	}
+	free(p_block);
+
+	if (status == SUCCESS)
+		p_data = finish_1B_parser(p_parser);
+	cleanup_1B_parser(p_parser);
+
+	return p_data;
+}
@@ -8,8 +8,101 @@
  *
  */
 
+#ifndef __AMI_1B_INTERNAL_H__
+#define __AMI_1B_INTERNAL_H__
+
+#include <stdio.h>
+
 #include "ami_1B.h"
 
+// Component data state flag, relative to the contents of the 1B file on disk
+//
+typedef enum {
+	DATA_CLEAN = 0,
+	DATA_DIRTY = 1,
+} COMPONENT_DATA_STATE;
+
+// Component data buffer type, i.e. how the buffer must be released
+//
+typedef enum {
+	BUFFER_ALLOCATED = 0,	// malloc()-ed, owned by the component
+	BUFFER_MAPPED = 1,	// read-only view into a mapped pack file
+	BUFFER_SHARED = 2,	// malloc()-ed, read-only, shared with the clones
+	// of the 1B data and freed with the last reference (see clone_1B_data())
+} COMPONENT_BUFFER_TYPE;
+
+// SHA-256 message digest (ami_1B_sha256.c)
+//
+#define SHA256_BLOCK_LENGTH	64
+#define SHA256_DIGEST_LENGTH	32
+#define SHA256_HEX_LENGTH	(SHA256_DIGEST_LENGTH * 2)
+
+typedef struct {
+	u32_t state[8];
+	u64_t count;		// number of bytes hashed so far
+	u8_t block[SHA256_BLOCK_LENGTH];	// partially filled input block
+} SHA256_CTX_T;
+
+void sha256_init(SHA256_CTX_T * p_ctx);
+
+void sha256_update(SHA256_CTX_T * p_ctx, const void *p_buf, size_t len);
+
+void sha256_final(SHA256_CTX_T * p_ctx, u8_t * p_digest);
+
+void sha256_buffer_to_hex(const void *p_buf, size_t len, char *p_hex);
+
+void sha256_digest_to_hex(const u8_t * p_digest, char *p_hex);
+
+// SWAR (SIMD within a register) byte scans: the hot byte scans test the 8
+// bytes of a 64-bit word per step instead of testing byte by byte
+//
+#define SWAR_ONES	0x0101010101010101ULL	// 0x01 in every byte
+#define SWAR_HIGHS	0x8080808080808080ULL	// 0x80 in every byte
+
+// Non-zero if any byte of the 64-bit word v is zero
+//
+#define SWAR_HAS_ZERO(v)	(((v) - SWAR_ONES) & ~(v) & SWAR_HIGHS)
+
+// Header variant decoders (ami_1B_decoder.c)
+//
+// Start offset and length of each component name in the header
+//
+typedef struct {
+	u16_t offset[MAX_COMPONENT];
+	u16_t length[MAX_COMPONENT];
+} STRING_TABLE_T;
+
+typedef struct HEADER_DECODER_S HEADER_DECODER_T;
+
+struct HEADER_DECODER_S {
+
+	const char *name;	// name of the header variant
+
+	STRING_PRESENCE string_status;	// whether the variant has component names
+
+	u16_t string_pad_length;	// pad bytes between names (see _1B_HEADER_S)
+
+	// Check whether the header is of this variant and split its string
+	// table. Returns SUCCESS if it is.
+	STATUS(*detect) (const HEADER_DECODER_T * p_decoder,
+			 const u8_t * p_header, u16_t header_len, u16_t count,
+			 STRING_TABLE_T * p_table);
+
+	// Name the components of the 1B data from the split string table
+	void (*decode_names) (_1B_DATA_T * p_data,
+			      const STRING_TABLE_T * p_table);
+
+};
+
+const HEADER_DECODER_T *detect_header_variant(const u8_t * p_header,
+					      u16_t header_len, u16_t count,
+					      STRING_TABLE_T * p_table);
+
+STRING_PRESENCE find_string_table(const u8_t * p_header, u16_t header_len,
+				  u16_t count, u16_t * p_offset);
+
+void decode_component_names(_1B_DATA_T * p_data);
+
 struct _1B_HEADER_S {
 
 	u16_t component_info_count;	// number of components info in the header (_including 
@@ -23,6 +116,8 @@ struct _1B_HEADER_S {
 	u16_t string_pad_length;	// length of "pad" bytes between component strings 
 	// (version 4.00 header has 5 bytes pad, newer ones have 4 bytes pad)
 
+	const HEADER_DECODER_T *p_decoder;	// decoder of the header variant
+
 	void *p_buf;		// pointer to buffer which contains the header 
 
 };
@@ -46,6 +141,22 @@ struct _1B_COMPONENT_S {
 
 	void *p_buf;		// pointer to buffer that holds the contents of the component
 
+	off_t disk_offset;	// offset of the component in the 1B file as it is currently 
+	// stored on disk (differs from file_offset after a size-changing replace)
+
+	u32_t disk_length;	// length of the component as it is currently stored on disk
+
+	COMPONENT_DATA_STATE data_state;	// flag to indicate whether p_buf was 
+	// modified since the component was read from (or written to) the 1B file
+
+	COMPONENT_BUFFER_TYPE buf_type;	// flag to indicate whether p_buf is owned 
+	// by the component or points into a mapped pack file (read-only)
+
+	u32_t *p_refcount;	// number of components sharing p_buf (BUFFER_SHARED only)
+
+	u8_t written_digest[SHA256_DIGEST_LENGTH];	// SHA-256 digest of the data 
+	// last written to the output file (see write_1B_data_to_file())
+
 };
 
 
@@ -61,4 +172,93 @@ struct _1B_DATA_S {
 
 	_1B_COMPONENT_T component[MAX_COMPONENT];	// components info and buffer that holds 
 	// components data
+
+	char written_filename[MAX_PATH];	// output file of the last successful 
+	// write_1B_data_to_file() (empty if none), checked by verify_1B_output()
+
+	u8_t written_header_digest[SHA256_DIGEST_LENGTH];	// SHA-256 digest of the 
+	// header last written to the output file
+};
+
+// Golden manifest (ami_1B_manifest.c)
+//
+// Expected state of one component
+//
+typedef struct {
+	char name[MAX_COMPONENT_NAME];
+	u32_t physical_address;
+	u32_t length;
+	COMPONENT_DATA_PRESENCE data_presence;
+	off_t file_offset;
+	char sha256[SHA256_HEX_LENGTH + 1];
+} MANIFEST_ENTRY_T;
+
+struct _1B_MANIFEST_S {
+
+	u16_t header_length;	// expected length of the 1B header
+
+	u16_t component_info_count;	// expected number of components
+
+	off_t size;		// expected 1B file size
+
+	char header_sha256[SHA256_HEX_LENGTH + 1];	// expected header digest
+
+	u8_t *p_header;		// raw header bytes (NULL if not in the manifest)
+
+	MANIFEST_ENTRY_T entry[MAX_COMPONENT];	// expected components
+
 };
+
+// Library internal functions shared between the library source files
+//
+STATUS write_buffer_to_file(FILE * f_out, void *p_buf, const u32_t len);
+
+void hash_buffer(const void *p_buf, const u32_t len, u8_t * p_digest);
+
+STATUS write_data_to_named_file(const char *filename, void *p_buf,
+				const u32_t len);
+
+void *init_file_chunk_buffer(const char *filename,
+			     off_t start_offset, size_t size);
+
+void release_component_buffer(_1B_COMPONENT_T * p_component);
+
+STATUS update_1B_file(_1B_DATA_T * p_data);
+
+// Process work items 0 to count - 1 on a pool of threads
+//
+typedef void (*WORK_ITEM_FUNC) (void *p_context, u32_t index);
+
+void run_worker_pool(u32_t count, WORK_ITEM_FUNC p_work, void *p_context);
+
+// Copy the first len bytes of file filename_in to new file filename_out 
+// in-kernel (ami_1B_copy.c)
+STATUS copy_file_data(const char *filename_in, const char *filename_out,
+		      u32_t len);
+
+// Write the 1B data as an in-kernel copy of its 1B file with only the 
+// modified components rewritten (ami_1B_variant.c)
+STATUS write_1B_data_to_copy(_1B_DATA_T * p_data, const char *filename);
+
+// Reading without the page cache (ami_1B_direct.c)
+//
+#define DIRECT_IO_ALIGNMENT	4096	// buffer, offset and size alignment of O_DIRECT reads
+
+void *alloc_aligned_buffer(size_t size);
+
+int open_uncached_file(const char *filename, int direct, int *p_direct);
+
+void drop_cached_file(int fd);
+
+void *read_file_chunk_direct(const char *filename, off_t start_offset,
+			     size_t size);
+
+_1B_DATA_T *init_1B_data_direct(const char *filename);
+
+STATUS parse_header_info(const void *p_buf, u16_t * p_header_len,
+			 u16_t * p_component_info_count);
+
+STATUS parse_header(_1B_DATA_T * p_data, const u16_t header_len,
+		    const u16_t component_info_count);
+
+#endif				//__AMI_1B_INTERNAL_H__
@@ -0,0 +1,495 @@
+/*
+ * ami_1B_journal.c
+ *
+ * Append-only undo journal of the edits of a 1B file. Before a modified 1B
+ * file is written back, one entry is appended to the journal holding only
+ * what the edit overwrites: the old header and the old data of the modified
+ * components, read from the 1B file on disk. Each entry is
+ *
+ * 	JOURNAL_ENTRY_T
+ * 	old header bytes (padded to JOURNAL_ALIGNMENT)
+ * 	for each modified component:
+ * 		JOURNAL_COMPONENT_T
+ * 		old component data (padded to JOURNAL_ALIGNMENT)
+ *
+ * The journal is flushed to disk before the 1B file is written, so an edit
+ * is never on disk without its journal entry. Undoing replays the entries
+ * from the last one backwards and cuts each undone entry off the journal.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "ami_1B_internal.h"
+
+#define JOURNAL_MAGIC		"AMI1BJNL"	// journal entry signature
+
+#define JOURNAL_ALIGNMENT	8	// alignment of the journal records
+
+#define JOURNAL_ALIGN(x)	(((x) + JOURNAL_ALIGNMENT - 1) & ~((u64_t) JOURNAL_ALIGNMENT - 1))
+
+// Journal entry of one edit
+//
+typedef struct {
+	char magic[8];
+	u64_t entry_length;	// length of the entry including the old data
+	u64_t time;		// time of the edit (seconds since the epoch)
+	u64_t old_size;		// 1B file size before the edit
+	u64_t new_size;		// 1B file size after the edit
+	u16_t header_length;	// length of the 1B header
+	u16_t component_count;	// number of modified components
+	u32_t reserved;
+	u8_t new_header_digest[SHA256_DIGEST_LENGTH];	// header after the edit
+} JOURNAL_ENTRY_T;
+
+// Modified component in a journal entry
+//
+typedef struct {
+	u16_t position;		// position of the component in the header
+	u16_t reserved;
+	u32_t old_length;	// length of the old data
+	u32_t new_length;	// length of the data after the edit
+	u32_t reserved2;
+	u8_t old_digest[SHA256_DIGEST_LENGTH];
+	u8_t new_digest[SHA256_DIGEST_LENGTH];
+} JOURNAL_COMPONENT_T;
+
+
+static STATUS write_padded(FILE * f_out, void *p_buf, u32_t len)
+{
+	static u8_t zero[JOURNAL_ALIGNMENT];
+
+	if ((len > 0) && (write_buffer_to_file(f_out, p_buf, len) == ERROR))
+		return ERROR;
+
+	if ((JOURNAL_ALIGN(len) != len) &&
+	    (write_buffer_to_file(f_out, zero,
+				  JOURNAL_ALIGN(len) - len) == ERROR))
+		return ERROR;
+
+	return SUCCESS;
+}
+
+
+/*
+ * Append the undo entry of the pending edit of p_data to the journal. The
+ * edit consists of the modified (dirty) components of p_data, their old
+ * data is read from the 1B file. Call this function after modifying the
+ * components and before write_1B_data_to_file() writes them back.
+ *
+ * input:
+ * 	p_data			pointer to the modified 1B data structure
+ * 	journal_filename	name of the journal file (created if missing)
+ *
+ * return value:
+ * 	ERROR 	on error, the 1B file must not be written
+ * 	SUCCESS	on success (also when nothing was modified)
+ */
+STATUS append_1B_journal(_1B_DATA_T * p_data, const char *journal_filename)
+{
+	JOURNAL_ENTRY_T entry;
+	JOURNAL_COMPONENT_T jcomp;
+	_1B_COMPONENT_T *p_comp = NULL;
+	struct stat f_stat;
+	void *p_old = NULL;
+	FILE *f_out = NULL;
+	u16_t i;
+
+	if ((p_data == NULL) || (journal_filename == NULL)) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return ERROR;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	memcpy(entry.magic, JOURNAL_MAGIC, sizeof(entry.magic));
+	entry.time = (u64_t) time(NULL);
+	entry.old_size = p_data->size;
+	entry.new_size = p_data->calculated_size;
+	entry.header_length = p_data->header.length;
+	entry.entry_length = sizeof(JOURNAL_ENTRY_T) +
+	    JOURNAL_ALIGN(p_data->header.length);
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->data_state != DATA_DIRTY))
+			continue;
+
+		entry.component_count++;
+		entry.entry_length += sizeof(JOURNAL_COMPONENT_T) +
+		    JOURNAL_ALIGN(p_comp->disk_length);
+	}
+
+	if (entry.component_count == 0)
+		return SUCCESS;
+
+	// The old data comes from the 1B file, make sure it's still the one
+	// the 1B data was read from
+	//
+	if ((stat(p_data->filename, &f_stat) != 0) ||
+	    (f_stat.st_size != p_data->size)) {
+		printf("ERROR: function %s() 1B file %s changed on disk\n",
+		       __func__, p_data->filename);
+		return ERROR;
+	}
+
+	hash_buffer(p_data->header.p_buf, p_data->header.length,
+		    entry.new_header_digest);
+
+	f_out = fopen(journal_filename, "ab");
+	if (f_out == NULL) {
+		printf("ERROR: function %s() unable to open journal %s\n",
+		       __func__, journal_filename);
+		return ERROR;
+	}
+
+	p_old = init_file_chunk_buffer(p_data->filename, 0,
+				       p_data->header.length);
+	if ((p_old == NULL) ||
+	    (write_buffer_to_file(f_out, &entry, sizeof(entry)) == ERROR) ||
+	    (write_padded(f_out, p_old, p_data->header.length) == ERROR))
+		goto error;
+	free(p_old);
+	p_old = NULL;
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->data_state != DATA_DIRTY))
+			continue;
+
+		memset(&jcomp, 0, sizeof(jcomp));
+		jcomp.position = i;
+		jcomp.old_length = p_comp->disk_length;
+		jcomp.new_length = p_comp->length;
+		hash_buffer(p_comp->p_buf, p_comp->length, jcomp.new_digest);
+
+		if (p_comp->disk_length > 0) {
+			p_old = init_file_chunk_buffer(p_data->filename,
+						       p_comp->disk_offset,
+						       p_comp->disk_length);
+			if (p_old == NULL)
+				goto error;
+		}
+		hash_buffer(p_old, p_comp->disk_length, jcomp.old_digest);
+
+		if ((write_buffer_to_file(f_out, &jcomp, sizeof(jcomp)) ==
+		     ERROR) ||
+		    (write_padded(f_out, p_old, p_comp->disk_length) == ERROR))
+			goto error;
+
+		free(p_old);
+		p_old = NULL;
+	}
+
+	// The entry must be on disk before the 1B file is modified
+	//
+	if (fflush(f_out) != 0)
+		goto error;
+#ifndef _WIN32
+	if (fsync(fileno(f_out)) != 0)
+		goto error;
+#endif
+	fclose(f_out);
+
+	printf("%s: Journaled 0x%X component(s) of %s to %s\n", __func__,
+	       entry.component_count, p_data->filename, journal_filename);
+	return SUCCESS;
+
+ error:
+	printf("ERROR: function %s() unable to write journal %s\n", __func__,
+	       journal_filename);
+	free(p_old);
+	fclose(f_out);
+	return ERROR;
+}
+
+
+/*
+ * Check whether the header and the journaled components of p_data match
+ * the state before (old) or after (new) the edit of a journal entry.
+ */
+static int match_entry_state(_1B_DATA_T * p_data, const u8_t * p_entry,
+			     int old)
+{
+	const JOURNAL_ENTRY_T *p_hdr = (const JOURNAL_ENTRY_T *) p_entry;
+	const JOURNAL_COMPONENT_T *p_jcomp = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u8_t digest[SHA256_DIGEST_LENGTH];
+	const u8_t *p = p_entry + sizeof(JOURNAL_ENTRY_T);
+	u16_t i;
+
+	if (p_data->size !=
+	    (off_t) (old ? p_hdr->old_size : p_hdr->new_size))
+		return 0;
+
+	if (old) {
+		if (memcmp(p_data->header.p_buf, p,
+			   p_hdr->header_length) != 0)
+			return 0;
+	} else {
+		hash_buffer(p_data->header.p_buf, p_data->header.length,
+			    digest);
+		if (memcmp(digest, p_hdr->new_header_digest,
+			   SHA256_DIGEST_LENGTH) != 0)
+			return 0;
+	}
+	p += JOURNAL_ALIGN(p_hdr->header_length);
+
+	for (i = 0; i < p_hdr->component_count; i++) {
+		p_jcomp = (const JOURNAL_COMPONENT_T *) p;
+		p_comp = &(p_data->component[p_jcomp->position]);
+
+		if (p_comp->length !=
+		    (old ? p_jcomp->old_length : p_jcomp->new_length))
+			return 0;
+
+		hash_buffer(p_comp->p_buf, p_comp->length, digest);
+		if (memcmp(digest, old ? p_jcomp->old_digest :
+			   p_jcomp->new_digest, SHA256_DIGEST_LENGTH) != 0)
+			return 0;
+
+		p += sizeof(JOURNAL_COMPONENT_T) +
+		    JOURNAL_ALIGN(p_jcomp->old_length);
+	}
+
+	return 1;
+}
+
+
+/*
+ * Check the journaled components and lengths of an entry against p_data
+ */
+static STATUS check_entry(_1B_DATA_T * p_data, const u8_t * p_entry)
+{
+	const JOURNAL_ENTRY_T *p_hdr = (const JOURNAL_ENTRY_T *) p_entry;
+	const JOURNAL_COMPONENT_T *p_jcomp = NULL;
+	u64_t offset;
+	u16_t i;
+
+	if (p_hdr->header_length != p_data->header.length)
+		return ERROR;
+
+	offset = sizeof(JOURNAL_ENTRY_T) + JOURNAL_ALIGN(p_hdr->header_length);
+	for (i = 0; i < p_hdr->component_count; i++) {
+		if (offset + sizeof(JOURNAL_COMPONENT_T) > p_hdr->entry_length)
+			return ERROR;
+
+		p_jcomp = (const JOURNAL_COMPONENT_T *) (p_entry + offset);
+		offset += sizeof(JOURNAL_COMPONENT_T) +
+		    JOURNAL_ALIGN(p_jcomp->old_length);
+
+		if ((p_jcomp->position >= p_data->header.component_info_count)
+		    || (p_data->component[p_jcomp->position].data_presence !=
+			DATA_PRESENT) || (offset > p_hdr->entry_length))
+			return ERROR;
+	}
+
+	return (offset == p_hdr->entry_length) ? SUCCESS : ERROR;
+}
+
+
+/*
+ * Restore the old header and components data of a journal entry in p_data
+ */
+static STATUS restore_entry(_1B_DATA_T * p_data, const u8_t * p_entry)
+{
+	const JOURNAL_ENTRY_T *p_hdr = (const JOURNAL_ENTRY_T *) p_entry;
+	const JOURNAL_COMPONENT_T *p_jcomp = NULL;
+	const u8_t *p_header = p_entry + sizeof(JOURNAL_ENTRY_T);
+	const u8_t *p = p_header + JOURNAL_ALIGN(p_hdr->header_length);
+	_1B_COMPONENT_T *p_comp = NULL;
+	u16_t i;
+
+	for (i = 0; i < p_hdr->component_count; i++) {
+		p_jcomp = (const JOURNAL_COMPONENT_T *) p;
+		p = p + sizeof(JOURNAL_COMPONENT_T);
+		p_comp = &(p_data->component[p_jcomp->position]);
+
+		if (replace_component_data_from_buffer(p_data, p_comp,
+						       (void *) p,
+						       p_jcomp->old_length,
+						       BUFFER_COPY) == ERROR)
+			return ERROR;
+
+		p += JOURNAL_ALIGN(p_jcomp->old_length);
+	}
+
+	// Restoring the components restores the length entries, the only
+	// part of the header an edit changes
+	//
+	if (memcmp(p_data->header.p_buf, p_header, p_hdr->header_length) != 0) {
+		printf("ERROR: function %s() restored header doesn't match "
+		       "the journaled header\n", __func__);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Undo the last count edits of 1B file filename recorded in its journal,
+ * the newest first. Each edit is undone by writing back the old data of
+ * the components it modified; the 1B file is never copied. Each undone
+ * entry is removed from the journal. An entry whose edit never reached
+ * the 1B file (e.g. the write failed) is removed without touching it.
+ *
+ * input:
+ * 	filename		name of the 1B file
+ * 	journal_filename	name of the journal file
+ * 	count			number of edits to undo, 0 to undo all
+ *
+ * return value:
+ * 	ERROR 	on error, including a 1B file modified without journal
+ * 	SUCCESS	on success
+ */
+STATUS undo_1B_journal(const char *filename, const char *journal_filename,
+		       u32_t count)
+{
+	_1B_DATA_T *p_data = NULL;
+	const JOURNAL_ENTRY_T *p_hdr = NULL;
+	u64_t *p_offset = NULL;
+	u8_t *p_journal = NULL;
+	struct stat f_stat;
+	u64_t offset, journal_length;
+	u32_t entry_count = 0, undone = 0;
+	char time_str[32];
+	time_t t;
+	STATUS status = SUCCESS;
+
+	if ((filename == NULL) || (journal_filename == NULL)) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return ERROR;
+	}
+
+	if (stat(journal_filename, &f_stat) != 0) {
+		printf("ERROR: function %s() unable to open journal %s\n",
+		       __func__, journal_filename);
+		return ERROR;
+	}
+	journal_length = f_stat.st_size;
+
+	if (journal_length == 0) {
+		printf("%s: Journal %s is empty\n", __func__,
+		       journal_filename);
+		return SUCCESS;
+	}
+
+	p_journal = (u8_t *) init_file_chunk_buffer(journal_filename, 0,
+						    journal_length);
+	p_offset = (u64_t *) malloc((journal_length /
+				     sizeof(JOURNAL_ENTRY_T) + 1) *
+				    sizeof(u64_t));
+	if ((p_journal == NULL) || (p_offset == NULL)) {
+		printf("ERROR: function %s() unable to read journal %s\n",
+		       __func__, journal_filename);
+		free(p_journal);
+		free(p_offset);
+		return ERROR;
+	}
+
+	// Find the entries. A partially written last entry was never
+	// followed by a write of the 1B file, it's dropped.
+	//
+	for (offset = 0; offset + sizeof(JOURNAL_ENTRY_T) <= journal_length;
+	     offset += p_hdr->entry_length) {
+		p_hdr = (const JOURNAL_ENTRY_T *) (p_journal + offset);
+		if ((memcmp(p_hdr->magic, JOURNAL_MAGIC,
+			    sizeof(p_hdr->magic)) != 0) ||
+		    (p_hdr->entry_length < sizeof(JOURNAL_ENTRY_T)) ||
+		    (p_hdr->entry_length > journal_length - offset))
+			break;
+
+		p_offset[entry_count++] = offset;
+	}
+
+	if (offset != journal_length) {
+		printf("Warning: dropping incomplete journal entry at "
+		       "offset 0x%llX of %s\n", offset, journal_filename);
+		if (truncate(journal_filename, offset) != 0) {
+			printf("ERROR: function %s() unable to truncate "
+			       "journal %s\n", __func__, journal_filename);
+			status = ERROR;
+			goto out;
+		}
+	}
+
+	p_data = init_1B_data(filename);
+	if (p_data == NULL) {
+		status = ERROR;
+		goto out;
+	}
+
+	while ((entry_count > 0) && ((count == 0) || (undone < count))) {
+		offset = p_offset[entry_count - 1];
+		p_hdr = (const JOURNAL_ENTRY_T *) (p_journal + offset);
+
+		t = (time_t) p_hdr->time;
+		strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S",
+			 localtime(&t));
+
+		if (check_entry(p_data, (const u8_t *) p_hdr) == ERROR) {
+			printf("ERROR: journal entry of %s doesn't match the "
+			       "header of %s\n", time_str, filename);
+			status = ERROR;
+			break;
+		}
+
+		if (match_entry_state(p_data, (const u8_t *) p_hdr, 0)) {
+			if ((restore_entry(p_data, (const u8_t *) p_hdr) ==
+			     ERROR) ||
+			    (write_1B_data_to_file(p_data, filename) ==
+			     ERROR)) {
+				printf("ERROR: unable to undo the edit of "
+				       "%s\n", time_str);
+				status = ERROR;
+				break;
+			}
+			printf("%s: Undone the edit of %s (0x%X "
+			       "component(s))\n", __func__, time_str,
+			       p_hdr->component_count);
+		} else if (match_entry_state(p_data, (const u8_t *) p_hdr, 1)) {
+			printf("%s: The edit of %s never reached %s, "
+			       "dropping it\n", __func__, time_str,
+			       filename);
+		} else {
+			printf("ERROR: %s was modified outside the journal "
+			       "after the edit of %s, not undoing it\n",
+			       filename, time_str);
+			status = ERROR;
+			break;
+		}
+
+		// Cut the undone entry off the journal
+		//
+		if (truncate(journal_filename, offset) != 0) {
+			printf("ERROR: function %s() unable to truncate "
+			       "journal %s\n", __func__, journal_filename);
+			status = ERROR;
+			break;
+		}
+
+		entry_count--;
+		undone++;
+	}
+
+	printf("%s: 0x%X edit(s) undone, 0x%X left in %s\n", __func__,
+	       undone, entry_count, journal_filename);
+
+ out:
+	cleanup_1B_data(p_data);
+	free(p_journal);
+	free(p_offset);
+	return status;
+}
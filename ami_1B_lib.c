@@ -7,6 +7,10 @@
  *
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/** Required for fallocate() */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -14,13 +18,34 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <linux/falloc.h>	/** Required for FALLOC_FL_* flags */
+#endif
 
 #include "ami_1B_internal.h"
 
+#define WRITE_HASH_CHUNK_SIZE	(64 * 1024)	// bytes hashed per write
+
+#define MAX_WORKER_THREADS	16	// maximum number of worker pool threads
+
+// State shared by the worker pool threads
+//
+typedef struct {
+	WORK_ITEM_FUNC p_work;
+	void *p_context;
+	u32_t count;
+
+	pthread_mutex_t lock;	// protects the member below
+	u32_t next;		// next work item
+} WORKER_POOL_T;
+
 static STATUS update_header_data(_1B_DATA_T * p_data)
 {
 	u16_t i;
 	u32_t len, offset;
+	off_t file_offset;
 
 	// Input parameter sanity check 
 	//
@@ -55,6 +80,19 @@ static STATUS update_header_data(_1B_DATA_T * p_data)
 		offset += COMPONENT_INFO_LENGTH;
 	}
 
+	// Recalculate the file offset of the present components and the 
+	// 1B file size, a component with different length moves every 
+	// component after it
+	//
+	file_offset = p_data->header.length;
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		if (p_data->component[i].data_presence == DATA_PRESENT) {
+			p_data->component[i].file_offset = file_offset;
+			file_offset += p_data->component[i].length;
+		}
+	}
+	p_data->calculated_size = file_offset;
+
 	return SUCCESS;
 }
 
@@ -75,8 +113,7 @@ static STATUS update_header_data(_1B_DATA_T * p_data)
  *      ERROR 	on error
  *      SUCCESS on success
  */
-static STATUS write_buffer_to_file(FILE * f_out, void *p_buf,
-				   const u32_t len)
+STATUS write_buffer_to_file(FILE * f_out, void *p_buf, const u32_t len)
 {
 	size_t processed_size, written_size;
 
@@ -102,6 +139,340 @@ static STATUS write_buffer_to_file(FILE * f_out, void *p_buf,
 }
 
 
+/*
+ * Write the contents of buffer p_buf to __an already opened__ file f_out and 
+ * compute its SHA-256 digest on the way. Each chunk is hashed right before 
+ * it is written, while it is still in the CPU cache, so the output doesn't 
+ * have to be read back to get its digest.
+ *
+ * input: 
+ *      f_out		pointer to an already opened file, ready for writing
+ *      p_buf		pointer to buffer to be written
+ *      len		length of p_buf in bytes
+ *
+ * output:
+ *      p_digest	SHA-256 digest of p_buf
+ *
+ *  return value: 
+ *      ERROR 	on error
+ *      SUCCESS on success
+ */
+static STATUS write_buffer_to_file_hashed(FILE * f_out, void *p_buf,
+					  const u32_t len, u8_t * p_digest)
+{
+	SHA256_CTX_T ctx;
+	u32_t processed_size, chunk_size;
+
+	sha256_init(&ctx);
+
+	for (processed_size = 0; processed_size < len;
+	     processed_size += chunk_size) {
+		chunk_size = len - processed_size;
+		if (chunk_size > WRITE_HASH_CHUNK_SIZE)
+			chunk_size = WRITE_HASH_CHUNK_SIZE;
+
+		sha256_update(&ctx, p_buf + processed_size, chunk_size);
+		if (write_buffer_to_file(f_out, p_buf + processed_size,
+					 chunk_size) == ERROR)
+			return ERROR;
+	}
+
+	sha256_final(&ctx, p_digest);
+	return SUCCESS;
+}
+
+
+/*
+ * Compute the SHA-256 digest of the first len bytes of p_buf
+ */
+void hash_buffer(const void *p_buf, const u32_t len, u8_t * p_digest)
+{
+	SHA256_CTX_T ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, p_buf, len);
+	sha256_final(&ctx, p_digest);
+}
+
+
+/*
+ * Write the contents of buffer p_buf to __an already opened__ file f_out
+ * starting at file offset offset.
+ *
+ * input: 
+ *      f_out	pointer to an already opened file, ready for writing
+ *      offset	file offset to start writing at
+ *      p_buf	pointer to buffer to be written
+ *      len	length of p_buf in bytes
+ *
+ *  output: 
+ *      p_digest	SHA-256 digest of p_buf (not computed if NULL)
+ *
+ *  return value: 
+ *      ERROR 	on error
+ *      SUCCESS on success
+ */
+static STATUS write_buffer_to_file_offset(FILE * f_out, off_t offset,
+					  void *p_buf, const u32_t len,
+					  u8_t * p_digest)
+{
+	if (fseek(f_out, offset, SEEK_SET) != 0) {
+		printf("ERROR: function %s() unable to seek output file\n",
+		       __func__);
+		return ERROR;
+	}
+
+	if (p_digest != NULL)
+		return write_buffer_to_file_hashed(f_out, p_buf, len,
+						   p_digest);
+
+	return write_buffer_to_file(f_out, p_buf, len);
+}
+
+
+/*
+ * Shift the part of the file after the [start, end) range by delta bytes 
+ * in-kernel, without reading and writing it back. The bytes in the 
+ * [start, end) range are undefined afterwards, the caller must rewrite 
+ * them.
+ *
+ * NOTE: Only works on Linux filesystems which support FALLOC_FL_INSERT_RANGE 
+ * and FALLOC_FL_COLLAPSE_RANGE (ext4, XFS) and only when the shift can be 
+ * done in whole filesystem blocks. The caller must fall back to rewriting 
+ * the tail when this function fails.
+ *
+ * input: 
+ *      f_out	pointer to an already opened file, ready for writing
+ *      start	start offset of the range that is rewritten by the caller
+ *      end	end offset of the range before the shift
+ *      delta	number of bytes to shift the tail, negative to shrink
+ *
+ *  return value: 
+ *      ERROR 	if the tail can't be shifted in-kernel
+ *      SUCCESS on success
+ */
+static STATUS shift_file_tail(FILE * f_out, off_t start, off_t end,
+			      off_t delta)
+{
+#if defined(__linux__) && defined(FALLOC_FL_INSERT_RANGE)
+	struct stat f_stat;
+	off_t blk_size, shift_offset;
+	int fd;
+
+	if (delta == 0)
+		return SUCCESS;
+
+	fd = fileno(f_out);
+	if ((fflush(f_out) != 0) || (fstat(fd, &f_stat) != 0))
+		return ERROR;
+
+	// Nothing to shift if the range is at the end of the file 
+	//
+	if (end >= f_stat.st_size)
+		return SUCCESS;
+
+	blk_size = f_stat.st_blksize;
+	if ((blk_size <= 0) || ((delta % blk_size) != 0))
+		return ERROR;
+
+	if (delta > 0) {
+		// Insert delta bytes at the last block boundary inside 
+		// the rewritten range
+		//
+		shift_offset = end - (end % blk_size);
+		if (shift_offset < start)
+			return ERROR;
+
+		if (fallocate(fd, FALLOC_FL_INSERT_RANGE, shift_offset,
+			      delta) != 0)
+			return ERROR;
+	} else {
+		// Remove -delta bytes starting at the first block boundary 
+		// inside the rewritten range
+		//
+		shift_offset = start + ((blk_size - (start % blk_size)) %
+					blk_size);
+		if ((shift_offset - delta) > end)
+			return ERROR;
+
+		if (fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, shift_offset,
+			      -delta) != 0)
+			return ERROR;
+	}
+
+	return SUCCESS;
+#else
+	return (delta == 0) ? SUCCESS : ERROR;
+#endif
+}
+
+
+/*
+ * Write the modified parts of the 1B data back to the 1B file it was read 
+ * from. Only the header length entries of the resized components, the 
+ * modified components and the components which moved are written. The 
+ * components in front of the first modified component are never touched. 
+ * If possible, the components after a resized component are shifted in-kernel
+ * instead of being rewritten. The digests of the written components are 
+ * computed while writing them, the others are hashed from memory.
+ *
+ * input: 
+ *      p_data	pointer to the 1B data structure 
+ *
+ *  return value: 
+ *      ERROR 	on error
+ *      SUCCESS on success
+ */
+STATUS update_1B_file(_1B_DATA_T * p_data)
+{
+	u16_t i, resized = 0;
+	u32_t offset;
+	off_t delta = 0, on_disk_offset;
+	STATUS shifted = ERROR;
+	FILE *f_out = NULL;
+	struct stat f_stat;
+	_1B_COMPONENT_T *p_comp = NULL;
+
+	// Make sure the file on disk is still the one the 1B data was read from
+	//
+	if ((stat(p_data->filename, &f_stat) != 0) ||
+	    (f_stat.st_size != p_data->size)) {
+		printf("ERROR: function %s() 1B file %s changed on disk\n",
+		       __func__, p_data->filename);
+		return ERROR;
+	}
+
+	f_out = fopen(p_data->filename, "r+b");
+	if (f_out == NULL) {
+		printf("ERROR: function %s() unable to open output file "
+		       "for writing\n", __func__);
+		return ERROR;
+	}
+
+	printf("%s: Updating 1B binary data in %s ..\n", __func__,
+	       p_data->filename);
+	p_data->written_filename[0] = '\0';
+
+	// Write the header length entry of the resized components and find 
+	// the first resized component
+	//
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == p_comp->disk_length))
+			continue;
+
+		offset = HEADER_CONTENTS_OFFSET +
+		    (i * COMPONENT_INFO_LENGTH) + 4;
+		if (write_buffer_to_file_offset(f_out, offset,
+						p_data->header.p_buf + offset,
+						4, NULL) == ERROR) {
+			printf("%s: Error writing header entry [0x%02X] to "
+			       "output file %s\n", __func__, i,
+			       p_data->filename);
+			fclose(f_out);
+			return ERROR;
+		}
+
+		if (delta == 0) {
+			resized = i;
+			delta = (off_t) p_comp->length -
+			    (off_t) p_comp->disk_length;
+		}
+	}
+
+	// Try to shift the components after the first resized component 
+	// in-kernel 
+	//
+	if (delta != 0) {
+		p_comp = &(p_data->component[resized]);
+		shifted = shift_file_tail(f_out, p_comp->disk_offset,
+					  p_comp->disk_offset +
+					  p_comp->disk_length, delta);
+	}
+
+	// Write the modified components and the components which are not 
+	// at their new offset in the file
+	//
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		on_disk_offset = p_comp->disk_offset;
+		if ((shifted == SUCCESS) && (i > resized))
+			on_disk_offset += delta;
+
+		if ((p_comp->data_state == DATA_CLEAN) &&
+		    (on_disk_offset == p_comp->file_offset)) {
+			hash_buffer(p_comp->p_buf, p_comp->length,
+				    p_comp->written_digest);
+			continue;
+		}
+
+		if (write_buffer_to_file_offset(f_out, p_comp->file_offset,
+						p_comp->p_buf,
+						p_comp->length,
+						p_comp->written_digest) ==
+		    ERROR) {
+			printf("%s: Error writing component "
+			       "[0x%02X] to output file %s\n",
+			       __func__, i, p_data->filename);
+			fclose(f_out);
+			return ERROR;
+		}
+
+		printf("Writing component[%02Xh] of length %Xh "
+		       "to file %s\n", i, p_comp->length, p_data->filename);
+	}
+
+	// Cut the leftover of the old contents if the 1B file shrinks
+	//
+	if ((fflush(f_out) != 0) ||
+	    ((p_data->calculated_size < p_data->size) &&
+	     (ftruncate(fileno(f_out), p_data->calculated_size) != 0))) {
+		printf("%s: Error truncating output file %s\n", __func__,
+		       p_data->filename);
+		fclose(f_out);
+		return ERROR;
+	}
+	fclose(f_out);
+
+	// The 1B file on disk now matches the 1B data
+	//
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		p_comp->disk_offset = p_comp->file_offset;
+		p_comp->disk_length = p_comp->length;
+		p_comp->data_state = DATA_CLEAN;
+	}
+	p_data->size = p_data->calculated_size;
+
+	hash_buffer(p_data->header.p_buf, p_data->header.length,
+		    p_data->written_header_digest);
+	strncpy(p_data->written_filename, p_data->filename, MAX_PATH);
+
+	return SUCCESS;
+}
+
+
+/*
+ * Write the 1B data to file filename. If filename is the 1B file the data 
+ * was read from, only the modified parts of the file are rewritten. The 
+ * SHA-256 digests of the header and components are computed while they 
+ * are written, call verify_1B_output() to check the file against them.
+ *
+ * input: 
+ *      p_data		pointer to the 1B data structure 
+ *      filename	name of the output file
+ *
+ *  return value: 
+ *      ERROR 	on error
+ *      SUCCESS on success
+ */
 STATUS write_1B_data_to_file(_1B_DATA_T * p_data, const char *filename)
 {
 	u16_t i = 0;
@@ -122,6 +493,11 @@ STATUS write_1B_data_to_file(_1B_DATA_T * p_data, const char *filename)
 		return ERROR;
 	}
 
+	// Only rewrite what changed when writing back to the original file
+	//
+	if (!strcmp(filename, p_data->filename))
+		return update_1B_file(p_data);
+
 	f_out = fopen(filename, "wb");
 	if (f_out == NULL) {
 		printf("ERROR: function %s() unable to open output file "
@@ -132,12 +508,15 @@ STATUS write_1B_data_to_file(_1B_DATA_T * p_data, const char *filename)
 
 	printf("%s: Writing 1B binary data to %s ..\n", __func__,
 	       filename);
+	p_data->written_filename[0] = '\0';
 
 	// Write header to output file
 	p_buf = p_data->header.p_buf;
 	len = p_data->header.length;
 	printf("Writing header to file %s\n", filename);
-	if (write_buffer_to_file(f_out, p_buf, len) == ERROR) {
+	if (write_buffer_to_file_hashed(f_out, p_buf, len,
+					p_data->written_header_digest) ==
+	    ERROR) {
 		printf("%s: Error writing header to output file %s\n",
 		       __func__, filename);
 		fclose(f_out);
@@ -149,7 +528,9 @@ STATUS write_1B_data_to_file(_1B_DATA_T * p_data, const char *filename)
 			p_buf = p_data->component[i].p_buf;
 			len = p_data->component[i].length;
 
-			if (write_buffer_to_file(f_out, p_buf, len) ==
+			if (write_buffer_to_file_hashed(f_out, p_buf, len,
+							p_data->component[i].
+							written_digest) ==
 			    ERROR) {
 				printf("%s: Error writing component "
 				       "[0x%02X] to output file %s\n",
@@ -163,7 +544,15 @@ STATUS write_1B_data_to_file(_1B_DATA_T * p_data, const char *filename)
 		}
 
 	}
-	fclose(f_out);
+
+	if (fclose(f_out) != 0) {
+		printf("%s: Error closing output file %s\n", __func__,
+		       filename);
+		return ERROR;
+	}
+
+	strncpy(p_data->written_filename, filename, MAX_PATH);
+	p_data->written_filename[MAX_PATH - 1] = '\0';
 	return SUCCESS;
 }
 
@@ -178,6 +567,18 @@ const char *get_1B_filename(_1B_DATA_T * p_data)
 	return p_data->filename;
 }
 
+// Size of the 1B file calculated from its header
+off_t get_1B_size(_1B_DATA_T * p_data)
+{
+	if (p_data == NULL) {
+		printf("ERROR: function %s() Empty 1B data structure\n",
+		       __func__);
+		return 0;
+	}
+
+	return p_data->calculated_size;
+}
+
 
 u16_t get_component_count(_1B_DATA_T * p_data)
 {
@@ -230,6 +631,40 @@ _1B_COMPONENT_T *get_component_from_position(_1B_DATA_T * p_data,
 }
 
 
+/*
+ * Find the component named name, preferring a component with its data 
+ * present in the 1B file if several components share the name
+ *
+ * return value:
+ * 	NULL				if there's no such component
+ * 	pointer to the component	on success
+ */
+_1B_COMPONENT_T *get_component_from_name(_1B_DATA_T * p_data,
+					 const char *name)
+{
+	_1B_COMPONENT_T *p_found = NULL;
+	u16_t i;
+
+	if ((p_data == NULL) || (name == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return NULL;
+	}
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		if (strcmp(p_data->component[i].name, name))
+			continue;
+
+		if (p_data->component[i].data_presence == DATA_PRESENT)
+			return &(p_data->component[i]);
+		if (p_found == NULL)
+			p_found = &(p_data->component[i]);
+	}
+
+	return p_found;
+}
+
+
 COMPONENT_DATA_PRESENCE
 is_component_data_present(_1B_COMPONENT_T * p_component)
 {
@@ -241,13 +676,49 @@ is_component_data_present(_1B_COMPONENT_T * p_component)
 	return p_component->data_presence;
 }
 
+/*
+ * Write len bytes of buffer p_buf to output file filename. The output file 
+ * is created or truncated.
+ *
+ * input: 
+ * 	filename	the name of the file to write into
+ * 	p_buf		pointer to buffer to be written
+ * 	len		length of p_buf in bytes
+ *
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+STATUS write_data_to_named_file(const char *filename, void *p_buf,
+				const u32_t len)
+{
+	FILE *f_out = NULL;
+
+	// Open output file and truncate it
+	f_out = fopen(filename, "wb");
+	if (f_out == NULL) {
+		printf("ERROR: Unable to create output file"
+		       " for writing\n");
+		return ERROR;
+	}
+
+	if (write_buffer_to_file(f_out, p_buf, len) == ERROR) {
+		printf("%s: Error writing to output file %s\n",
+		       __func__, filename);
+		fclose(f_out);
+		return ERROR;
+	} else {
+		fclose(f_out);
+		return SUCCESS;
+	}
+}
+
 /*
  * Write contents of the component data buffer to output file with the same name 
  * as the component name/string
  *
  * input: 
  * 	p_component	pointer to the component contains the data to be written
- * 	filename	the name of the file to write into
  *
  * return value: 
  * 	ERROR 	on error
@@ -255,10 +726,6 @@ is_component_data_present(_1B_COMPONENT_T * p_component)
  */
 STATUS write_component_data_to_file(_1B_COMPONENT_T * p_component)
 {
-	void *p_buf = NULL;
-	u32_t len = 0;
-	FILE *f_out = NULL;
-
 	// Input buffer sanity check
 	//
 	if (p_component == NULL) {
@@ -275,30 +742,13 @@ STATUS write_component_data_to_file(_1B_COMPONENT_T * p_component)
 		printf("ERROR: Invalid component name\n");
 		return ERROR;
 	}
-	// Open output file and truncate it
-	f_out = fopen(p_component->name, "wb");
-	if (f_out == NULL) {
-		printf("ERROR: Unable to create output file"
-		       " for writing\n");
-		return ERROR;
-	}
 	// Write the output buffer to the output file
 	printf("%s: Writing component data to %s ..\n",
 	       __func__, p_component->name);
 
-	// Write header to output file
-	p_buf = p_component->p_buf;
-	len = p_component->length;
-	if (write_buffer_to_file(f_out, p_buf, len) == ERROR) {
-		printf("%s: Error writing to output file %s\n",
-		       __func__, p_component->name);
-		fclose(f_out);
-		return ERROR;
-	} else {
-		fclose(f_out);
-		return SUCCESS;
-	}
-
+	return write_data_to_named_file(p_component->name,
+					p_component->p_buf,
+					p_component->length);
 }
 
 
@@ -319,8 +769,8 @@ STATUS write_component_data_to_file(_1B_COMPONENT_T * p_component)
  * 	NULL 				on error
  * 	pointer_to_allocated_buffer  	on success		
  */
-static void *init_file_chunk_buffer(const char *filename,
-				    off_t start_offset, size_t size)
+void *init_file_chunk_buffer(const char *filename,
+			     off_t start_offset, size_t size)
 {
 	void *p_chunk = NULL;
 	FILE *f_in = NULL;
@@ -338,6 +788,9 @@ static void *init_file_chunk_buffer(const char *filename,
 		return NULL;
 	}
 
+	if (get_1B_read_mode() == READ_DIRECT)
+		return read_file_chunk_direct(filename, start_offset, size);
+
 	f_in = fopen(filename, "rb");
 	if (f_in == NULL) {
 		printf("ERROR: Unable to open input file\n");
@@ -376,25 +829,204 @@ static void *init_file_chunk_buffer(const char *filename,
 			processed_size += read_size;
 		}
 	}
-	fclose(f_in);
-	return p_chunk;
-}
+	fclose(f_in);
+	return p_chunk;
+}
+
+
+/*
+ * Cleanup file chunk buffer
+ *
+ * input: 
+ * 	p_chunk pointer to allocated file chunk buffer
+ * 
+ */
+static void cleanup_file_chunk_buffer(void *p_chunk)
+{
+	if (p_chunk != NULL) {
+		free(p_chunk);
+	}
+}
+
+/*
+ * Release the component's data buffer according to its type. A shared 
+ * buffer is freed when the last component sharing it releases it, mapped 
+ * buffers belong to the pack file.
+ *
+ * input: 
+ * 	p_component	pointer to the component
+ * 
+ */
+void release_component_buffer(_1B_COMPONENT_T * p_component)
+{
+	switch (p_component->buf_type) {
+	case BUFFER_ALLOCATED:
+		cleanup_file_chunk_buffer(p_component->p_buf);
+		break;
+
+	case BUFFER_SHARED:
+		if (__atomic_sub_fetch(p_component->p_refcount, 1,
+				       __ATOMIC_ACQ_REL) == 0) {
+			cleanup_file_chunk_buffer(p_component->p_buf);
+			free(p_component->p_refcount);
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	p_component->p_buf = NULL;
+	p_component->buf_type = BUFFER_ALLOCATED;
+	p_component->p_refcount = NULL;
+}
+
+/*
+ * Replace the component's data with the len bytes of buffer p_buf. 
+ *
+ * With BUFFER_TAKE the library takes ownership of p_buf, which must have 
+ * been allocated with malloc(), and frees it in cleanup_1B_data(). With 
+ * BUFFER_COPY the data is copied and p_buf stays owned by the caller.
+ *
+ * input: 
+ *  p_data		pointer to the 1B data structure 
+ *  p_component		pointer to the component with data to be replaced
+ *  p_buf		pointer to buffer which contains the new data
+ *  len			length of p_buf in bytes
+ *  ownership		BUFFER_TAKE or BUFFER_COPY
+ *
+ *  return value:
+ *  ERROR	on error (the caller still owns p_buf)
+ *  SUCCESS	on success
+ */
+STATUS replace_component_data_from_buffer(_1B_DATA_T * p_data,
+					  _1B_COMPONENT_T * p_component,
+					  void *p_buf, u32_t len,
+					  BUFFER_OWNERSHIP ownership)
+{
+	void *p_new_buf = NULL;
+
+	// Sanity check on input parameters 
+	//
+	if ((p_data == NULL) || (p_component == NULL) || (p_buf == NULL) ||
+	    (len == 0)) {
+		printf("ERROR: %s() invalid input parameter\n", __func__);
+		return ERROR;
+	}
+	// update_header_data() below must not fail once the component owns 
+	// the new buffer
+	//
+	if (p_data->header.p_buf == NULL) {
+		printf("ERROR: %s() header buffer is empty\n", __func__);
+		return ERROR;
+	}
+	// Make sure the replaced component is present in the 1B file
+	//
+	if ((p_component->data_presence != DATA_PRESENT) ||
+	    (p_component->p_buf == NULL)) {
+		printf("ERROR: %s() component data not present\n",
+		       __func__);
+		return ERROR;
+	}
+
+	if (ownership == BUFFER_TAKE) {
+		p_new_buf = p_buf;
+	} else {
+		p_new_buf = malloc(len);
+		if (p_new_buf == NULL) {
+			printf("ERROR: %s() unable to allocate buffer for the "
+			       "new component data\n", __func__);
+			return ERROR;
+		}
+		memcpy(p_new_buf, p_buf, len);
+	}
+	// Compare old data buffer size to new data buffer size
+	// Display warning message if they don't match
+	// 
+	if (len != p_component->length) {
+		printf("Warning: The new component have different size"
+		       " with the current component.\n");
+	}
+	// Delete old data buffer and assign new data buffer to the component
+	//
+	release_component_buffer(p_component);
+
+	p_component->p_buf = p_new_buf;
+	p_component->length = len;
+	p_component->data_state = DATA_DIRTY;
+
+	// Update header data and p_data size-related members 
+	// to reflect the change.
+	return update_header_data(p_data);
+}
+
+
+/*
+ * Overwrite len bytes of the component's data starting at offset 
+ * (relative to the start of the component) with the contents of p_buf. 
+ * The component length doesn't change.
+ *
+ * input: 
+ *  p_data		pointer to the 1B data structure 
+ *  p_component		pointer to the component to be patched
+ *  offset		offset of the patched range inside the component
+ *  p_buf		pointer to buffer which contains the new bytes
+ *  len			length of p_buf in bytes
+ *
+ *  return value:
+ *  ERROR	on error
+ *  SUCCESS	on success
+ */
+STATUS patch_component_data(_1B_DATA_T * p_data,
+			    _1B_COMPONENT_T * p_component, u32_t offset,
+			    const void *p_buf, u32_t len)
+{
+	void *p_new_buf = NULL;
+
+	// Sanity check on input parameters 
+	//
+	if ((p_data == NULL) || (p_component == NULL) || (p_buf == NULL)) {
+		printf("ERROR: %s() invalid input parameter\n", __func__);
+		return ERROR;
+	}
+
+	if ((p_component->data_presence != DATA_PRESENT) ||
+	    (p_component->p_buf == NULL)) {
+		printf("ERROR: %s() component data not present\n",
+		       __func__);
+		return ERROR;
+	}
 
+	if ((offset > p_component->length) ||
+	    (len > p_component->length - offset)) {
+		printf("ERROR: %s() patch range 0x%X+0x%X is out of "
+		       "component range\n", __func__, offset, len);
+		return ERROR;
+	}
+	// Mapped data is read-only (and may be shared with other 1B files
+	// in the pack), shared data is shared with the clones of the 1B data, 
+	// patch a private copy
+	//
+	if (p_component->buf_type != BUFFER_ALLOCATED) {
+		p_new_buf = malloc(p_component->length);
+		if (p_new_buf == NULL) {
+			printf("ERROR: %s() unable to allocate buffer for the "
+			       "patched component data\n", __func__);
+			return ERROR;
+		}
+		memcpy(p_new_buf, p_component->p_buf, p_component->length);
 
-/*
- * Cleanup file chunk buffer
- *
- * input: 
- * 	p_chunk pointer to allocated file chunk buffer
- * 
- */
-static void cleanup_file_chunk_buffer(void *p_chunk)
-{
-	if (p_chunk != NULL) {
-		free(p_chunk);
+		release_component_buffer(p_component);
+		p_component->p_buf = p_new_buf;
 	}
+
+	memcpy(p_component->p_buf + offset, p_buf, len);
+	p_component->data_state = DATA_DIRTY;
+
+	return update_header_data(p_data);
 }
 
+
 /*
  * Replace the component's data with data read from the input file filename
  *
@@ -411,7 +1043,7 @@ STATUS replace_component_data(_1B_DATA_T * p_data,
 			      _1B_COMPONENT_T * p_component,
 			      const char *filename)
 {
-	u32_t old_len = 0, new_len = 0;
+	u32_t new_len = 0;
 	struct stat f_stat;
 	void *p_buf = NULL;
 
@@ -421,18 +1053,6 @@ STATUS replace_component_data(_1B_DATA_T * p_data,
 		printf("ERROR: %s() invalid input parameter\n", __func__);
 		return ERROR;
 	}
-	// Make sure the replaced component is present in the 1B file
-	//
-	if ((p_component->data_presence != DATA_PRESENT) ||
-	    (p_component->p_buf == NULL)) {
-		printf("ERROR: %s() component data not present\n",
-		       __func__);
-		return ERROR;
-	}
-	// Save current component data length 
-	//
-	old_len = p_component->length;
-
 	// Read input file to buffer
 	//
 	if (stat(filename, &f_stat) != 0) {
@@ -449,93 +1069,18 @@ STATUS replace_component_data(_1B_DATA_T * p_data,
 		return ERROR;
 
 	}
-	// Delete old data buffer
-	//
-	cleanup_file_chunk_buffer(p_component->p_buf);
-
-	// Compare old data buffer size to new data buffer size
-	// Display warning message if they don't match
-	// 
-	if (new_len != old_len) {
-		printf("Warning: The new component have different size"
-		       " with the current component.\n");
-	}
-	// Assign new data buffer to the component
-	//
-	p_component->p_buf = p_buf;
-	p_component->length = new_len;
-	// Update header data and p_data size-related members 
-	// to reflect the change.
-	return update_header_data(p_data);
-}
 
-
-/*
- * Check thoroughly whether component string is present. 
- * The check is a comprehensive check, instead of simple check
- */
-static STRING_PRESENCE
-get_component_string_start(void *p_header_buf,
-			   const u16_t header_len,
-			   const u16_t
-			   component_info_count,
-			   u16_t * p_offset, u8_t * p_pad_length)
-{
-	u16_t offset = 0;
-
-	if ((p_header_buf == NULL) || (header_len == 0) ||
-	    (component_info_count == 0) || (p_offset == NULL)
-	    || (p_pad_length == NULL)) {
-		printf("ERROR: Invalid input parameter for %s\n",
-		       __func__);
-		return STRING_ABSENT;
+	if (replace_component_data_from_buffer(p_data, p_component, p_buf,
+					       new_len,
+					       BUFFER_TAKE) == ERROR) {
+		cleanup_file_chunk_buffer(p_buf);
+		return ERROR;
 	}
 
-	offset = component_info_count * COMPONENT_INFO_LENGTH +
-	    HEADER_INFO_LENGTH;
-
-	if (offset < header_len) {
-		// Check the header version and  set component string pad size 
-		// to the right value (header newer than 4.00 uses 4 bytes pad, 
-		// version 4.00 uses 5 bytes pad)
-		//
-		offset = component_info_count * COMPONENT_INFO_LENGTH +
-		    HEADER_INFO_LENGTH + 2;
-
-		if (!strncmp((char *) (p_header_buf + offset), "00", 2))
-			*p_pad_length = 5;
-		else
-			*p_pad_length = 4;
-
-
-		// Find the start of component string in the header 
-		// by looking for "RUN_" string which is part of the 
-		// first component name (RUN_CSEG)
-		//
-		offset = component_info_count * COMPONENT_INFO_LENGTH +
-		    HEADER_INFO_LENGTH + 4;
-
-		while (offset < header_len) {
-			if (!strncmp((char *) (p_header_buf + offset),
-				     "RUN_", 4))
-				break;
-			else
-				offset++;
-		}
-
-		// Handle unwanted cases where the component string component 
-		// is faulty or empty
-		if (offset < header_len) {
-			*p_offset = offset;
-			return STRING_PRESENT;
-		}
-
-	} 
-
-	*p_pad_length = 0;
-	return STRING_ABSENT;
+	return SUCCESS;
 }
 
+
 /*
  * Parse the 1B header contents. Fill the _1B_DATA_T object and its associated
  * components objects with correct data
@@ -552,14 +1097,12 @@ get_component_string_start(void *p_header_buf,
  * 	ERROR	on error 
  * 	SUCCESS	on success	 
  */
-static STATUS
+STATUS
 parse_header(_1B_DATA_T * p_data, const u16_t header_len,
 	     const u16_t component_info_count)
 {
 	u32_t i, file_offset, t;
-	u16_t info_offset, string_offset, string_len;
-	u8_t pad_length;
-	char *p_str = NULL;
+	u16_t info_offset;
 
 	if ((p_data == NULL) || (p_data->header.p_buf == NULL) ||
 	    (header_len == 0) || (component_info_count == 0)) {
@@ -584,19 +1127,10 @@ parse_header(_1B_DATA_T * p_data, const u16_t header_len,
 		       sizeof(p_data->component[i].name));
 	}
 
-	// Check whether the header contains component string or not
+	// Detect the header variant once and name the components with its
+	// decoder
 	//
-	if (get_component_string_start(p_data->header.p_buf,
-				       header_len,
-				       component_info_count,
-				       &string_offset,
-				       &pad_length) == STRING_PRESENT) {
-		p_data->header.string_status = STRING_PRESENT;
-		p_data->header.string_pad_length = pad_length;
-	} else {
-		p_data->header.string_status = STRING_ABSENT;
-		p_data->header.string_pad_length = 0;
-	}
+	decode_component_names(p_data);
 
 	// Parse the components data
 	//
@@ -615,22 +1149,6 @@ parse_header(_1B_DATA_T * p_data, const u16_t header_len,
 
 		info_offset += COMPONENT_INFO_LENGTH;
 
-		if (p_data->header.string_status == STRING_PRESENT) {
-			p_str = (char *) (p_data->header.p_buf +
-					  string_offset);
-			string_len = strlen(p_str);
-			snprintf(p_data->component[i].name, string_len + 1,
-				 "%s", p_str);
-			p_str = NULL;
-
-			string_offset = string_offset + string_len +
-			    p_data->header.string_pad_length;
-
-		} else {
-			string_len = strlen("_1B_component_XXh");
-			snprintf(p_data->component[i].name, string_len + 1,
-				 "_1B_component_%02Xh", i);
-		}
 #ifdef DEBUG
 		printf("Name: %s, ", p_data->component[i].name);
 #endif
@@ -657,6 +1175,14 @@ parse_header(_1B_DATA_T * p_data, const u16_t header_len,
 			p_data->component[i].data_presence = DATA_ABSENT;
 			p_data->component[i].file_offset = 0;
 		}
+
+		p_data->component[i].disk_offset =
+		    p_data->component[i].file_offset;
+		p_data->component[i].disk_length = p_data->component[i].length;
+		p_data->component[i].data_state = DATA_CLEAN;
+		p_data->component[i].p_buf = NULL;
+		p_data->component[i].buf_type = BUFFER_ALLOCATED;
+		p_data->component[i].p_refcount = NULL;
 #ifdef DEBUG
 		printf("Length: 0x%X", p_data->component[i].length);
 		printf("\n");
@@ -668,6 +1194,48 @@ parse_header(_1B_DATA_T * p_data, const u16_t header_len,
 	return SUCCESS;
 }
 
+/*
+ * Read the header info (the first HEADER_INFO_LENGTH bytes of the 1B file) 
+ * from buffer p_buf
+ *
+ * input: 
+ * 	p_buf			pointer to the header info bytes
+ *
+ * output: 
+ * 	p_header_len		length of the 1B header
+ * 	p_component_info_count	number of components info in the header
+ *
+ * return value: 
+ * 	ERROR 	if the header info is invalid
+ * 	SUCCESS	on success
+ */
+STATUS
+parse_header_info(const void *p_buf, u16_t * p_header_len,
+		  u16_t * p_component_info_count)
+{
+	u16_t hdr_len = 0;
+	u16_t component_cnt = 0;
+
+	component_cnt = *((u16_t *) (p_buf + COMPONENT_COUNT_OFFSET));
+	hdr_len = *((u16_t *) (p_buf + HEADER_LENGTH_OFFSET));
+
+#ifdef DEBUG
+	printf("component_info_count = 0x%02X\n", component_cnt);
+	printf("header_length = 0x%02X\n", hdr_len);
+#endif
+
+	// Sanity check on the header info value
+	//
+	if ((hdr_len == 0) || (component_cnt == 0)) {
+		printf("ERROR: Invalid header info\n");
+		return ERROR;
+	}
+
+	*p_component_info_count = component_cnt;
+	*p_header_len = hdr_len;
+	return SUCCESS;
+}
+
 /* 
  * Read the header information required to create header buffer
  *
@@ -687,8 +1255,7 @@ get_header_info(const char *filename, u16_t * p_header_len,
 		u16_t * p_component_info_count)
 {
 	void *p_buf = NULL;
-	u16_t hdr_len = 0;
-	u16_t component_cnt = 0;
+	STATUS status;
 
 	if ((filename == NULL) || (p_header_len == NULL)
 	    || (p_component_info_count == NULL)) {
@@ -701,33 +1268,17 @@ get_header_info(const char *filename, u16_t * p_header_len,
 		printf("ERROR: unable to read header info\n");
 		return ERROR;
 	}
-	// Read header information from the input file
-	//
-	component_cnt = *((u16_t *) (p_buf + COMPONENT_COUNT_OFFSET));
-	hdr_len = *((u16_t *) (p_buf + HEADER_LENGTH_OFFSET));
-
-#ifdef DEBUG
-	printf("component_info_count = 0x%02X\n", component_cnt);
-	printf("header_length = 0x%02X\n", hdr_len);
-#endif
-
-	// Sanity check on the header info value
-	//
-	if ((hdr_len == 0) || (component_cnt == 0)) {
-		printf("ERROR: Invalid header info\n");
-		cleanup_file_chunk_buffer(p_buf);
-		return ERROR;
-	} else {
-		*p_component_info_count = component_cnt;
-		*p_header_len = hdr_len;
 
-		cleanup_file_chunk_buffer(p_buf);
-		return SUCCESS;
-	}
+	status = parse_header_info(p_buf, p_header_len,
+				   p_component_info_count);
+	cleanup_file_chunk_buffer(p_buf);
+	return status;
 }
 
 /*
- * Initialize data structures describing the 1B components.
+ * Initialize data structures describing the 1B components from the 1B 
+ * header only. The components data is not read, the p_buf member of all 
+ * components is NULL.
  * 
  * NOTE: You must call cleanup cleanup_1B_data() when you're finished using 
  * 	 the dynamic data structures created by this function.
@@ -739,12 +1290,11 @@ get_header_info(const char *filename, u16_t * p_header_len,
  * 	NULL	on error 
  * 	Pointer to initialized _1B_DATA_T on success	 
  */
-_1B_DATA_T *init_1B_data(const char *filename)
+_1B_DATA_T *init_1B_header(const char *filename)
 {
 	_1B_DATA_T *p_data = NULL;
 	u16_t hdr_len = 0;
 	u16_t component_cnt = 0;
-	u32_t i;
 	struct stat f_stat;
 
 	if (stat(filename, &f_stat) != 0) {
@@ -763,6 +1313,9 @@ _1B_DATA_T *init_1B_data(const char *filename)
 		       "file data\n");
 		return NULL;
 	}
+	p_data->header.p_buf = NULL;
+	p_data->header.component_info_count = 0;
+	p_data->written_filename[0] = '\0';
 
 	if (get_header_info(filename, &hdr_len, &component_cnt) == ERROR) {
 		printf("ERROR: unable to get header info from "
@@ -791,9 +1344,40 @@ _1B_DATA_T *init_1B_data(const char *filename)
 	strncpy(p_data->filename, filename, strlen(filename) + 1);
 	p_data->size = f_stat.st_size;
 
+	return p_data;
+}
+
+/*
+ * Initialize data structures describing the 1B components.
+ * 
+ * NOTE: You must call cleanup cleanup_1B_data() when you're finished using 
+ * 	 the dynamic data structures created by this function.
+ *
+ * input: 
+ * 	filename	1B filename string
+ *
+ * returns: 
+ * 	NULL	on error 
+ * 	Pointer to initialized _1B_DATA_T on success	 
+ */
+_1B_DATA_T *init_1B_data(const char *filename)
+{
+	_1B_DATA_T *p_data = NULL;
+	u32_t i;
+
+	// Read the whole file in a few large reads instead of one read per 
+	// component
+	//
+	if (get_1B_read_mode() == READ_DIRECT)
+		return init_1B_data_direct(filename);
+
+	p_data = init_1B_header(filename);
+	if (p_data == NULL)
+		return NULL;
+
 	// Read the components data to buffer for components with data present in the 1B file
 	//
-	for (i = 0; i < component_cnt; i++) {
+	for (i = 0; i < p_data->header.component_info_count; i++) {
 		if (p_data->component[i].data_presence == DATA_ABSENT) {
 			continue;
 		} else if (p_data->component[i].data_presence ==
@@ -844,10 +1428,8 @@ void cleanup_1B_data(_1B_DATA_T * p_data)
 	// Cleanup the components file buffer 
 	//
 	for (i = 0; i < p_data->header.component_info_count; i++) {
-		if (p_data->component[i].p_buf != NULL) {
-			cleanup_file_chunk_buffer(p_data->
-						  component[i].p_buf);
-		}
+		if (p_data->component[i].p_buf != NULL)
+			release_component_buffer(&(p_data->component[i]));
 	}
 
 	// Cleanup the _1B_DATA_T structure
@@ -888,6 +1470,7 @@ STATUS list_components(_1B_DATA_T * p_data)
 	} else {
 		printf("Component string doesn't exist \n");
 	}
+	printf("Header variant: %s\n", get_header_variant(p_data));
 
 	// Display each component information 
 	//
@@ -912,3 +1495,214 @@ STATUS list_components(_1B_DATA_T * p_data)
 
 	return SUCCESS;
 }
+
+
+/*
+ * qsort() callback to sort pointers to components by target physical address
+ */
+static int compare_component_address(const void *p_a, const void *p_b)
+{
+	const _1B_COMPONENT_T *p_comp_a = *((_1B_COMPONENT_T **) p_a);
+	const _1B_COMPONENT_T *p_comp_b = *((_1B_COMPONENT_T **) p_b);
+
+	if (p_comp_a->physical_address < p_comp_b->physical_address)
+		return -1;
+	else if (p_comp_a->physical_address > p_comp_b->physical_address)
+		return 1;
+	else
+		return 0;
+}
+
+
+/*
+ * Write the components to output file filename, each component placed at 
+ * its target physical address, i.e. the memory layout after the components 
+ * are relocated by the BIOS code. Components which are not present in the 
+ * 1B file are left as holes, so the output file stays sparse. Components 
+ * which overlap in physical memory are reported.
+ *
+ * input: 
+ * 	p_data		pointer to initialized _1B_DATA_T 
+ * 	filename	name of the output file
+ *
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+STATUS write_memory_image(_1B_DATA_T * p_data, const char *filename)
+{
+	_1B_COMPONENT_T *sorted[MAX_COMPONENT];
+	_1B_COMPONENT_T *p_comp = NULL, *p_next = NULL;
+	u16_t i, j, count;
+	off_t end, image_size = 0;
+	FILE *f_out = NULL;
+
+	if ((p_data == NULL) || (filename == NULL)) {
+		printf("ERROR: function %s() "
+		       "invalid p_data/filename pointer\n", __func__);
+		return ERROR;
+	}
+
+	count = p_data->header.component_info_count;
+	for (i = 0; i < count; i++) {
+		sorted[i] = &(p_data->component[i]);
+
+		end = (off_t) sorted[i]->physical_address + sorted[i]->length;
+		if (end > image_size)
+			image_size = end;
+	}
+
+	// Report the components which overlap in physical memory
+	//
+	qsort(sorted, count, sizeof(sorted[0]), compare_component_address);
+
+	for (i = 0; i < count; i++) {
+		p_comp = sorted[i];
+		end = (off_t) p_comp->physical_address + p_comp->length;
+
+		for (j = i + 1; j < count; j++) {
+			p_next = sorted[j];
+			if (p_next->physical_address >= end)
+				break;
+
+			printf("Warning: %s [0x%X-0x%lX]%s overlaps "
+			       "%s [0x%X-0x%lX]%s\n",
+			       p_comp->name, p_comp->physical_address, end - 1,
+			       (p_comp->data_presence == DATA_PRESENT) ?
+			       "" : " (not present)", p_next->name,
+			       p_next->physical_address,
+			       (off_t) p_next->physical_address +
+			       p_next->length - 1,
+			       (p_next->data_presence == DATA_PRESENT) ?
+			       "" : " (not present)");
+		}
+	}
+
+	f_out = fopen(filename, "wb");
+	if (f_out == NULL) {
+		printf("ERROR: function %s() unable to open output file "
+		       "for writing\n", __func__);
+		return ERROR;
+	}
+
+	printf("%s: Writing memory image of 0x%lX bytes to %s ..\n",
+	       __func__, image_size, filename);
+
+	// Write each present component at its physical address, the holes 
+	// between them are not written at all
+	//
+	for (i = 0; i < count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		if (write_buffer_to_file_offset(f_out,
+						p_comp->physical_address,
+						p_comp->p_buf,
+						p_comp->length, NULL) == ERROR) {
+			printf("%s: Error writing component %s to output "
+			       "file %s\n", __func__, p_comp->name, filename);
+			fclose(f_out);
+			return ERROR;
+		}
+	}
+
+	// Extend the file to cover the trailing absent components
+	//
+	if ((fflush(f_out) != 0) ||
+	    (ftruncate(fileno(f_out), image_size) != 0)) {
+		printf("%s: Error setting the size of output file %s\n",
+		       __func__, filename);
+		fclose(f_out);
+		return ERROR;
+	}
+
+	fclose(f_out);
+	return SUCCESS;
+}
+
+
+/*
+ * Worker thread: takes the next work item and processes it
+ */
+static void *pool_worker(void *p_arg)
+{
+	WORKER_POOL_T *p_pool = (WORKER_POOL_T *) p_arg;
+	u32_t i;
+
+	while (1) {
+		pthread_mutex_lock(&p_pool->lock);
+		if (p_pool->next >= p_pool->count) {
+			pthread_mutex_unlock(&p_pool->lock);
+			break;
+		}
+		i = p_pool->next++;
+		pthread_mutex_unlock(&p_pool->lock);
+
+		p_pool->p_work(p_pool->p_context, i);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Return the number of worker threads to use for count work items
+ */
+static u32_t get_worker_thread_count(u32_t count)
+{
+	long cpus = 4;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (cpus < 1)
+		cpus = 1;
+	if (cpus > MAX_WORKER_THREADS)
+		cpus = MAX_WORKER_THREADS;
+	if (cpus > count)
+		cpus = count;
+
+	return cpus;
+}
+
+
+/*
+ * Process work items 0 to count - 1 concurrently: p_work is called once
+ * per work item by up to one thread per CPU, in the calling thread if no
+ * thread can be created. Returns when all work items are processed.
+ *
+ * input:
+ * 	count		number of work items
+ * 	p_work		function processing one work item, must be thread-safe
+ * 	p_context	passed to p_work
+ */
+void run_worker_pool(u32_t count, WORK_ITEM_FUNC p_work, void *p_context)
+{
+	pthread_t threads[MAX_WORKER_THREADS];
+	WORKER_POOL_T pool;
+	u32_t i, thread_count, started = 0;
+
+	pool.p_work = p_work;
+	pool.p_context = p_context;
+	pool.count = count;
+	pool.next = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	thread_count = get_worker_thread_count(count);
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&threads[started], NULL, pool_worker,
+				   &pool) == 0)
+			started++;
+	}
+
+	if (started == 0)
+		pool_worker(&pool);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&pool.lock);
+}
@@ -0,0 +1,523 @@
+/*
+ * ami_1B_manifest.c
+ *
+ * Golden manifest of a 1B file: the header fields, the component names,
+ * physical addresses, presence flags, file offsets, lengths and SHA-256
+ * digests. A 1B file is verified against a manifest by checking the header
+ * fields first and then hashing the components in parallel.
+ *
+ * Manifest format (text, one component per line in header order):
+ *
+ * 	# 1B file: <1B_filename>
+ * 	# header length: 0x<len>, components: 0x<count>, size: 0x<size>
+ * 	# header sha256: <sha256>
+ * 	# header: <raw header bytes in hexadecimal>
+ * 	# name physical_address present file_offset length sha256
+ * 	<name> 0x<address> <0|1> 0x<offset> 0x<length> <sha256|->
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ami_1B_internal.h"
+
+#define MAX_MANIFEST_LINE	(MAX_PATH + MAX_COMPONENT_NAME + 128)	// maximum
+							// length of one component line
+
+#define MAX_HEADER_LINE		(0x10000 * 2 + 16)	// maximum length of the
+							// raw header line
+
+#define VERIFY_CHUNK_SIZE	0x10000	// size of the read buffer of each
+					// hashing thread
+
+// State shared by the hashing threads
+//
+typedef struct {
+	_1B_MANIFEST_T *p_manifest;
+	_1B_DATA_T *p_data;
+	VERIFY_MODE mode;
+
+	pthread_mutex_t lock;	// protects the members below
+	s32_t mismatches;	// number of mismatches found
+	STATUS status;		// ERROR on read error
+	int stop;		// set to stop the threads early
+} VERIFY_JOB_T;
+
+
+/*
+ * Create the manifest of the 1B file. The components data must be loaded
+ * (see init_1B_data()).
+ *
+ * NOTE: Caller must free the returned buffer.
+ *
+ * input:
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * output:
+ * 	p_len	length of the returned manifest
+ *
+ * return value:
+ * 	NULL 			on error
+ * 	pointer to manifest	on success
+ */
+char *create_1B_manifest(_1B_DATA_T * p_data, u32_t * p_len)
+{
+	char *p_manifest = NULL;
+	char sha256[SHA256_HEX_LENGTH + 1];
+	size_t size, len;
+	u16_t i;
+	_1B_COMPONENT_T *p_comp = NULL;
+
+	if ((p_data == NULL) || (p_len == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return NULL;
+	}
+
+	size = (p_data->header.component_info_count + 4) * MAX_MANIFEST_LINE +
+	    p_data->header.length * 2 + 16;
+	p_manifest = (char *) malloc(size);
+	if (p_manifest == NULL) {
+		printf("ERROR: function %s() unable to allocate manifest "
+		       "buffer\n", __func__);
+		return NULL;
+	}
+
+	sha256_buffer_to_hex(p_data->header.p_buf, p_data->header.length,
+			     sha256);
+	len = snprintf(p_manifest, size,
+		       "# 1B file: %s\n"
+		       "# header length: 0x%X, components: 0x%X, "
+		       "size: 0x%lX\n"
+		       "# header sha256: %s\n"
+		       "# name physical_address present file_offset length "
+		       "sha256\n", p_data->filename, p_data->header.length,
+		       p_data->header.component_info_count,
+		       p_data->calculated_size, sha256);
+
+	len += snprintf(p_manifest + len, size - len, "# header: ");
+	for (i = 0; i < p_data->header.length; i++)
+		len += snprintf(p_manifest + len, size - len, "%02x",
+				((u8_t *) p_data->header.p_buf)[i]);
+	len += snprintf(p_manifest + len, size - len, "\n");
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if (p_comp->data_presence == DATA_PRESENT) {
+			if (p_comp->p_buf == NULL) {
+				printf("ERROR: function %s() component %s "
+				       "data not loaded\n", __func__,
+				       p_comp->name);
+				free(p_manifest);
+				return NULL;
+			}
+			sha256_buffer_to_hex(p_comp->p_buf, p_comp->length,
+					     sha256);
+		} else {
+			strcpy(sha256, "-");
+		}
+
+		len += snprintf(p_manifest + len, size - len,
+				"%s 0x%X %d 0x%lX 0x%X %s\n", p_comp->name,
+				p_comp->physical_address,
+				(p_comp->data_presence == DATA_PRESENT),
+				p_comp->file_offset, p_comp->length, sha256);
+	}
+
+	*p_len = len;
+	return p_manifest;
+}
+
+
+/*
+ * Read a manifest file created by create_1B_manifest()
+ *
+ * NOTE: You must call cleanup_1B_manifest() when you're finished using
+ * 	 the manifest.
+ *
+ * input:
+ * 	filename	name of the manifest file
+ *
+ * return value:
+ * 	NULL 				on error
+ * 	pointer to _1B_MANIFEST_T	on success
+ */
+_1B_MANIFEST_T *init_1B_manifest(const char *filename)
+{
+	_1B_MANIFEST_T *p_manifest = NULL;
+	MANIFEST_ENTRY_T *p_entry = NULL;
+	char *line = NULL;
+	unsigned int hdr_len, count, byte;
+	int present;
+	u32_t j;
+	u16_t i = 0;
+	FILE *f_in = NULL;
+
+	f_in = fopen(filename, "r");
+	if (f_in == NULL) {
+		printf("ERROR: function %s() unable to open manifest %s\n",
+		       __func__, filename);
+		return NULL;
+	}
+
+	p_manifest = (_1B_MANIFEST_T *) malloc(sizeof(_1B_MANIFEST_T));
+	if (p_manifest == NULL) {
+		printf("ERROR: unable to allocate memory for manifest\n");
+		fclose(f_in);
+		return NULL;
+	}
+	memset(p_manifest, 0, sizeof(_1B_MANIFEST_T));
+
+	line = (char *) malloc(MAX_HEADER_LINE);
+	if (line == NULL) {
+		printf("ERROR: unable to allocate memory for manifest\n");
+		cleanup_1B_manifest(p_manifest);
+		fclose(f_in);
+		return NULL;
+	}
+
+	while (fgets(line, MAX_HEADER_LINE, f_in) != NULL) {
+		if (line[0] == '#') {
+			if (sscanf(line, "# header length: 0x%X, "
+				   "components: 0x%X, size: 0x%lX",
+				   &hdr_len, &count, &p_manifest->size) == 3) {
+				p_manifest->header_length = hdr_len;
+				p_manifest->component_info_count = count;
+			} else if ((!strncmp(line, "# header: ", 10)) &&
+				   (p_manifest->header_length > 0) &&
+				   (p_manifest->p_header == NULL)) {
+				// Raw header, used as 1B build template
+				//
+				p_manifest->p_header =
+				    (u8_t *) malloc(p_manifest->header_length);
+				for (j = 0; (p_manifest->p_header != NULL) &&
+				     (j < p_manifest->header_length); j++) {
+					if (sscanf(line + 10 + j * 2, "%2x",
+						   &byte) != 1)
+						break;
+					p_manifest->p_header[j] = byte;
+				}
+
+				if ((p_manifest->p_header != NULL) &&
+				    (j < p_manifest->header_length)) {
+					free(p_manifest->p_header);
+					p_manifest->p_header = NULL;
+				}
+			} else {
+				sscanf(line, "# header sha256: %64s",
+				       p_manifest->header_sha256);
+			}
+			continue;
+		}
+
+		if (i >= MAX_COMPONENT) {
+			printf("ERROR: function %s() maximum supported "
+			       "number of 1B components exceeded\n",
+			       __func__);
+			cleanup_1B_manifest(p_manifest);
+			free(line);
+			fclose(f_in);
+			return NULL;
+		}
+
+		p_entry = &(p_manifest->entry[i]);
+		if (sscanf(line, "%199s 0x%X %d 0x%lX 0x%X %64s",
+			   p_entry->name, &p_entry->physical_address,
+			   &present, &p_entry->file_offset, &p_entry->length,
+			   p_entry->sha256) != 6)
+			continue;
+
+		p_entry->data_presence = present ? DATA_PRESENT : DATA_ABSENT;
+		i++;
+	}
+	free(line);
+	fclose(f_in);
+
+	if ((p_manifest->component_info_count == 0) ||
+	    (p_manifest->component_info_count != i)) {
+		printf("ERROR: function %s() invalid manifest %s\n",
+		       __func__, filename);
+		cleanup_1B_manifest(p_manifest);
+		return NULL;
+	}
+
+	return p_manifest;
+}
+
+
+void cleanup_1B_manifest(_1B_MANIFEST_T * p_manifest)
+{
+	if (p_manifest == NULL)
+		return;
+
+	if (p_manifest->p_header != NULL)
+		free(p_manifest->p_header);
+
+	free(p_manifest);
+}
+
+
+/*
+ * Compare the header fields of the 1B file with the manifest
+ *
+ * return value:
+ * 	number of mismatches
+ */
+static s32_t verify_header_fields(_1B_MANIFEST_T * p_manifest,
+				  _1B_DATA_T * p_data, VERIFY_MODE mode)
+{
+	char sha256[SHA256_HEX_LENGTH + 1];
+	MANIFEST_ENTRY_T *p_entry = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	s32_t mismatches = 0;
+	u16_t i;
+
+#define REPORT_MISMATCH(...)					\
+	do {							\
+		printf("MISMATCH: %s: ", p_data->filename);	\
+		printf(__VA_ARGS__);				\
+		mismatches++;					\
+		if (mode == VERIFY_FIRST_MISMATCH)		\
+			return mismatches;			\
+	} while (0)
+
+	if (p_data->header.length != p_manifest->header_length)
+		REPORT_MISMATCH("header length 0x%X, expected 0x%X\n",
+				p_data->header.length,
+				p_manifest->header_length);
+
+	if (p_data->header.component_info_count !=
+	    p_manifest->component_info_count) {
+		REPORT_MISMATCH("component count 0x%X, expected 0x%X\n",
+				p_data->header.component_info_count,
+				p_manifest->component_info_count);
+		// The components can't be compared one by one
+		//
+		return mismatches;
+	}
+
+	if (p_data->size != p_manifest->size)
+		REPORT_MISMATCH("file size 0x%lX, expected 0x%lX\n",
+				p_data->size, p_manifest->size);
+
+	if (p_data->calculated_size != p_manifest->size)
+		REPORT_MISMATCH("calculated size 0x%lX, expected 0x%lX\n",
+				p_data->calculated_size, p_manifest->size);
+
+	sha256_buffer_to_hex(p_data->header.p_buf, p_data->header.length,
+			     sha256);
+	if (strcmp(sha256, p_manifest->header_sha256))
+		REPORT_MISMATCH("header sha256 %s, expected %s\n", sha256,
+				p_manifest->header_sha256);
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		p_entry = &(p_manifest->entry[i]);
+
+		if (strcmp(p_comp->name, p_entry->name))
+			REPORT_MISMATCH("component[%02Xh] name %s, "
+					"expected %s\n", i, p_comp->name,
+					p_entry->name);
+
+		if (p_comp->physical_address != p_entry->physical_address)
+			REPORT_MISMATCH("%s physical address 0x%X, "
+					"expected 0x%X\n", p_entry->name,
+					p_comp->physical_address,
+					p_entry->physical_address);
+
+		if (p_comp->data_presence != p_entry->data_presence)
+			REPORT_MISMATCH("%s presence %d, expected %d\n",
+					p_entry->name,
+					p_comp->data_presence,
+					p_entry->data_presence);
+
+		if (p_comp->length != p_entry->length)
+			REPORT_MISMATCH("%s length 0x%X, expected 0x%X\n",
+					p_entry->name, p_comp->length,
+					p_entry->length);
+
+		if (p_comp->file_offset != p_entry->file_offset)
+			REPORT_MISMATCH("%s file offset 0x%lX, "
+					"expected 0x%lX\n", p_entry->name,
+					p_comp->file_offset,
+					p_entry->file_offset);
+	}
+
+#undef REPORT_MISMATCH
+
+	return mismatches;
+}
+
+
+/*
+ * Set the verification status to ERROR and stop the hashing threads
+ */
+static void stop_verify_job(VERIFY_JOB_T * p_job)
+{
+	pthread_mutex_lock(&p_job->lock);
+	p_job->status = ERROR;
+	p_job->stop = 1;
+	pthread_mutex_unlock(&p_job->lock);
+}
+
+
+/*
+ * Work item of the worker pool: hashes the data of component index straight
+ * from the 1B file and compares the digest with the manifest
+ */
+static void verify_work(void *p_context, u32_t index)
+{
+	VERIFY_JOB_T *p_job = (VERIFY_JOB_T *) p_context;
+	_1B_COMPONENT_T *p_comp = &(p_job->p_data->component[index]);
+	MANIFEST_ENTRY_T *p_entry = &(p_job->p_manifest->entry[index]);
+	SHA256_CTX_T ctx;
+	u8_t digest[SHA256_DIGEST_LENGTH];
+	char sha256[SHA256_HEX_LENGTH + 1];
+	u8_t *p_buf = NULL;
+	size_t chunk, read_size;
+	u32_t remaining;
+	FILE *f_in = NULL;
+
+	// Another thread found a mismatch already
+	//
+	if (__atomic_load_n(&p_job->stop, __ATOMIC_RELAXED) ||
+	    (p_comp->data_presence != DATA_PRESENT))
+		return;
+
+	// A component cut off by a truncated 1B file can't match, it's not a
+	// read error
+	//
+	if (p_comp->file_offset + (off_t) p_comp->length >
+	    p_job->p_data->size) {
+		pthread_mutex_lock(&p_job->lock);
+		p_job->mismatches++;
+		if (p_job->mode == VERIFY_FIRST_MISMATCH)
+			p_job->stop = 1;
+		printf("MISMATCH: %s: %s beyond the end of the 1B file\n",
+		       p_job->p_data->filename, p_entry->name);
+		pthread_mutex_unlock(&p_job->lock);
+		return;
+	}
+
+	f_in = fopen(p_job->p_data->filename, "rb");
+	p_buf = (u8_t *) malloc(VERIFY_CHUNK_SIZE);
+
+	if ((f_in == NULL) || (p_buf == NULL) ||
+	    (fseek(f_in, p_comp->file_offset, SEEK_SET) != 0)) {
+		printf("ERROR: function %s() unable to read %s\n", __func__,
+		       p_job->p_data->filename);
+		stop_verify_job(p_job);
+		goto out;
+	}
+
+	sha256_init(&ctx);
+	remaining = p_comp->length;
+	while (remaining > 0) {
+		chunk = (remaining > VERIFY_CHUNK_SIZE) ?
+		    VERIFY_CHUNK_SIZE : remaining;
+
+		read_size = fread(p_buf, sizeof(u8_t), chunk, f_in);
+		if (read_size != chunk) {
+			printf("ERROR: function %s() unable to read %s from "
+			       "%s\n", __func__, p_comp->name,
+			       p_job->p_data->filename);
+			stop_verify_job(p_job);
+			goto out;
+		}
+
+		sha256_update(&ctx, p_buf, read_size);
+		remaining -= read_size;
+
+		if (__atomic_load_n(&p_job->stop, __ATOMIC_RELAXED))
+			goto out;
+	}
+
+	sha256_final(&ctx, digest);
+	sha256_digest_to_hex(digest, sha256);
+
+	if (strcmp(sha256, p_entry->sha256)) {
+		pthread_mutex_lock(&p_job->lock);
+		p_job->mismatches++;
+		if (p_job->mode == VERIFY_FIRST_MISMATCH)
+			p_job->stop = 1;
+		printf("MISMATCH: %s: %s sha256 %s, expected %s\n",
+		       p_job->p_data->filename, p_entry->name, sha256,
+		       p_entry->sha256);
+		pthread_mutex_unlock(&p_job->lock);
+	}
+
+ out:
+	if (p_buf != NULL)
+		free(p_buf);
+	if (f_in != NULL)
+		fclose(f_in);
+}
+
+
+/*
+ * Verify 1B file filename against manifest p_manifest. The header fields
+ * are checked first, then the components data are hashed in parallel.
+ * In VERIFY_FIRST_MISMATCH mode the verification stops at the first
+ * mismatch, in VERIFY_ALL mode every mismatch is reported.
+ *
+ * input:
+ * 	p_manifest	pointer to manifest read by init_1B_manifest()
+ * 	filename	name of the 1B file
+ * 	mode		verification mode
+ *
+ * return value:
+ * 	ERROR 			on error
+ * 	number of mismatches	on success (0 if the 1B file matches)
+ */
+s32_t verify_1B_file(_1B_MANIFEST_T * p_manifest, const char *filename,
+		     VERIFY_MODE mode)
+{
+	VERIFY_JOB_T job;
+	s32_t mismatches;
+
+	if ((p_manifest == NULL) || (filename == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+	// Only the header is needed, the threads read the components data
+	//
+	job.p_data = init_1B_header(filename);
+	if (job.p_data == NULL)
+		return ERROR;
+
+	mismatches = verify_header_fields(p_manifest, job.p_data, mode);
+	if ((mismatches > 0) && ((mode == VERIFY_FIRST_MISMATCH) ||
+				 (job.p_data->header.component_info_count !=
+				  p_manifest->component_info_count))) {
+		cleanup_1B_data(job.p_data);
+		return mismatches;
+	}
+
+	job.p_manifest = p_manifest;
+	job.mode = mode;
+	job.mismatches = mismatches;
+	job.status = SUCCESS;
+	job.stop = 0;
+	pthread_mutex_init(&job.lock, NULL);
+
+	run_worker_pool(job.p_data->header.component_info_count, verify_work,
+			&job);
+
+	pthread_mutex_destroy(&job.lock);
+	cleanup_1B_data(job.p_data);
+
+	if (job.status == ERROR)
+		return ERROR;
+
+	return job.mismatches;
+}
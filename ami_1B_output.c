@@ -0,0 +1,652 @@
+/*
+ * ami_1B_output.c
+ *
+ * Bulk output engine to write the components of many 1B files into
+ * individual files. On Linux the open/write/close of the component files
+ * are submitted in batches through io_uring. When io_uring is not
+ * available, the component files are written one by one with stdio.
+ *
+ * In OUTPUT_CHANGED mode only the component files which differ from the
+ * existing output files are rewritten. The SHA-256 digest of each written
+ * file is stored in a <component>.sha256 sidecar file (sha256sum format).
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#if defined(IORING_RSRC_REGISTER_SPARSE) && defined(__NR_io_uring_setup)
+#define USE_IO_URING		/** Kernel headers support direct descriptors */
+#endif
+#endif
+
+#include "ami_1B_internal.h"
+
+#define MAX_OUTPUT_PATH	(MAX_PATH + MAX_COMPONENT_NAME)	// maximum length of
+							// output file path
+
+#define SIDECAR_SUFFIX	".sha256"	// suffix of the digest sidecar files
+
+#define COMPARE_CHUNK_SIZE	0x10000	// read size when comparing an existing
+					// output file with the component data
+
+// What to do with one component file
+//
+typedef enum {
+	JOB_WRITE = 0,		// write the file (and its sidecar)
+	JOB_SKIP = 1,		// the file is up to date
+	JOB_SIDECAR = 2,	// the file is up to date, only write its sidecar
+} JOB_ACTION;
+
+// One component file to be written
+//
+typedef struct {
+	char path[MAX_OUTPUT_PATH];	// output file path
+
+	void *p_buf;		// component data
+
+	u32_t len;		// component length in bytes
+
+	STATUS status;		// SUCCESS once the file was completely written
+
+	JOB_ACTION action;	// what to do with the file
+
+	char sha256[SHA256_HEX_LENGTH + 1];	// digest of the component data
+	// (only calculated in OUTPUT_CHANGED mode, empty until needed)
+
+} OUTPUT_JOB_T;
+
+#ifdef USE_IO_URING
+
+#define URING_FILE_SLOTS	64	// number of files in flight per batch
+
+#define URING_OPS_PER_FILE	3	// openat + write + close
+
+#define URING_ENTRIES		(URING_FILE_SLOTS * URING_OPS_PER_FILE)
+
+typedef struct {
+	int fd;			// io_uring file descriptor
+
+	void *p_sq_ring;	// mapped submission queue ring
+	size_t sq_ring_size;
+	void *p_cq_ring;	// mapped completion queue ring
+	size_t cq_ring_size;
+	struct io_uring_sqe *p_sqes;	// mapped submission queue entries
+	size_t sqes_size;
+
+	u32_t *p_sq_tail;
+	u32_t *p_sq_mask;
+	u32_t *p_sq_array;
+
+	u32_t *p_cq_head;
+	u32_t *p_cq_tail;
+	u32_t *p_cq_mask;
+	struct io_uring_cqe *p_cqes;
+
+} URING_T;
+
+
+/*
+ * Release the io_uring instance
+ */
+static void cleanup_uring(URING_T * p_ring)
+{
+	if ((p_ring->p_cq_ring != NULL) &&
+	    (p_ring->p_cq_ring != p_ring->p_sq_ring))
+		munmap(p_ring->p_cq_ring, p_ring->cq_ring_size);
+
+	if (p_ring->p_sq_ring != NULL)
+		munmap(p_ring->p_sq_ring, p_ring->sq_ring_size);
+
+	if (p_ring->p_sqes != NULL)
+		munmap(p_ring->p_sqes, p_ring->sqes_size);
+
+	if (p_ring->fd >= 0)
+		close(p_ring->fd);
+}
+
+
+/*
+ * Create an io_uring instance with a sparse table of URING_FILE_SLOTS
+ * direct descriptors. The component files are opened into the direct
+ * descriptor table, so the open, write and close of one file can be
+ * submitted at once as a linked chain.
+ *
+ * return value:
+ * 	ERROR 	if io_uring (or direct descriptors) is not available
+ * 	SUCCESS	on success
+ */
+static STATUS init_uring(URING_T * p_ring)
+{
+	struct io_uring_params params;
+	struct io_uring_rsrc_register files;
+
+	memset(p_ring, 0, sizeof(URING_T));
+	memset(&params, 0, sizeof(params));
+
+	p_ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (p_ring->fd < 0)
+		return ERROR;
+
+	p_ring->sq_ring_size = params.sq_off.array +
+	    params.sq_entries * sizeof(u32_t);
+	p_ring->cq_ring_size = params.cq_off.cqes +
+	    params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (p_ring->cq_ring_size > p_ring->sq_ring_size)
+			p_ring->sq_ring_size = p_ring->cq_ring_size;
+		p_ring->cq_ring_size = p_ring->sq_ring_size;
+	}
+
+	p_ring->p_sq_ring = mmap(NULL, p_ring->sq_ring_size,
+				 PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, p_ring->fd,
+				 IORING_OFF_SQ_RING);
+	if (p_ring->p_sq_ring == MAP_FAILED) {
+		p_ring->p_sq_ring = NULL;
+		cleanup_uring(p_ring);
+		return ERROR;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		p_ring->p_cq_ring = p_ring->p_sq_ring;
+	} else {
+		p_ring->p_cq_ring = mmap(NULL, p_ring->cq_ring_size,
+					 PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_POPULATE,
+					 p_ring->fd, IORING_OFF_CQ_RING);
+		if (p_ring->p_cq_ring == MAP_FAILED) {
+			p_ring->p_cq_ring = NULL;
+			cleanup_uring(p_ring);
+			return ERROR;
+		}
+	}
+
+	p_ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	p_ring->p_sqes = mmap(NULL, p_ring->sqes_size,
+			      PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, p_ring->fd,
+			      IORING_OFF_SQES);
+	if (p_ring->p_sqes == MAP_FAILED) {
+		p_ring->p_sqes = NULL;
+		cleanup_uring(p_ring);
+		return ERROR;
+	}
+
+	p_ring->p_sq_tail = p_ring->p_sq_ring + params.sq_off.tail;
+	p_ring->p_sq_mask = p_ring->p_sq_ring + params.sq_off.ring_mask;
+	p_ring->p_sq_array = p_ring->p_sq_ring + params.sq_off.array;
+
+	p_ring->p_cq_head = p_ring->p_cq_ring + params.cq_off.head;
+	p_ring->p_cq_tail = p_ring->p_cq_ring + params.cq_off.tail;
+	p_ring->p_cq_mask = p_ring->p_cq_ring + params.cq_off.ring_mask;
+	p_ring->p_cqes = p_ring->p_cq_ring + params.cq_off.cqes;
+
+	// Register the (empty) direct descriptor table
+	//
+	memset(&files, 0, sizeof(files));
+	files.nr = URING_FILE_SLOTS;
+	files.flags = IORING_RSRC_REGISTER_SPARSE;
+	if (syscall(__NR_io_uring_register, p_ring->fd,
+		    IORING_REGISTER_FILES2, &files, sizeof(files)) < 0) {
+		cleanup_uring(p_ring);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Queue one submission queue entry, return pointer to it
+ */
+static struct io_uring_sqe *get_uring_sqe(URING_T * p_ring, u32_t * p_tail)
+{
+	struct io_uring_sqe *p_sqe = NULL;
+	u32_t index;
+
+	index = *p_tail & *p_ring->p_sq_mask;
+	p_sqe = &(p_ring->p_sqes[index]);
+	memset(p_sqe, 0, sizeof(struct io_uring_sqe));
+
+	p_ring->p_sq_array[index] = index;
+	(*p_tail)++;
+
+	return p_sqe;
+}
+
+
+/*
+ * Write a batch of at most URING_FILE_SLOTS jobs. Each job is submitted as
+ * a linked openat -> write -> close chain on direct descriptor slot i.
+ * The status of a job is SUCCESS only if all three operations completed.
+ *
+ * return value:
+ * 	ERROR 	if io_uring_enter() fails (the submitted entries are
+ * 		reaped first if possible)
+ * 	SUCCESS	on success (individual jobs may still have failed)
+ */
+static STATUS write_uring_batch(URING_T * p_ring, OUTPUT_JOB_T * p_jobs,
+				u32_t count)
+{
+	struct io_uring_sqe *p_sqe = NULL;
+	struct io_uring_cqe *p_cqe = NULL;
+	u32_t i, tail, head, done[URING_FILE_SLOTS];
+	u32_t queued, submitted, reaped, job, op;
+	STATUS status = SUCCESS;
+	long ret;
+
+	tail = *p_ring->p_sq_tail;
+
+	for (i = 0; i < count; i++) {
+		p_jobs[i].status = ERROR;
+		done[i] = 0;
+
+		p_sqe = get_uring_sqe(p_ring, &tail);
+		p_sqe->opcode = IORING_OP_OPENAT;
+		p_sqe->fd = AT_FDCWD;
+		p_sqe->addr = (unsigned long) p_jobs[i].path;
+		p_sqe->len = 0644;
+		p_sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+		p_sqe->file_index = i + 1;
+		p_sqe->flags = IOSQE_IO_LINK;
+		p_sqe->user_data = ((__u64) i * URING_OPS_PER_FILE) + 0;
+
+		p_sqe = get_uring_sqe(p_ring, &tail);
+		p_sqe->opcode = IORING_OP_WRITE;
+		p_sqe->fd = i;
+		p_sqe->addr = (unsigned long) p_jobs[i].p_buf;
+		p_sqe->len = p_jobs[i].len;
+		p_sqe->off = 0;
+		p_sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+		p_sqe->user_data = ((__u64) i * URING_OPS_PER_FILE) + 1;
+
+		p_sqe = get_uring_sqe(p_ring, &tail);
+		p_sqe->opcode = IORING_OP_CLOSE;
+		p_sqe->file_index = i + 1;
+		p_sqe->user_data = ((__u64) i * URING_OPS_PER_FILE) + 2;
+	}
+
+	__atomic_store_n(p_ring->p_sq_tail, tail, __ATOMIC_RELEASE);
+
+	queued = count * URING_OPS_PER_FILE;
+	submitted = 0;
+	reaped = 0;
+
+	// Submit the queued entries (io_uring_enter() may take fewer of them
+	// than asked, the rest is submitted again) and reap the completions
+	// of the submitted ones
+	//
+	while (reaped < queued) {
+		if (submitted < queued) {
+			ret = syscall(__NR_io_uring_enter, p_ring->fd,
+				      queued - submitted, 0, 0, NULL, 0);
+			if (ret > 0) {
+				submitted += ret;
+			} else if ((ret < 0) && (errno == EINTR)) {
+				continue;
+			} else if ((reaped == submitted) ||
+				   ((ret < 0) && (errno != EAGAIN) &&
+				    (errno != EBUSY))) {
+				// Nothing more can be submitted, only wait for
+				// the submitted entries
+				//
+				status = ERROR;
+				queued = submitted;
+				continue;
+			}
+		}
+
+		head = *p_ring->p_cq_head;
+		if (head == __atomic_load_n(p_ring->p_cq_tail,
+					    __ATOMIC_ACQUIRE)) {
+			if (reaped == submitted)
+				continue;
+
+			if ((syscall(__NR_io_uring_enter, p_ring->fd, 0, 1,
+				     IORING_ENTER_GETEVENTS, NULL, 0) < 0) &&
+			    (errno != EINTR))
+				return ERROR;
+			continue;
+		}
+
+		p_cqe = &(p_ring->p_cqes[head & *p_ring->p_cq_mask]);
+		job = p_cqe->user_data / URING_OPS_PER_FILE;
+		op = p_cqe->user_data % URING_OPS_PER_FILE;
+
+		if ((p_cqe->res >= 0) &&
+		    ((op != 1) || ((u32_t) p_cqe->res == p_jobs[job].len)))
+			done[job]++;
+
+		__atomic_store_n(p_ring->p_cq_head, head + 1,
+				 __ATOMIC_RELEASE);
+		reaped++;
+	}
+
+	if (status == ERROR)
+		return ERROR;
+
+	for (i = 0; i < count; i++) {
+		if (done[i] == URING_OPS_PER_FILE)
+			p_jobs[i].status = SUCCESS;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Write the jobs through io_uring in batches of URING_FILE_SLOTS files.
+ *
+ * return value:
+ * 	ERROR 	if io_uring is not usable, no job was written
+ * 	SUCCESS	on success (individual jobs may still have failed)
+ */
+static STATUS write_jobs_uring(OUTPUT_JOB_T * p_jobs, u32_t count)
+{
+	URING_T ring;
+	u32_t i, batch;
+
+	if (init_uring(&ring) == ERROR)
+		return ERROR;
+
+	for (i = 0; i < count; i += batch) {
+		batch = count - i;
+		if (batch > URING_FILE_SLOTS)
+			batch = URING_FILE_SLOTS;
+
+		if (write_uring_batch(&ring, &p_jobs[i], batch) == ERROR) {
+			cleanup_uring(&ring);
+			return ERROR;
+		}
+	}
+
+	cleanup_uring(&ring);
+	return SUCCESS;
+}
+
+#endif				// USE_IO_URING
+
+
+/*
+ * Compare the contents of file filename with buffer p_buf
+ *
+ * return value:
+ * 	ERROR 	if the contents differ or the file can't be read
+ * 	SUCCESS	if the contents are equal
+ */
+static STATUS compare_file_contents(const char *filename, const u8_t * p_buf,
+				    u32_t len)
+{
+	u8_t *p_chunk = NULL;
+	u32_t compared = 0;
+	size_t chunk;
+	FILE *f_in = NULL;
+	STATUS status = SUCCESS;
+
+	f_in = fopen(filename, "rb");
+	if (f_in == NULL)
+		return ERROR;
+
+	p_chunk = (u8_t *) malloc(COMPARE_CHUNK_SIZE);
+	if (p_chunk == NULL) {
+		fclose(f_in);
+		return ERROR;
+	}
+
+	while ((compared < len) && (status == SUCCESS)) {
+		chunk = len - compared;
+		if (chunk > COMPARE_CHUNK_SIZE)
+			chunk = COMPARE_CHUNK_SIZE;
+
+		if ((fread(p_chunk, sizeof(u8_t), chunk, f_in) != chunk) ||
+		    (memcmp(p_chunk, p_buf + compared, chunk) != 0))
+			status = ERROR;
+
+		compared += chunk;
+	}
+
+	free(p_chunk);
+	fclose(f_in);
+	return status;
+}
+
+
+/*
+ * Check whether the file described by p_stat was modified after the one
+ * described by p_sidecar_stat, to the nanosecond where the platform keeps
+ * it
+ */
+static int is_modified_after(const struct stat *p_stat,
+			     const struct stat *p_sidecar_stat)
+{
+	if (p_stat->st_mtime != p_sidecar_stat->st_mtime)
+		return p_stat->st_mtime > p_sidecar_stat->st_mtime;
+
+#ifdef __linux__
+	return p_stat->st_mtim.tv_nsec > p_sidecar_stat->st_mtim.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+
+/*
+ * Calculate the digest of the job's component data, once
+ */
+static void hash_job_data(OUTPUT_JOB_T * p_job)
+{
+	if (p_job->sha256[0] == '\0')
+		sha256_buffer_to_hex(p_job->p_buf, p_job->len, p_job->sha256);
+}
+
+
+/*
+ * Decide whether the output file of the job must be rewritten. The existing
+ * file is compared by length first, then by the digest stored in its
+ * sidecar (only trusted if the file wasn't modified after the sidecar was
+ * written), and finally byte by byte.
+ */
+static JOB_ACTION get_job_action(OUTPUT_JOB_T * p_job)
+{
+	char sidecar[MAX_OUTPUT_PATH + sizeof(SIDECAR_SUFFIX)];
+	char stored[SHA256_HEX_LENGTH + 1];
+	struct stat f_stat, sidecar_stat;
+	FILE *f_in = NULL;
+	int stored_valid = 0;
+
+	if ((stat(p_job->path, &f_stat) != 0) ||
+	    (f_stat.st_size != p_job->len))
+		return JOB_WRITE;
+
+	snprintf(sidecar, sizeof(sidecar), "%s%s", p_job->path,
+		 SIDECAR_SUFFIX);
+	if ((stat(sidecar, &sidecar_stat) == 0) &&
+	    (!is_modified_after(&f_stat, &sidecar_stat))) {
+		f_in = fopen(sidecar, "r");
+		if (f_in != NULL) {
+			stored_valid = (fscanf(f_in, "%64s", stored) == 1) &&
+			    (strlen(stored) == SHA256_HEX_LENGTH);
+			fclose(f_in);
+		}
+	}
+
+	if (stored_valid) {
+		hash_job_data(p_job);
+		return strcmp(stored, p_job->sha256) ? JOB_WRITE : JOB_SKIP;
+	}
+
+	if (compare_file_contents(p_job->path, p_job->p_buf, p_job->len) ==
+	    SUCCESS)
+		return JOB_SIDECAR;
+
+	return JOB_WRITE;
+}
+
+
+/*
+ * Write the digest sidecar of the job's output file
+ */
+static STATUS write_job_sidecar(OUTPUT_JOB_T * p_job)
+{
+	char sidecar[MAX_OUTPUT_PATH + sizeof(SIDECAR_SUFFIX)];
+	char line[SHA256_HEX_LENGTH + MAX_OUTPUT_PATH + 4];
+	const char *p_name = NULL;
+	int len;
+
+	p_name = strrchr(p_job->path, '/');
+	p_name = (p_name == NULL) ? p_job->path : p_name + 1;
+
+	hash_job_data(p_job);
+
+	snprintf(sidecar, sizeof(sidecar), "%s%s", p_job->path,
+		 SIDECAR_SUFFIX);
+	len = snprintf(line, sizeof(line), "%s  %s\n", p_job->sha256, p_name);
+
+	return write_data_to_named_file(sidecar, line, len);
+}
+
+
+/*
+ * Write all present components of count 1B files into individual files.
+ * The components of p_data[i] are written to directory dir_names[i]
+ * (or to the current directory if dir_names is NULL), the files are named
+ * after the components.
+ *
+ * The files are written through io_uring when available, the files which
+ * can't be written that way are written with the synchronous stdio path.
+ * In OUTPUT_CHANGED mode the files which are up to date are not written.
+ *
+ * input:
+ * 	p_data		array of pointers to initialized _1B_DATA_T
+ * 	dir_names	array of output directory names, may be NULL
+ * 	count		number of 1B files
+ * 	mode		OUTPUT_ALL or OUTPUT_CHANGED
+ *
+ * return value:
+ * 	ERROR 	if any of the component files can't be written
+ * 	SUCCESS	on success
+ */
+STATUS write_all_components_batch(_1B_DATA_T * p_data[],
+				  const char *dir_names[], u32_t count,
+				  OUTPUT_MODE mode)
+{
+	OUTPUT_JOB_T *p_jobs = NULL;
+	OUTPUT_JOB_T tmp_job;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u32_t i, job_count = 0, write_count = 0;
+	u16_t j;
+	STATUS status = SUCCESS;
+
+	if (p_data == NULL) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return ERROR;
+	}
+
+	for (i = 0; i < count; i++)
+		job_count += p_data[i]->header.component_info_count;
+
+	p_jobs = (OUTPUT_JOB_T *) malloc(job_count * sizeof(OUTPUT_JOB_T) + 1);
+	if (p_jobs == NULL) {
+		printf("ERROR: function %s() unable to allocate output "
+		       "jobs\n", __func__);
+		return ERROR;
+	}
+
+	// Create one job per present component
+	//
+	job_count = 0;
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < p_data[i]->header.component_info_count; j++) {
+			p_comp = &(p_data[i]->component[j]);
+
+			if ((p_comp->data_presence != DATA_PRESENT) ||
+			    (p_comp->p_buf == NULL) || (p_comp->length == 0))
+				continue;
+
+			if ((dir_names != NULL) && (dir_names[i] != NULL))
+				snprintf(p_jobs[job_count].path,
+					 MAX_OUTPUT_PATH, "%s/%s",
+					 dir_names[i], p_comp->name);
+			else
+				snprintf(p_jobs[job_count].path,
+					 MAX_OUTPUT_PATH, "%s", p_comp->name);
+
+			p_jobs[job_count].p_buf = p_comp->p_buf;
+			p_jobs[job_count].len = p_comp->length;
+			p_jobs[job_count].status = ERROR;
+			p_jobs[job_count].action = JOB_WRITE;
+			p_jobs[job_count].sha256[0] = '\0';
+			job_count++;
+		}
+	}
+
+	// Move the jobs which must be written to the front
+	//
+	for (i = 0; i < job_count; i++) {
+		if (mode == OUTPUT_CHANGED)
+			p_jobs[i].action = get_job_action(&p_jobs[i]);
+
+		if (p_jobs[i].action == JOB_WRITE) {
+			if (i != write_count) {
+				tmp_job = p_jobs[write_count];
+				p_jobs[write_count] = p_jobs[i];
+				p_jobs[i] = tmp_job;
+			}
+			write_count++;
+		}
+	}
+
+#ifdef USE_IO_URING
+	if ((write_count > 0) &&
+	    (write_jobs_uring(p_jobs, write_count) == SUCCESS))
+		printf("%s: Wrote component files with io_uring\n", __func__);
+#endif
+
+	// Write the remaining files synchronously
+	//
+	for (i = 0; i < job_count; i++) {
+		if (p_jobs[i].action != JOB_WRITE) {
+			printf("%s: Component file %s is up to date\n",
+			       __func__, p_jobs[i].path);
+			p_jobs[i].status = SUCCESS;
+		} else if (p_jobs[i].status == SUCCESS) {
+			printf("%s: Wrote component data to %s\n", __func__,
+			       p_jobs[i].path);
+		} else {
+			printf("%s: Writing component data to %s ..\n",
+			       __func__, p_jobs[i].path);
+			p_jobs[i].status =
+			    write_data_to_named_file(p_jobs[i].path,
+						     p_jobs[i].p_buf,
+						     p_jobs[i].len);
+		}
+
+		if (p_jobs[i].status == ERROR) {
+			status = ERROR;
+			continue;
+		}
+
+		if ((mode == OUTPUT_CHANGED) && (p_jobs[i].action != JOB_SKIP) &&
+		    (write_job_sidecar(&p_jobs[i]) == ERROR))
+			status = ERROR;
+	}
+
+	free(p_jobs);
+	return status;
+}
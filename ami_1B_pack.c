@@ -0,0 +1,771 @@
+/*
+ * ami_1B_pack.c
+ *
+ * Pack file holding many 1B files for random access. The headers and the
+ * component data are stored once per distinct contents (deduplicated by
+ * SHA-256 digest), followed by an index of the 1B files and a trailer:
+ *
+ * 	PACK_FILE_HEADER_T
+ * 	header and component data blobs
+ * 	index: one record per 1B file, each record is
+ * 		PACK_IMAGE_RECORD_T
+ * 		1B filename (NUL terminated, padded to PACK_ALIGNMENT)
+ * 		u64_t file offset of each component data (0 if absent)
+ * 	PACK_TRAILER_T
+ *
+ * A pack is read through a read-only mapping. The components of a 1B file
+ * loaded from the pack point into the mapping, nothing is copied except
+ * the header.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "ami_1B_internal.h"
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+#define PACK_MAGIC		"AMI1BPAK"	// pack file header signature
+
+#define PACK_INDEX_MAGIC	"AMI1BIDX"	// pack file trailer signature
+
+#define PACK_VERSION		1	// pack format version
+
+#define PACK_ALIGNMENT		8	// alignment of the index and its records
+
+#define PACK_INITIAL_BLOBS	1024	// initial size of the digest table
+
+#define PACK_ALIGN(x)	(((x) + PACK_ALIGNMENT - 1) & ~((u64_t) PACK_ALIGNMENT - 1))
+
+// Pack file header, at offset 0
+//
+typedef struct {
+	char magic[8];
+	u32_t version;
+	u32_t reserved;
+} PACK_FILE_HEADER_T;
+
+// Index record of one 1B file
+//
+typedef struct {
+	u64_t header_offset;	// file offset of the 1B header
+	u16_t header_length;	// length of the 1B header
+	u16_t component_info_count;	// number of components info in the header
+	u16_t name_length;	// length of the 1B filename including NUL
+	u16_t reserved;
+} PACK_IMAGE_RECORD_T;
+
+// Pack file trailer, at the end of the file
+//
+typedef struct {
+	u64_t index_offset;	// file offset of the index
+	u64_t index_length;	// length of the index in bytes
+	u32_t image_count;	// number of 1B files in the pack
+	u32_t reserved;
+	char magic[8];
+} PACK_TRAILER_T;
+
+// Data blob already stored in the pack being written
+//
+typedef struct {
+	u8_t digest[SHA256_DIGEST_LENGTH];
+	u64_t offset;
+	u32_t length;
+	u32_t used;
+} PACK_BLOB_T;
+
+struct _1B_PACK_S {
+
+	char filename[MAX_PATH];	// pack filename
+
+	// Pack being written (init_1B_pack())
+	//
+	FILE *f_out;		// the pack output file
+
+	u64_t data_offset;	// current end of the data blobs
+
+	PACK_BLOB_T *p_blob;	// open addressing table of the stored blobs
+
+	u32_t blob_table_size;	// number of slots in p_blob (power of 2)
+
+	u32_t blob_count;	// number of stored blobs
+
+	u64_t dedup_length;	// bytes not stored because of deduplication
+
+	u8_t *p_index;		// index being built
+
+	u64_t index_length;	// length of the index
+
+	u64_t index_size;	// size of the p_index buffer
+
+	// Pack being read (open_1B_pack())
+	//
+	u8_t *p_map;		// the mapped pack file
+
+	u64_t map_length;	// length of the mapping
+
+	u64_t index_offset;	// offset of the index (end of the data blobs)
+
+	// Both
+	//
+	u32_t image_count;	// number of 1B files in the pack
+
+	PACK_IMAGE_RECORD_T **pp_record;	// index records (reading only)
+
+};
+
+
+/*
+ * Return pointer to the component offsets which follow the index record
+ */
+static u64_t *get_record_offsets(PACK_IMAGE_RECORD_T * p_record)
+{
+	return (u64_t *) ((u8_t *) p_record + sizeof(PACK_IMAGE_RECORD_T) +
+			  PACK_ALIGN(p_record->name_length));
+}
+
+
+/*
+ * Grow the table of stored blobs to twice its size
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS grow_blob_table(_1B_PACK_T * p_pack)
+{
+	PACK_BLOB_T *p_old = p_pack->p_blob;
+	u32_t old_size = p_pack->blob_table_size;
+	u32_t i, slot, size;
+
+	size = (old_size == 0) ? PACK_INITIAL_BLOBS : old_size * 2;
+	p_pack->p_blob = (PACK_BLOB_T *) calloc(size, sizeof(PACK_BLOB_T));
+	if (p_pack->p_blob == NULL) {
+		printf("ERROR: function %s() unable to allocate blob table\n",
+		       __func__);
+		p_pack->p_blob = p_old;
+		return ERROR;
+	}
+	p_pack->blob_table_size = size;
+
+	for (i = 0; i < old_size; i++) {
+		if (!p_old[i].used)
+			continue;
+
+		slot = *((u32_t *) p_old[i].digest) & (size - 1);
+		while (p_pack->p_blob[slot].used)
+			slot = (slot + 1) & (size - 1);
+		p_pack->p_blob[slot] = p_old[i];
+	}
+
+	if (p_old != NULL)
+		free(p_old);
+	return SUCCESS;
+}
+
+
+/*
+ * Store data blob p_buf in the pack, unless a blob with the same contents
+ * was stored before.
+ *
+ * output:
+ * 	p_offset	file offset of the blob in the pack
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS store_blob(_1B_PACK_T * p_pack, void *p_buf, u32_t len,
+			 u64_t * p_offset)
+{
+	SHA256_CTX_T ctx;
+	u8_t digest[SHA256_DIGEST_LENGTH];
+	PACK_BLOB_T *p_slot = NULL;
+	u32_t slot;
+
+	if ((p_pack->blob_count + 1) * 2 > p_pack->blob_table_size) {
+		if (grow_blob_table(p_pack) == ERROR)
+			return ERROR;
+	}
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, p_buf, len);
+	sha256_final(&ctx, digest);
+
+	slot = *((u32_t *) digest) & (p_pack->blob_table_size - 1);
+	for (;;) {
+		p_slot = &(p_pack->p_blob[slot]);
+		if (!p_slot->used)
+			break;
+
+		if ((p_slot->length == len) &&
+		    (!memcmp(p_slot->digest, digest, SHA256_DIGEST_LENGTH))) {
+			*p_offset = p_slot->offset;
+			p_pack->dedup_length += len;
+			return SUCCESS;
+		}
+		slot = (slot + 1) & (p_pack->blob_table_size - 1);
+	}
+
+	if (write_buffer_to_file(p_pack->f_out, p_buf, len) == ERROR) {
+		printf("ERROR: function %s() unable to write to pack %s\n",
+		       __func__, p_pack->filename);
+		return ERROR;
+	}
+
+	memcpy(p_slot->digest, digest, SHA256_DIGEST_LENGTH);
+	p_slot->offset = p_pack->data_offset;
+	p_slot->length = len;
+	p_slot->used = 1;
+	p_pack->blob_count++;
+
+	*p_offset = p_pack->data_offset;
+	p_pack->data_offset += len;
+	return SUCCESS;
+}
+
+
+/*
+ * Create a pack file for writing.
+ *
+ * NOTE: You must call close_1B_pack() to write the index of the pack.
+ *
+ * input:
+ * 	filename	name of the pack file
+ *
+ * return value:
+ * 	NULL 			on error
+ * 	pointer to _1B_PACK_T 	on success
+ */
+_1B_PACK_T *init_1B_pack(const char *filename)
+{
+	_1B_PACK_T *p_pack = NULL;
+	PACK_FILE_HEADER_T hdr;
+
+	if ((filename == NULL) || (strlen(filename) >= MAX_PATH)) {
+		printf("ERROR: function %s() invalid filename\n", __func__);
+		return NULL;
+	}
+
+	p_pack = (_1B_PACK_T *) malloc(sizeof(_1B_PACK_T));
+	if (p_pack == NULL) {
+		printf("ERROR: unable to allocate memory for pack\n");
+		return NULL;
+	}
+	memset(p_pack, 0, sizeof(_1B_PACK_T));
+	strcpy(p_pack->filename, filename);
+
+	p_pack->f_out = fopen(filename, "wb");
+	if (p_pack->f_out == NULL) {
+		printf("ERROR: function %s() unable to open %s for "
+		       "writing\n", __func__, filename);
+		free(p_pack);
+		return NULL;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PACK_MAGIC, sizeof(hdr.magic));
+	hdr.version = PACK_VERSION;
+	if (write_buffer_to_file(p_pack->f_out, &hdr, sizeof(hdr)) == ERROR) {
+		printf("ERROR: function %s() unable to write to pack %s\n",
+		       __func__, filename);
+		fclose(p_pack->f_out);
+		free(p_pack);
+		return NULL;
+	}
+	p_pack->data_offset = sizeof(hdr);
+
+	return p_pack;
+}
+
+
+/*
+ * Add the header and the components of the 1B file to the pack. The
+ * components data must be loaded (see init_1B_data()). The 1B file is
+ * recorded in the index under its base name.
+ *
+ * input:
+ * 	p_pack	pointer to the pack created by init_1B_pack()
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS write_1B_data_to_pack(_1B_PACK_T * p_pack, _1B_DATA_T * p_data)
+{
+	PACK_IMAGE_RECORD_T *p_record = NULL;
+	const char *p_base = NULL;
+	u64_t *p_offset = NULL;
+	u64_t record_length, size;
+	u8_t *p_index = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u16_t i;
+
+	if ((p_pack == NULL) || (p_pack->f_out == NULL) || (p_data == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	p_base = strrchr(p_data->filename, '/');
+	p_base = (p_base == NULL) ? p_data->filename : p_base + 1;
+
+	record_length = sizeof(PACK_IMAGE_RECORD_T) +
+	    PACK_ALIGN(strlen(p_base) + 1) +
+	    p_data->header.component_info_count * sizeof(u64_t);
+
+	if (p_pack->index_length + record_length > p_pack->index_size) {
+		size = (p_pack->index_size == 0) ? 0x10000 :
+		    p_pack->index_size * 2;
+		while (p_pack->index_length + record_length > size)
+			size *= 2;
+
+		p_index = (u8_t *) realloc(p_pack->p_index, size);
+		if (p_index == NULL) {
+			printf("ERROR: function %s() unable to allocate pack "
+			       "index\n", __func__);
+			return ERROR;
+		}
+		p_pack->p_index = p_index;
+		p_pack->index_size = size;
+	}
+
+	p_record = (PACK_IMAGE_RECORD_T *) (p_pack->p_index +
+					    p_pack->index_length);
+	memset(p_record, 0, record_length);
+	p_record->header_length = p_data->header.length;
+	p_record->component_info_count = p_data->header.component_info_count;
+	p_record->name_length = strlen(p_base) + 1;
+	memcpy((u8_t *) p_record + sizeof(PACK_IMAGE_RECORD_T), p_base,
+	       p_record->name_length);
+
+	if (store_blob(p_pack, p_data->header.p_buf, p_data->header.length,
+		       &p_record->header_offset) == ERROR)
+		return ERROR;
+
+	p_offset = get_record_offsets(p_record);
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		if (p_comp->p_buf == NULL) {
+			printf("ERROR: function %s() component %s data not "
+			       "loaded\n", __func__, p_comp->name);
+			return ERROR;
+		}
+
+		if (store_blob(p_pack, p_comp->p_buf, p_comp->length,
+			       &p_offset[i]) == ERROR)
+			return ERROR;
+	}
+
+	p_pack->index_length += record_length;
+	p_pack->image_count++;
+	return SUCCESS;
+}
+
+
+/*
+ * Write the index and the trailer of a pack being written
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS write_pack_index(_1B_PACK_T * p_pack)
+{
+	u8_t pad[PACK_ALIGNMENT];
+	PACK_TRAILER_T trailer;
+	u64_t pad_length;
+
+	pad_length = PACK_ALIGN(p_pack->data_offset) - p_pack->data_offset;
+	memset(pad, 0, sizeof(pad));
+	if ((pad_length > 0) &&
+	    (write_buffer_to_file(p_pack->f_out, pad, pad_length) == ERROR))
+		return ERROR;
+
+	if ((p_pack->index_length > 0) &&
+	    (write_buffer_to_file(p_pack->f_out, p_pack->p_index,
+				  p_pack->index_length) == ERROR))
+		return ERROR;
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.index_offset = p_pack->data_offset + pad_length;
+	trailer.index_length = p_pack->index_length;
+	trailer.image_count = p_pack->image_count;
+	memcpy(trailer.magic, PACK_INDEX_MAGIC, sizeof(trailer.magic));
+
+	return write_buffer_to_file(p_pack->f_out, &trailer, sizeof(trailer));
+}
+
+
+/*
+ * Open a pack file for reading. The pack is mapped read-only.
+ *
+ * NOTE: You must call close_1B_pack() when you're finished using the pack,
+ * 	 after cleaning up all _1B_DATA_T loaded from it.
+ *
+ * input:
+ * 	filename	name of the pack file
+ *
+ * return value:
+ * 	NULL 			on error
+ * 	pointer to _1B_PACK_T 	on success
+ */
+_1B_PACK_T *open_1B_pack(const char *filename)
+{
+	_1B_PACK_T *p_pack = NULL;
+	PACK_FILE_HEADER_T *p_hdr = NULL;
+	PACK_TRAILER_T *p_trailer = NULL;
+	PACK_IMAGE_RECORD_T *p_record = NULL;
+	struct stat f_stat;
+	u64_t offset, end;
+	u32_t i;
+	int fd;
+
+	if ((filename == NULL) || (strlen(filename) >= MAX_PATH)) {
+		printf("ERROR: function %s() invalid filename\n", __func__);
+		return NULL;
+	}
+
+	fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0) {
+		printf("ERROR: function %s() unable to open pack %s\n",
+		       __func__, filename);
+		return NULL;
+	}
+
+	if ((fstat(fd, &f_stat) != 0) ||
+	    (f_stat.st_size < (off_t) (sizeof(PACK_FILE_HEADER_T) +
+				       sizeof(PACK_TRAILER_T)))) {
+		printf("ERROR: function %s() invalid pack %s\n", __func__,
+		       filename);
+		close(fd);
+		return NULL;
+	}
+
+	p_pack = (_1B_PACK_T *) malloc(sizeof(_1B_PACK_T));
+	if (p_pack == NULL) {
+		printf("ERROR: unable to allocate memory for pack\n");
+		close(fd);
+		return NULL;
+	}
+	memset(p_pack, 0, sizeof(_1B_PACK_T));
+	strcpy(p_pack->filename, filename);
+	p_pack->map_length = f_stat.st_size;
+
+#ifdef _WIN32
+	p_pack->p_map = (u8_t *) malloc(p_pack->map_length);
+	if ((p_pack->p_map != NULL) &&
+	    (read(fd, p_pack->p_map, p_pack->map_length) !=
+	     (ssize_t) p_pack->map_length)) {
+		free(p_pack->p_map);
+		p_pack->p_map = NULL;
+	}
+#else
+	p_pack->p_map = (u8_t *) mmap(NULL, p_pack->map_length, PROT_READ,
+				      MAP_PRIVATE, fd, 0);
+	if (p_pack->p_map == MAP_FAILED)
+		p_pack->p_map = NULL;
+#endif
+	close(fd);
+
+	if (p_pack->p_map == NULL) {
+		printf("ERROR: function %s() unable to map pack %s\n",
+		       __func__, filename);
+		free(p_pack);
+		return NULL;
+	}
+
+	p_hdr = (PACK_FILE_HEADER_T *) p_pack->p_map;
+	p_trailer = (PACK_TRAILER_T *) (p_pack->p_map + p_pack->map_length -
+					sizeof(PACK_TRAILER_T));
+	end = p_pack->map_length - sizeof(PACK_TRAILER_T);
+
+	if (memcmp(p_hdr->magic, PACK_MAGIC, sizeof(p_hdr->magic)) ||
+	    (p_hdr->version != PACK_VERSION) ||
+	    memcmp(p_trailer->magic, PACK_INDEX_MAGIC,
+		   sizeof(p_trailer->magic)) ||
+	    (p_trailer->index_offset % PACK_ALIGNMENT) ||
+	    (p_trailer->index_offset > end) ||
+	    (p_trailer->index_length != end - p_trailer->index_offset)) {
+		printf("ERROR: function %s() %s is not a valid 1B pack\n",
+		       __func__, filename);
+		close_1B_pack(p_pack);
+		return NULL;
+	}
+	p_pack->index_offset = p_trailer->index_offset;
+
+	// Locate the index records once, for random access by position
+	//
+	p_pack->pp_record = (PACK_IMAGE_RECORD_T **)
+	    malloc((p_trailer->image_count + 1) *
+		   sizeof(PACK_IMAGE_RECORD_T *));
+	if (p_pack->pp_record == NULL) {
+		printf("ERROR: unable to allocate memory for pack index\n");
+		close_1B_pack(p_pack);
+		return NULL;
+	}
+
+	offset = p_trailer->index_offset;
+	for (i = 0; i < p_trailer->image_count; i++) {
+		p_record = (PACK_IMAGE_RECORD_T *) (p_pack->p_map + offset);
+		if ((offset + sizeof(PACK_IMAGE_RECORD_T) > end) ||
+		    (p_record->name_length == 0) ||
+		    (p_record->component_info_count > MAX_COMPONENT))
+			break;
+
+		offset += sizeof(PACK_IMAGE_RECORD_T) +
+		    PACK_ALIGN(p_record->name_length) +
+		    p_record->component_info_count * sizeof(u64_t);
+		if ((offset > end) ||
+		    (((char *) p_record)[sizeof(PACK_IMAGE_RECORD_T) +
+					 p_record->name_length - 1] != '\0'))
+			break;
+
+		p_pack->pp_record[i] = p_record;
+	}
+
+	if ((i != p_trailer->image_count) || (offset != end)) {
+		printf("ERROR: function %s() pack %s index is corrupted\n",
+		       __func__, filename);
+		close_1B_pack(p_pack);
+		return NULL;
+	}
+	p_pack->image_count = p_trailer->image_count;
+
+	return p_pack;
+}
+
+
+u32_t get_pack_image_count(_1B_PACK_T * p_pack)
+{
+	return (p_pack == NULL) ? 0 : p_pack->image_count;
+}
+
+
+/*
+ * Return the name of the 1B file at position index in the pack, NULL if
+ * index is out of range
+ */
+const char *get_pack_image_name(_1B_PACK_T * p_pack, u32_t index)
+{
+	if ((p_pack == NULL) || (p_pack->pp_record == NULL) ||
+	    (index >= p_pack->image_count))
+		return NULL;
+
+	return (const char *) p_pack->pp_record[index] +
+	    sizeof(PACK_IMAGE_RECORD_T);
+}
+
+
+/*
+ * Return the position of the 1B file named name in the pack
+ *
+ * return value:
+ * 	-1	 	if not found
+ * 	position	on success
+ */
+s32_t find_pack_image(_1B_PACK_T * p_pack, const char *name)
+{
+	u32_t i;
+
+	if ((p_pack == NULL) || (name == NULL))
+		return -1;
+
+	for (i = 0; i < p_pack->image_count; i++) {
+		if (!strcmp(get_pack_image_name(p_pack, i), name))
+			return i;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Initialize data structures describing the 1B file at position index in
+ * the pack, like init_1B_data(). The components data is not copied, the
+ * components point into the (read-only) mapping of the pack. Replacing
+ * or patching a component gives it a private buffer. The filename of the
+ * returned _1B_DATA_T is "<pack_filename>:<1B_filename>".
+ *
+ * NOTE: You must call cleanup cleanup_1B_data() when you're finished using
+ * 	 the returned data structure, before calling close_1B_pack().
+ *
+ * input:
+ * 	p_pack	pointer to the pack opened by open_1B_pack()
+ * 	index	position of the 1B file in the pack
+ *
+ * returns:
+ * 	NULL	on error
+ * 	Pointer to initialized _1B_DATA_T on success
+ */
+_1B_DATA_T *init_1B_data_from_pack(_1B_PACK_T * p_pack, u32_t index)
+{
+	_1B_DATA_T *p_data = NULL;
+	PACK_IMAGE_RECORD_T *p_record = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u64_t *p_offset = NULL;
+	u8_t *p_header = NULL;
+	u16_t i;
+
+	if ((p_pack == NULL) || (p_pack->p_map == NULL) ||
+	    (index >= p_pack->image_count)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return NULL;
+	}
+
+	p_record = p_pack->pp_record[index];
+	if ((p_record->header_length < HEADER_CONTENTS_OFFSET) ||
+	    (p_record->header_offset + p_record->header_length >
+	     p_pack->index_offset)) {
+		printf("ERROR: function %s() invalid header of %s in pack\n",
+		       __func__, get_pack_image_name(p_pack, index));
+		return NULL;
+	}
+
+	p_header = p_pack->p_map + p_record->header_offset;
+	if ((*((u16_t *) (p_header + HEADER_LENGTH_OFFSET)) !=
+	     p_record->header_length) ||
+	    (*((u16_t *) (p_header + COMPONENT_COUNT_OFFSET)) !=
+	     p_record->component_info_count)) {
+		printf("ERROR: function %s() header of %s doesn't match the "
+		       "pack index\n", __func__,
+		       get_pack_image_name(p_pack, index));
+		return NULL;
+	}
+
+	p_data = (_1B_DATA_T *) malloc(sizeof(_1B_DATA_T));
+	if (p_data == NULL) {
+		printf("ERROR: unable to allocate memory for 1B "
+		       "file data\n");
+		return NULL;
+	}
+	p_data->header.component_info_count = 0;
+	p_data->written_filename[0] = '\0';
+
+	// The header is updated in place when a component is replaced,
+	// give it a private copy
+	//
+	p_data->header.p_buf = malloc(p_record->header_length);
+	if (p_data->header.p_buf == NULL) {
+		printf("ERROR: Unable to allocate header buffer\n");
+		cleanup_1B_data(p_data);
+		return NULL;
+	}
+	memcpy(p_data->header.p_buf, p_header, p_record->header_length);
+
+	if (parse_header(p_data, p_record->header_length,
+			 p_record->component_info_count) == ERROR) {
+		printf("ERROR: Unable to parse header correctly\n");
+		cleanup_1B_data(p_data);
+		return NULL;
+	}
+
+	p_offset = get_record_offsets(p_record);
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		if ((p_offset[i] == 0) ||
+		    (p_offset[i] + p_comp->length > p_pack->index_offset)) {
+			printf("ERROR: function %s() invalid component %s of "
+			       "%s in pack\n", __func__, p_comp->name,
+			       get_pack_image_name(p_pack, index));
+			cleanup_1B_data(p_data);
+			return NULL;
+		}
+
+		p_comp->p_buf = p_pack->p_map + p_offset[i];
+		p_comp->buf_type = BUFFER_MAPPED;
+	}
+
+	// "<pack filename>:<1B name>"
+	//
+	if (snprintf(p_data->filename, sizeof(p_data->filename), "%s:%s",
+		     p_pack->filename, get_pack_image_name(p_pack, index)) >=
+	    (int) sizeof(p_data->filename)) {
+		printf("ERROR: function %s() name of %s in pack %s is too "
+		       "long\n", __func__, get_pack_image_name(p_pack, index),
+		       p_pack->filename);
+		cleanup_1B_data(p_data);
+		return NULL;
+	}
+	p_data->size = p_data->calculated_size;
+
+	return p_data;
+}
+
+
+/*
+ * Close the pack. A pack being written gets its index written first.
+ *
+ * input:
+ * 	p_pack	pointer to the pack
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS close_1B_pack(_1B_PACK_T * p_pack)
+{
+	STATUS status = SUCCESS;
+
+	if (p_pack == NULL)
+		return ERROR;
+
+	if (p_pack->f_out != NULL) {
+		status = write_pack_index(p_pack);
+		if (fclose(p_pack->f_out) != 0)
+			status = ERROR;
+
+		if (status == ERROR)
+			printf("ERROR: function %s() unable to finish pack "
+			       "%s\n", __func__, p_pack->filename);
+		else
+			printf("%s: Packed 0x%X 1B files into %s, 0x%X data "
+			       "blobs, 0x%llX bytes deduplicated\n", __func__,
+			       p_pack->image_count, p_pack->filename,
+			       p_pack->blob_count, p_pack->dedup_length);
+	}
+
+	if (p_pack->p_map != NULL) {
+#ifdef _WIN32
+		free(p_pack->p_map);
+#else
+		munmap(p_pack->p_map, p_pack->map_length);
+#endif
+	}
+
+	if (p_pack->p_blob != NULL)
+		free(p_pack->p_blob);
+	if (p_pack->p_index != NULL)
+		free(p_pack->p_index);
+	if (p_pack->pp_record != NULL)
+		free(p_pack->pp_record);
+
+	free(p_pack);
+	return status;
+}
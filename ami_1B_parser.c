@@ -0,0 +1,370 @@
+/*
+ * ami_1B_parser.c
+ *
+ * Push parser of the 1B file. The 1B file is fed in chunks of any size
+ * (e.g. as they arrive from the network) and the parser moves through the
+ * header info, the header and the data of each present component. The
+ * caller is notified as soon as the header is parsed and as soon as the
+ * data of each component is complete, so it can process the components
+ * while the rest of the 1B file is still arriving. The result is the same
+ * _1B_DATA_T init_1B_data() returns for the 1B file.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+// Parser state, i.e. what the next byte of the 1B file belongs to
+//
+typedef enum {
+	PARSE_HEADER_INFO = 0,	// component count and header length
+	PARSE_HEADER = 1,	// rest of the header
+	PARSE_COMPONENT = 2,	// data of the current component
+	PARSE_DONE = 3,		// all present components are complete
+	PARSE_FAILED = 4,	// error, no more input accepted
+} PARSER_STATE;
+
+struct _1B_PARSER_S {
+
+	PARSER_STATE state;
+
+	_1B_DATA_T *p_data;	// the 1B data being built
+
+	u8_t header_info[HEADER_INFO_LENGTH];	// header info being received
+
+	u16_t header_length;	// from the header info
+
+	u16_t component_info_count;	// from the header info
+
+	u16_t component;	// position of the current component
+
+	u32_t filled;		// bytes of the current item received so far
+
+	u64_t received;		// bytes of the 1B file received so far
+
+	PARSER_CALLBACK callback;	// event callback (may be NULL)
+
+	void *p_context;	// passed to the callback
+
+};
+
+
+/*
+ * Move to the next present component with data after position start, or
+ * to PARSE_DONE after the last one
+ */
+static STATUS next_component(_1B_PARSER_T * p_parser, u32_t start)
+{
+	_1B_DATA_T *p_data = p_parser->p_data;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u32_t i;
+
+	for (i = start; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		p_comp->p_buf = malloc(p_comp->length);
+		if (p_comp->p_buf == NULL) {
+			printf("ERROR: Unable to allocate buffer "
+			       "for component[%02Xh]\n", i);
+			return ERROR;
+		}
+		p_comp->buf_type = BUFFER_ALLOCATED;
+
+		p_parser->component = i;
+		p_parser->filled = 0;
+		p_parser->state = PARSE_COMPONENT;
+		return SUCCESS;
+	}
+
+	p_parser->state = PARSE_DONE;
+	if ((p_parser->callback != NULL) &&
+	    (p_parser->callback(PARSER_DONE, p_data, NULL,
+				p_parser->p_context) == ERROR))
+		return ERROR;
+
+	return SUCCESS;
+}
+
+
+/*
+ * Parse the complete header info, allocate the header buffer
+ */
+static STATUS end_header_info(_1B_PARSER_T * p_parser)
+{
+	_1B_DATA_T *p_data = p_parser->p_data;
+
+	if (parse_header_info(p_parser->header_info,
+			      &p_parser->header_length,
+			      &p_parser->component_info_count) == ERROR)
+		return ERROR;
+
+	// The header must hold the info of all components
+	//
+	if (p_parser->header_length < HEADER_CONTENTS_OFFSET +
+	    (u32_t) p_parser->component_info_count * COMPONENT_INFO_LENGTH) {
+		printf("ERROR: function %s() header length 0x%X is too small "
+		       "for 0x%X components\n", __func__,
+		       p_parser->header_length,
+		       p_parser->component_info_count);
+		return ERROR;
+	}
+
+	p_data->header.p_buf = malloc(p_parser->header_length);
+	if (p_data->header.p_buf == NULL) {
+		printf("ERROR: Unable to allocate header buffer\n");
+		return ERROR;
+	}
+	memcpy(p_data->header.p_buf, p_parser->header_info,
+	       HEADER_INFO_LENGTH);
+
+	p_parser->state = PARSE_HEADER;
+	return SUCCESS;
+}
+
+
+/*
+ * Parse the complete header and report it
+ */
+static STATUS end_header(_1B_PARSER_T * p_parser)
+{
+	_1B_DATA_T *p_data = p_parser->p_data;
+
+	if (parse_header(p_data, p_parser->header_length,
+			 p_parser->component_info_count) == ERROR) {
+		printf("ERROR: Unable to parse header correctly\n");
+		return ERROR;
+	}
+	p_data->size = p_data->calculated_size;
+
+	if ((p_parser->callback != NULL) &&
+	    (p_parser->callback(PARSER_HEADER, p_data, NULL,
+				p_parser->p_context) == ERROR))
+		return ERROR;
+
+	return next_component(p_parser, 0);
+}
+
+
+/*
+ * Create a push parser for one 1B file.
+ *
+ * NOTE: You must call cleanup_1B_parser() when you're finished with the
+ * 	 parser.
+ *
+ * input:
+ * 	name		name of the 1B file (stored as its filename)
+ * 	callback	called on each parser event, NULL for none. Returning
+ * 			ERROR from the callback stops the parser.
+ * 	p_context	passed to the callback
+ *
+ * return value:
+ * 	NULL 				on error
+ * 	pointer to _1B_PARSER_T		on success
+ */
+_1B_PARSER_T *init_1B_parser(const char *name, PARSER_CALLBACK callback,
+			     void *p_context)
+{
+	_1B_PARSER_T *p_parser = NULL;
+	_1B_DATA_T *p_data = NULL;
+
+	if ((name == NULL) || (strlen(name) >= MAX_PATH)) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return NULL;
+	}
+
+	p_parser = (_1B_PARSER_T *) malloc(sizeof(_1B_PARSER_T));
+	p_data = (_1B_DATA_T *) malloc(sizeof(_1B_DATA_T));
+	if ((p_parser == NULL) || (p_data == NULL)) {
+		printf("ERROR: unable to allocate memory for 1B parser\n");
+		free(p_parser);
+		free(p_data);
+		return NULL;
+	}
+
+	p_data->header.p_buf = NULL;
+	p_data->header.component_info_count = 0;
+	p_data->written_filename[0] = '\0';
+	p_data->size = 0;
+	p_data->calculated_size = 0;
+	strcpy(p_data->filename, name);
+
+	p_parser->state = PARSE_HEADER_INFO;
+	p_parser->p_data = p_data;
+	p_parser->filled = 0;
+	p_parser->received = 0;
+	p_parser->callback = callback;
+	p_parser->p_context = p_context;
+
+	return p_parser;
+}
+
+
+/*
+ * Feed the next chunk of the 1B file to the parser. The callback is called
+ * for every event the chunk completes, before this function returns. Bytes
+ * after the last present component are accepted and ignored.
+ *
+ * input:
+ * 	p_parser	pointer to the parser created by init_1B_parser()
+ * 	p_buf		pointer to the chunk
+ * 	len		length of the chunk in bytes (may be 0)
+ *
+ * return value:
+ * 	ERROR 	on error (invalid 1B file or the callback failed), the
+ * 		parser doesn't accept more input
+ * 	SUCCESS	on success
+ */
+STATUS feed_1B_parser(_1B_PARSER_T * p_parser, const void *p_buf,
+		      size_t len)
+{
+	const u8_t *p = (const u8_t *) p_buf;
+	_1B_COMPONENT_T *p_comp = NULL;
+	STATUS status = SUCCESS;
+	u32_t want;
+
+	if ((p_parser == NULL) || ((p_buf == NULL) && (len > 0))) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return ERROR;
+	}
+
+	if (p_parser->state == PARSE_FAILED)
+		return ERROR;
+
+	p_parser->received += len;
+
+	while ((len > 0) && (status == SUCCESS)) {
+		switch (p_parser->state) {
+		case PARSE_HEADER_INFO:
+			want = HEADER_INFO_LENGTH - p_parser->filled;
+			if (want > len)
+				want = len;
+
+			memcpy(p_parser->header_info + p_parser->filled, p,
+			       want);
+			p_parser->filled += want;
+
+			if (p_parser->filled == HEADER_INFO_LENGTH)
+				status = end_header_info(p_parser);
+			break;
+
+		case PARSE_HEADER:
+			want = p_parser->header_length - p_parser->filled;
+			if (want > len)
+				want = len;
+
+			memcpy(p_parser->p_data->header.p_buf +
+			       p_parser->filled, p, want);
+			p_parser->filled += want;
+
+			if (p_parser->filled == p_parser->header_length)
+				status = end_header(p_parser);
+			break;
+
+		case PARSE_COMPONENT:
+			p_comp = &(p_parser->p_data->component[p_parser->
+							       component]);
+			want = p_comp->length - p_parser->filled;
+			if (want > len)
+				want = len;
+
+			memcpy(p_comp->p_buf + p_parser->filled, p, want);
+			p_parser->filled += want;
+
+			if (p_parser->filled < p_comp->length)
+				break;
+
+			if ((p_parser->callback != NULL) &&
+			    (p_parser->callback(PARSER_COMPONENT,
+						p_parser->p_data, p_comp,
+						p_parser->p_context) ==
+			     ERROR)) {
+				status = ERROR;
+				break;
+			}
+			status = next_component(p_parser,
+						p_parser->component + 1);
+			break;
+
+		default:
+			// Trailing bytes after the last component
+			//
+			want = len;
+			break;
+		}
+
+		p += want;
+		len -= want;
+	}
+
+	if (status == ERROR)
+		p_parser->state = PARSE_FAILED;
+
+	return status;
+}
+
+
+/*
+ * Finish parsing and take the parsed 1B data from the parser. Fails if the
+ * 1B file was incomplete.
+ *
+ * NOTE: You must call cleanup_1B_data() when you're finished using the
+ * 	 returned 1B data. The parser still has to be cleaned up with
+ * 	 cleanup_1B_parser().
+ *
+ * input:
+ * 	p_parser	pointer to the parser created by init_1B_parser()
+ *
+ * return value:
+ * 	NULL 			on error
+ * 	pointer to _1B_DATA_T	on success
+ */
+_1B_DATA_T *finish_1B_parser(_1B_PARSER_T * p_parser)
+{
+	_1B_DATA_T *p_data = NULL;
+
+	if (p_parser == NULL) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return NULL;
+	}
+
+	if (p_parser->state != PARSE_DONE) {
+		if (p_parser->state != PARSE_FAILED)
+			printf("ERROR: 1B file %s ended after 0x%llX "
+			       "bytes, 0x%llX bytes expected\n",
+			       p_parser->p_data->filename,
+			       p_parser->received,
+			       (p_parser->state == PARSE_HEADER_INFO) ?
+			       (u64_t) HEADER_INFO_LENGTH :
+			       (p_parser->state == PARSE_HEADER) ?
+			       (u64_t) p_parser->header_length :
+			       (u64_t) p_parser->p_data->calculated_size);
+		return NULL;
+	}
+
+	p_data = p_parser->p_data;
+	p_data->size = p_parser->received;
+	p_parser->p_data = NULL;
+
+	return p_data;
+}
+
+
+void cleanup_1B_parser(_1B_PARSER_T * p_parser)
+{
+	if (p_parser == NULL)
+		return;
+
+	cleanup_1B_data(p_parser->p_data);
+	free(p_parser);
+}
@@ -0,0 +1,470 @@
+/*
+ * ami_1B_search.c
+ *
+ * Search the present components of 1B files for many byte patterns in one
+ * pass (Aho-Corasick automaton). Each hit is reported with the component,
+ * the offset in the component, the 1B file offset and the physical address
+ * of the hit after relocation.
+ *
+ * Pattern file format, one pattern per line:
+ *
+ * 	# comment
+ * 	"text"			ASCII string (\" and \\ escapes)
+ * 	0F 01 C8		hexadecimal bytes (whitespace is ignored)
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "ami_1B_internal.h"
+
+#define MAX_PATTERN_LINE	1024	// maximum length of a pattern file line
+
+#define ROOT_STATE		0	// automaton start state
+
+#define NO_PATTERN		(-1)
+
+// Search pattern
+//
+typedef struct {
+	char label[MAX_PATTERN_LINE];	// pattern as written in the pattern file
+	u8_t *p_bytes;
+	u32_t length;
+} SEARCH_PATTERN_T;
+
+struct _1B_SEARCH_S {
+
+	SEARCH_PATTERN_T *p_pattern;	// the patterns
+
+	u32_t pattern_count;
+
+	u32_t state_count;	// number of automaton states
+
+	u32_t *p_next;		// transition table, 256 entries per state
+
+	s32_t *p_match;		// pattern ending at each state, NO_PATTERN if none
+
+	u32_t *p_output;	// next state on the suffix chain with a match,
+				// ROOT_STATE if none
+
+	u8_t first_byte[256];	// non-zero for the first byte of any pattern
+
+	s32_t single_first_byte;	// the only first byte of all patterns,
+					// -1 if the patterns start differently
+
+};
+
+
+/*
+ * Parse one pattern file line into p_pattern
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS parse_pattern(char *line, SEARCH_PATTERN_T * p_pattern)
+{
+	u8_t bytes[MAX_PATTERN_LINE];
+	u32_t len = 0;
+	unsigned int byte;
+	char *p = line;
+
+	if (*p == '"') {
+		for (p++; (*p != '"') && (*p != '\0'); p++) {
+			if ((*p == '\\') && ((p[1] == '"') || (p[1] == '\\')))
+				p++;
+			bytes[len++] = *p;
+		}
+
+		if (*p != '"')
+			return ERROR;
+	} else {
+		while (*p != '\0') {
+			if (isspace((unsigned char) *p)) {
+				p++;
+				continue;
+			}
+
+			if ((!isxdigit((unsigned char) p[0])) ||
+			    (!isxdigit((unsigned char) p[1])) ||
+			    (sscanf(p, "%2x", &byte) != 1))
+				return ERROR;
+
+			bytes[len++] = byte;
+			p += 2;
+		}
+	}
+
+	if (len == 0)
+		return ERROR;
+
+	p_pattern->p_bytes = (u8_t *) malloc(len);
+	if (p_pattern->p_bytes == NULL)
+		return ERROR;
+
+	memcpy(p_pattern->p_bytes, bytes, len);
+	p_pattern->length = len;
+	strcpy(p_pattern->label, line);
+	return SUCCESS;
+}
+
+
+/*
+ * Read the patterns of pattern file filename into p_search
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS read_patterns(_1B_SEARCH_T * p_search, const char *filename)
+{
+	char line[MAX_PATTERN_LINE];
+	SEARCH_PATTERN_T *p_pattern = NULL;
+	u32_t size = 0, line_no = 0;
+	char *p_start = NULL, *p_end = NULL;
+	FILE *f_in = NULL;
+
+	f_in = fopen(filename, "r");
+	if (f_in == NULL) {
+		printf("ERROR: function %s() unable to open pattern file %s\n",
+		       __func__, filename);
+		return ERROR;
+	}
+
+	while (fgets(line, sizeof(line), f_in) != NULL) {
+		line_no++;
+
+		// Trim the line
+		//
+		for (p_start = line; isspace((unsigned char) *p_start);
+		     p_start++) ;
+		p_end = p_start + strlen(p_start);
+		while ((p_end > p_start) && isspace((unsigned char) p_end[-1]))
+			p_end--;
+		*p_end = '\0';
+
+		if ((*p_start == '\0') || (*p_start == '#'))
+			continue;
+
+		if (p_search->pattern_count == size) {
+			size = (size == 0) ? 64 : size * 2;
+			p_pattern = (SEARCH_PATTERN_T *)
+			    realloc(p_search->p_pattern,
+				    size * sizeof(SEARCH_PATTERN_T));
+			if (p_pattern == NULL) {
+				printf("ERROR: function %s() unable to allocate "
+				       "patterns\n", __func__);
+				fclose(f_in);
+				return ERROR;
+			}
+			p_search->p_pattern = p_pattern;
+		}
+
+		if (parse_pattern(p_start,
+				  &p_search->p_pattern[p_search->
+						       pattern_count]) ==
+		    ERROR) {
+			printf("ERROR: invalid pattern at %s line %u\n",
+			       filename, line_no);
+			fclose(f_in);
+			return ERROR;
+		}
+		p_search->pattern_count++;
+	}
+	fclose(f_in);
+
+	if (p_search->pattern_count == 0) {
+		printf("ERROR: no pattern in %s\n", filename);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Build the automaton of the patterns: a trie of the patterns, completed
+ * into a transition table (DFA) with the failure links resolved
+ * breadth-first.
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS build_automaton(_1B_SEARCH_T * p_search)
+{
+	SEARCH_PATTERN_T *p_pattern = NULL;
+	u32_t *p_fail = NULL, *p_queue = NULL;
+	u32_t i, j, max_states = 1, state, next, head = 0, tail = 0;
+	s32_t first = -1;
+
+	for (i = 0; i < p_search->pattern_count; i++)
+		max_states += p_search->p_pattern[i].length;
+
+	p_search->p_next = (u32_t *) calloc((size_t) max_states * 256,
+					    sizeof(u32_t));
+	p_search->p_match = (s32_t *) malloc(max_states * sizeof(s32_t));
+	p_search->p_output = (u32_t *) calloc(max_states, sizeof(u32_t));
+	p_fail = (u32_t *) calloc(max_states, sizeof(u32_t));
+	p_queue = (u32_t *) malloc(max_states * sizeof(u32_t));
+
+	if ((p_search->p_next == NULL) || (p_search->p_match == NULL) ||
+	    (p_search->p_output == NULL) || (p_fail == NULL) ||
+	    (p_queue == NULL)) {
+		printf("ERROR: function %s() unable to allocate pattern "
+		       "automaton\n", __func__);
+		free(p_fail);
+		free(p_queue);
+		return ERROR;
+	}
+
+	for (i = 0; i < max_states; i++)
+		p_search->p_match[i] = NO_PATTERN;
+	p_search->state_count = 1;
+
+	// Trie of the patterns. A transition to ROOT_STATE means none yet,
+	// no state other than the root has ROOT_STATE as its child.
+	//
+	for (i = 0; i < p_search->pattern_count; i++) {
+		p_pattern = &(p_search->p_pattern[i]);
+
+		state = ROOT_STATE;
+		for (j = 0; j < p_pattern->length; j++) {
+			next = p_search->p_next[state * 256 +
+						p_pattern->p_bytes[j]];
+			if (next == ROOT_STATE) {
+				next = p_search->state_count++;
+				p_search->p_next[state * 256 +
+						 p_pattern->p_bytes[j]] = next;
+			}
+			state = next;
+		}
+
+		if (p_search->p_match[state] == NO_PATTERN)
+			p_search->p_match[state] = i;
+
+		p_search->first_byte[p_pattern->p_bytes[0]] = 1;
+		if (first == -1)
+			first = p_pattern->p_bytes[0];
+		else if (first != p_pattern->p_bytes[0])
+			first = -2;
+	}
+	p_search->single_first_byte = (first >= 0) ? first : -1;
+
+	// Resolve the failure links breadth-first and fill the missing
+	// transitions with the transitions of the failure state
+	//
+	for (j = 0; j < 256; j++) {
+		next = p_search->p_next[ROOT_STATE * 256 + j];
+		if (next != ROOT_STATE)
+			p_queue[tail++] = next;
+	}
+
+	while (head < tail) {
+		state = p_queue[head++];
+
+		// Nearest proper suffix state which ends a pattern
+		//
+		p_search->p_output[state] =
+		    (p_search->p_match[p_fail[state]] != NO_PATTERN) ?
+		    p_fail[state] : p_search->p_output[p_fail[state]];
+
+		for (j = 0; j < 256; j++) {
+			next = p_search->p_next[state * 256 + j];
+			if (next != ROOT_STATE) {
+				p_fail[next] =
+				    p_search->p_next[p_fail[state] * 256 + j];
+				p_queue[tail++] = next;
+			} else {
+				p_search->p_next[state * 256 + j] =
+				    p_search->p_next[p_fail[state] * 256 + j];
+			}
+		}
+	}
+
+	free(p_fail);
+	free(p_queue);
+	return SUCCESS;
+}
+
+
+/*
+ * Read the patterns of pattern file filename and build the automaton which
+ * searches for all of them at once.
+ *
+ * NOTE: You must call cleanup_1B_search() when you're finished searching.
+ *
+ * input:
+ * 	filename	name of the pattern file
+ *
+ * return value:
+ * 	NULL 			on error
+ * 	pointer to _1B_SEARCH_T	on success
+ */
+_1B_SEARCH_T *init_1B_search(const char *filename)
+{
+	_1B_SEARCH_T *p_search = NULL;
+
+	if (filename == NULL) {
+		printf("ERROR: function %s() invalid filename\n", __func__);
+		return NULL;
+	}
+
+	p_search = (_1B_SEARCH_T *) malloc(sizeof(_1B_SEARCH_T));
+	if (p_search == NULL) {
+		printf("ERROR: unable to allocate memory for search\n");
+		return NULL;
+	}
+	memset(p_search, 0, sizeof(_1B_SEARCH_T));
+
+	if ((read_patterns(p_search, filename) == ERROR) ||
+	    (build_automaton(p_search) == ERROR)) {
+		cleanup_1B_search(p_search);
+		return NULL;
+	}
+
+	return p_search;
+}
+
+
+void cleanup_1B_search(_1B_SEARCH_T * p_search)
+{
+	u32_t i;
+
+	if (p_search == NULL)
+		return;
+
+	for (i = 0; i < p_search->pattern_count; i++)
+		free(p_search->p_pattern[i].p_bytes);
+
+	free(p_search->p_pattern);
+	free(p_search->p_next);
+	free(p_search->p_match);
+	free(p_search->p_output);
+	free(p_search);
+}
+
+
+/*
+ * Print the hit of the pattern at position pattern which ends at offset
+ * end_offset (exclusive) of component p_component
+ */
+static void print_hit(_1B_SEARCH_T * p_search, _1B_DATA_T * p_data,
+		      _1B_COMPONENT_T * p_component, s32_t pattern,
+		      u32_t end_offset)
+{
+	u32_t offset;
+
+	offset = end_offset - p_search->p_pattern[pattern].length;
+	printf("%s: %s in %s at offset 0x%X, file offset 0x%lX, "
+	       "physical address 0x%X\n", p_data->filename,
+	       p_search->p_pattern[pattern].label, p_component->name, offset,
+	       p_component->file_offset + offset,
+	       p_component->physical_address + offset);
+}
+
+
+/*
+ * Skip the bytes of p_buf which can't start a pattern
+ *
+ * return value:
+ * 	offset of the next byte which starts a pattern, len if none
+ */
+static u32_t skip_to_first_byte(_1B_SEARCH_T * p_search, const u8_t * p_buf,
+				u32_t offset, u32_t len)
+{
+	const u8_t *p = NULL;
+
+	if (p_search->single_first_byte >= 0) {
+		p = (const u8_t *) memchr(p_buf + offset,
+					  p_search->single_first_byte,
+					  len - offset);
+		return (p == NULL) ? len : (u32_t) (p - p_buf);
+	}
+
+	while ((offset < len) && (!p_search->first_byte[p_buf[offset]]))
+		offset++;
+
+	return offset;
+}
+
+
+/*
+ * Search all present components of the 1B file for the patterns and print
+ * the hits. Patterns don't match across component boundaries. The
+ * components data must be loaded (see init_1B_data()).
+ *
+ * input:
+ * 	p_search	pointer to the search created by init_1B_search()
+ * 	p_data		pointer to initialized _1B_DATA_T
+ *
+ * return value:
+ * 	-1		on error
+ * 	number of hits	on success
+ */
+s32_t search_1B_data(_1B_SEARCH_T * p_search, _1B_DATA_T * p_data)
+{
+	_1B_COMPONENT_T *p_comp = NULL;
+	const u8_t *p_buf = NULL;
+	u32_t offset, state, out;
+	s32_t hits = 0;
+	u16_t i;
+
+	if ((p_search == NULL) || (p_data == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return -1;
+	}
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		if (p_comp->p_buf == NULL) {
+			printf("ERROR: function %s() component %s data not "
+			       "loaded\n", __func__, p_comp->name);
+			return -1;
+		}
+
+		p_buf = (const u8_t *) p_comp->p_buf;
+		state = ROOT_STATE;
+		offset = 0;
+		while (offset < p_comp->length) {
+			// Prefilter: jump to the next possible pattern start
+			//
+			if (state == ROOT_STATE) {
+				offset = skip_to_first_byte(p_search, p_buf,
+							    offset,
+							    p_comp->length);
+				if (offset >= p_comp->length)
+					break;
+			}
+
+			state = p_search->p_next[state * 256 + p_buf[offset]];
+			offset++;
+
+			if (p_search->p_match[state] != NO_PATTERN) {
+				print_hit(p_search, p_data, p_comp,
+					  p_search->p_match[state], offset);
+				hits++;
+			}
+
+			for (out = p_search->p_output[state];
+			     out != ROOT_STATE; out = p_search->p_output[out]) {
+				print_hit(p_search, p_data, p_comp,
+					  p_search->p_match[out], offset);
+				hits++;
+			}
+		}
+	}
+
+	return hits;
+}
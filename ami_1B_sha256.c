@@ -0,0 +1,191 @@
+/*
+ * ami_1B_sha256.c
+ *
+ * SHA-256 (FIPS 180-4) message digest, used to fingerprint the 1B header
+ * and components.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+#define ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static const u32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+/*
+ * Process one 64 bytes block
+ */
+static void sha256_transform(SHA256_CTX_T * p_ctx, const u8_t * p_block)
+{
+	u32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	u32_t i;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = ((u32_t) p_block[i * 4] << 24) |
+		    ((u32_t) p_block[i * 4 + 1] << 16) |
+		    ((u32_t) p_block[i * 4 + 2] << 8) |
+		    ((u32_t) p_block[i * 4 + 3]);
+	}
+
+	for (i = 16; i < 64; i++) {
+		w[i] = (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^
+			(w[i - 2] >> 10)) + w[i - 7] +
+		    (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^
+		     (w[i - 15] >> 3)) + w[i - 16];
+	}
+
+	a = p_ctx->state[0];
+	b = p_ctx->state[1];
+	c = p_ctx->state[2];
+	d = p_ctx->state[3];
+	e = p_ctx->state[4];
+	f = p_ctx->state[5];
+	g = p_ctx->state[6];
+	h = p_ctx->state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+		    ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+		    ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	p_ctx->state[0] += a;
+	p_ctx->state[1] += b;
+	p_ctx->state[2] += c;
+	p_ctx->state[3] += d;
+	p_ctx->state[4] += e;
+	p_ctx->state[5] += f;
+	p_ctx->state[6] += g;
+	p_ctx->state[7] += h;
+}
+
+
+void sha256_init(SHA256_CTX_T * p_ctx)
+{
+	p_ctx->state[0] = 0x6a09e667;
+	p_ctx->state[1] = 0xbb67ae85;
+	p_ctx->state[2] = 0x3c6ef372;
+	p_ctx->state[3] = 0xa54ff53a;
+	p_ctx->state[4] = 0x510e527f;
+	p_ctx->state[5] = 0x9b05688c;
+	p_ctx->state[6] = 0x1f83d9ab;
+	p_ctx->state[7] = 0x5be0cd19;
+	p_ctx->count = 0;
+}
+
+
+void sha256_update(SHA256_CTX_T * p_ctx, const void *p_buf, size_t len)
+{
+	const u8_t *p = (const u8_t *) p_buf;
+	u32_t used, fill;
+
+	used = p_ctx->count % SHA256_BLOCK_LENGTH;
+	p_ctx->count += len;
+
+	// Complete the partially filled block first
+	//
+	if (used != 0) {
+		fill = SHA256_BLOCK_LENGTH - used;
+		if (len < fill) {
+			memcpy(p_ctx->block + used, p, len);
+			return;
+		}
+
+		memcpy(p_ctx->block + used, p, fill);
+		sha256_transform(p_ctx, p_ctx->block);
+		p += fill;
+		len -= fill;
+	}
+
+	while (len >= SHA256_BLOCK_LENGTH) {
+		sha256_transform(p_ctx, p);
+		p += SHA256_BLOCK_LENGTH;
+		len -= SHA256_BLOCK_LENGTH;
+	}
+
+	if (len > 0)
+		memcpy(p_ctx->block, p, len);
+}
+
+
+void sha256_final(SHA256_CTX_T * p_ctx, u8_t * p_digest)
+{
+	u8_t pad[SHA256_BLOCK_LENGTH * 2];
+	u64_t bit_count;
+	u32_t used, pad_len, i;
+
+	bit_count = p_ctx->count * 8;
+	used = p_ctx->count % SHA256_BLOCK_LENGTH;
+	pad_len = (used < 56) ? (56 - used) : (120 - used);
+
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	for (i = 0; i < 8; i++)
+		pad[pad_len + i] = (u8_t) (bit_count >> (56 - i * 8));
+
+	sha256_update(p_ctx, pad, pad_len + 8);
+
+	for (i = 0; i < 8; i++) {
+		p_digest[i * 4] = (u8_t) (p_ctx->state[i] >> 24);
+		p_digest[i * 4 + 1] = (u8_t) (p_ctx->state[i] >> 16);
+		p_digest[i * 4 + 2] = (u8_t) (p_ctx->state[i] >> 8);
+		p_digest[i * 4 + 3] = (u8_t) (p_ctx->state[i]);
+	}
+}
+
+
+/*
+ * Calculate the SHA-256 digest of buffer p_buf and write it as lowercase
+ * hexadecimal string to p_hex (SHA256_HEX_LENGTH + 1 bytes)
+ */
+void sha256_buffer_to_hex(const void *p_buf, size_t len, char *p_hex)
+{
+	SHA256_CTX_T ctx;
+	u8_t digest[SHA256_DIGEST_LENGTH];
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, p_buf, len);
+	sha256_final(&ctx, digest);
+	sha256_digest_to_hex(digest, p_hex);
+}
+
+
+void sha256_digest_to_hex(const u8_t * p_digest, char *p_hex)
+{
+	u32_t i;
+
+	for (i = 0; i < SHA256_DIGEST_LENGTH; i++)
+		sprintf(p_hex + i * 2, "%02x", p_digest[i]);
+}
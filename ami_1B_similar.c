@@ -0,0 +1,624 @@
+/*
+ * ami_1B_similar.c
+ *
+ * Near-duplicate components across many 1B files. A SHA-256 digest only
+ * tells whether two components are identical; POST_CSEG of two BIOS
+ * versions which differ in a few patched bytes gets two unrelated digests.
+ * Each present component therefore gets a MinHash sketch of the set of its
+ * 8-byte shingles (one permutation hashing, SIMILAR_SKETCH_LENGTH bins): the
+ * fraction of equal sketch values estimates the Jaccard similarity of the
+ * two shingle sets. The sketches of a corpus of 1B files are written to a
+ * fingerprint file next to the listing and loaded into a locality sensitive
+ * hashing index (SIMILAR_BANDS bands of SIMILAR_ROWS values each), so a
+ * query only compares the components which share at least one band bucket
+ * with it instead of every component of the corpus.
+ *
+ * Fingerprint file format (text, any number of 1B files):
+ *
+ * 	# 1B file: <1B_filename>
+ * 	# name length minhash
+ * 	<name> 0x<length> <SIMILAR_SKETCH_LENGTH 32-bit values in hexadecimal>
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+#define SIMILAR_SKETCH_LENGTH	64	// number of MinHash bins per component
+#define SIMILAR_BANDS		16	// LSH bands ...
+#define SIMILAR_ROWS		4	// ... of SIMILAR_ROWS sketch values each
+
+#define SIMILAR_SHINGLE_LENGTH	8	// bytes per shingle
+
+#define SIMILAR_MIN_PERCENT	50	// least similarity reported
+
+#define FILE_MARKER		"# 1B file: "
+
+#define MAX_FINGERPRINT_LINE	(MAX_PATH + MAX_COMPONENT_NAME + \
+				 SIMILAR_SKETCH_LENGTH * 8 + 32)	// maximum
+							// length of one line
+
+// Sketch of one component of the corpus
+//
+typedef struct {
+	u32_t file_index;	// 1B file of the component
+	char *p_name;		// name of the component
+	u32_t length;
+	u32_t sketch[SIMILAR_SKETCH_LENGTH];
+} SIMILAR_ENTRY_T;
+
+// Match of a query
+//
+typedef struct {
+	u32_t entry;
+	u32_t equal;		// number of equal sketch values
+} SIMILAR_MATCH_T;
+
+struct _1B_SIMILAR_S {
+
+	char **p_filename;	// names of the 1B files in the corpus
+	u32_t file_count;
+
+	SIMILAR_ENTRY_T *p_entry;	// sketches of the corpus components
+	u32_t entry_count;
+
+	u32_t bucket_mask;	// number of buckets per band - 1
+
+	s32_t *p_bucket;	// first entry of each bucket of each band, -1
+				// if none (SIMILAR_BANDS * buckets)
+
+	s32_t *p_next;		// next entry in the same bucket of the band
+				// (SIMILAR_BANDS * entry_count)
+
+	u32_t *p_seen;		// last query which compared each entry
+	u32_t query;
+
+};
+
+
+/*
+ * 64-bit hash finalizer (SplitMix64)
+ */
+static u64_t mix64(u64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+
+/*
+ * Compute the MinHash sketch of the shingles of the buffer. Each shingle is
+ * hashed once; the top bits of the hash select the bin, the low bits are
+ * the value kept if it's the smallest in the bin. Empty bins (components
+ * with few distinct shingles) are filled from the next non-empty bin so
+ * that sketches stay comparable.
+ */
+static void compute_sketch(const u8_t * p_buf, u32_t len, u32_t * p_sketch)
+{
+	u8_t filled[SIMILAR_SKETCH_LENGTH];
+	u64_t shingle, h;
+	u32_t i, j, bin;
+
+	memset(filled, 0, sizeof(filled));
+	for (i = 0; i < SIMILAR_SKETCH_LENGTH; i++)
+		p_sketch[i] = 0xFFFFFFFF;
+
+	if (len < SIMILAR_SHINGLE_LENGTH) {
+		shingle = 0;
+		memcpy(&shingle, p_buf, len);
+		h = mix64(shingle ^ ((u64_t) len << 56));
+		bin = h >> 58;
+		p_sketch[bin] = (u32_t) h;
+		filled[bin] = 1;
+	}
+
+	for (i = 0; i + SIMILAR_SHINGLE_LENGTH <= len; i++) {
+		memcpy(&shingle, p_buf + i, SIMILAR_SHINGLE_LENGTH);
+		h = mix64(shingle);
+		bin = h >> 58;	// SIMILAR_SKETCH_LENGTH bins
+		if ((u32_t) h <= p_sketch[bin]) {
+			p_sketch[bin] = (u32_t) h;
+			filled[bin] = 1;
+		}
+	}
+
+	for (i = 0; i < SIMILAR_SKETCH_LENGTH; i++) {
+		if (filled[i])
+			continue;
+
+		for (j = 1; j < SIMILAR_SKETCH_LENGTH; j++) {
+			bin = (i + j) % SIMILAR_SKETCH_LENGTH;
+			if (filled[bin]) {
+				p_sketch[i] = p_sketch[bin] + j * 0x9E3779B9;
+				break;
+			}
+		}
+	}
+}
+
+
+/*
+ * Create the fingerprints (MinHash sketches) of the present components of
+ * the 1B file. The components data must be loaded (see init_1B_data()).
+ *
+ * NOTE: Caller must free the returned buffer.
+ *
+ * input:
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * output:
+ * 	p_len	length of the returned fingerprints
+ *
+ * return value:
+ * 	NULL 			on error
+ * 	pointer to fingerprints	on success
+ */
+char *create_1B_fingerprints(_1B_DATA_T * p_data, u32_t * p_len)
+{
+	u32_t sketch[SIMILAR_SKETCH_LENGTH];
+	_1B_COMPONENT_T *p_comp = NULL;
+	char *p_text = NULL;
+	size_t size, len;
+	u16_t i, j;
+
+	if ((p_data == NULL) || (p_len == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return NULL;
+	}
+
+	size = (p_data->header.component_info_count + 2) *
+	    MAX_FINGERPRINT_LINE;
+	p_text = (char *) malloc(size);
+	if (p_text == NULL) {
+		printf("ERROR: function %s() unable to allocate fingerprint "
+		       "buffer\n", __func__);
+		return NULL;
+	}
+
+	len = snprintf(p_text, size, FILE_MARKER "%s\n"
+		       "# name length minhash\n", p_data->filename);
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		if (p_comp->p_buf == NULL) {
+			printf("ERROR: function %s() data of component %s is "
+			       "not loaded\n", __func__, p_comp->name);
+			free(p_text);
+			return NULL;
+		}
+
+		compute_sketch(p_comp->p_buf, p_comp->length, sketch);
+
+		len += snprintf(p_text + len, size - len, "%s 0x%X ",
+				p_comp->name, p_comp->length);
+		for (j = 0; j < SIMILAR_SKETCH_LENGTH; j++)
+			len += snprintf(p_text + len, size - len, "%08x",
+					sketch[j]);
+		len += snprintf(p_text + len, size - len, "\n");
+	}
+
+	*p_len = len;
+	return p_text;
+}
+
+
+/*
+ * Bucket of the band of the sketch
+ */
+static u32_t get_band_bucket(const _1B_SIMILAR_T * p_similar,
+			     const u32_t * p_sketch, u32_t band)
+{
+	u64_t h = band;
+	u32_t i;
+
+	for (i = 0; i < SIMILAR_ROWS; i++)
+		h = mix64(h ^ p_sketch[band * SIMILAR_ROWS + i]);
+
+	return band * (p_similar->bucket_mask + 1) +
+	    (h & p_similar->bucket_mask);
+}
+
+
+/*
+ * Parse one component line of a fingerprint file
+ *
+ * return value:
+ * 	ERROR 	if the line isn't a component line
+ * 	SUCCESS	on success
+ */
+static STATUS parse_fingerprint(const char *line, char *name,
+				SIMILAR_ENTRY_T * p_entry)
+{
+	const char *p = NULL;
+	char *p_end = NULL;
+	u32_t value, i, j;
+	size_t len;
+
+	len = strcspn(line, " \t\r\n");
+	if ((len == 0) || (len >= MAX_COMPONENT_NAME) || (line[len] != ' '))
+		return ERROR;
+	memcpy(name, line, len);
+	name[len] = '\0';
+
+	p_entry->length = strtoul(line + len + 1, &p_end, 16);
+	if ((strncmp(line + len + 1, "0x", 2)) || (*p_end != ' ') ||
+	    (strlen(p_end + 1) < SIMILAR_SKETCH_LENGTH * 8))
+		return ERROR;
+
+	// The line is parsed by hand, sscanf() would dominate the loading
+	// time of a large corpus
+	//
+	p = p_end + 1;
+	for (i = 0; i < SIMILAR_SKETCH_LENGTH; i++) {
+		value = 0;
+		for (j = 0; j < 8; j++, p++) {
+			if ((*p >= '0') && (*p <= '9'))
+				value = (value << 4) | (*p - '0');
+			else if ((*p >= 'a') && (*p <= 'f'))
+				value = (value << 4) | (*p - 'a' + 10);
+			else if ((*p >= 'A') && (*p <= 'F'))
+				value = (value << 4) | (*p - 'A' + 10);
+			else
+				return ERROR;
+		}
+		p_entry->sketch[i] = value;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Add the 1B filename to the corpus
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS add_corpus_file(_1B_SIMILAR_T * p_similar, const char *filename)
+{
+	char **p_filename = NULL;
+
+	p_filename = (char **) realloc(p_similar->p_filename,
+				       (p_similar->file_count + 1) *
+				       sizeof(char *));
+	if (p_filename == NULL)
+		return ERROR;
+	p_similar->p_filename = p_filename;
+
+	p_filename[p_similar->file_count] = strdup(filename);
+	if (p_filename[p_similar->file_count] == NULL)
+		return ERROR;
+
+	p_similar->file_count++;
+	return SUCCESS;
+}
+
+
+/*
+ * Build the LSH index of the corpus sketches
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS build_similar_index(_1B_SIMILAR_T * p_similar)
+{
+	u32_t buckets = 1, band, bucket, i;
+
+	while (buckets < p_similar->entry_count)
+		buckets <<= 1;
+	p_similar->bucket_mask = buckets - 1;
+
+	p_similar->p_bucket = (s32_t *) malloc(SIMILAR_BANDS * buckets *
+					       sizeof(s32_t));
+	p_similar->p_next = (s32_t *) malloc(SIMILAR_BANDS *
+					     (p_similar->entry_count + 1) *
+					     sizeof(s32_t));
+	p_similar->p_seen = (u32_t *) calloc(p_similar->entry_count + 1,
+					     sizeof(u32_t));
+	if ((p_similar->p_bucket == NULL) || (p_similar->p_next == NULL) ||
+	    (p_similar->p_seen == NULL))
+		return ERROR;
+
+	memset(p_similar->p_bucket, 0xFF,
+	       SIMILAR_BANDS * buckets * sizeof(s32_t));
+
+	for (i = 0; i < p_similar->entry_count; i++) {
+		for (band = 0; band < SIMILAR_BANDS; band++) {
+			bucket = get_band_bucket(p_similar,
+						 p_similar->p_entry[i].sketch,
+						 band);
+			p_similar->p_next[band * p_similar->entry_count + i] =
+			    p_similar->p_bucket[bucket];
+			p_similar->p_bucket[bucket] = i;
+		}
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Load the fingerprint file (see create_1B_fingerprints()) of a corpus of
+ * 1B files and index the sketches for find_similar_components().
+ *
+ * NOTE: You must call cleanup_1B_similar() when you're finished querying.
+ *
+ * input:
+ * 	filename	name of the fingerprint file
+ *
+ * return value:
+ * 	NULL 				on error
+ * 	pointer to _1B_SIMILAR_T	on success
+ */
+_1B_SIMILAR_T *init_1B_similar(const char *filename)
+{
+	_1B_SIMILAR_T *p_similar = NULL;
+	SIMILAR_ENTRY_T entry, *p_entry = NULL;
+	char name[MAX_COMPONENT_NAME];
+	char *line = NULL;
+	u32_t entry_alloc = 0;
+	size_t len;
+	FILE *f_in = NULL;
+
+	if (filename == NULL) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return NULL;
+	}
+
+	f_in = fopen(filename, "r");
+	if (f_in == NULL) {
+		printf("ERROR: function %s() unable to open fingerprint file "
+		       "%s\n", __func__, filename);
+		return NULL;
+	}
+
+	p_similar = (_1B_SIMILAR_T *) calloc(1, sizeof(_1B_SIMILAR_T));
+	line = (char *) malloc(MAX_FINGERPRINT_LINE);
+	if ((p_similar == NULL) || (line == NULL)) {
+		printf("ERROR: function %s() unable to allocate memory\n",
+		       __func__);
+		free(p_similar);
+		free(line);
+		fclose(f_in);
+		return NULL;
+	}
+
+	while (fgets(line, MAX_FINGERPRINT_LINE, f_in) != NULL) {
+		if (!strncmp(line, FILE_MARKER, strlen(FILE_MARKER))) {
+			len = strcspn(line, "\r\n");
+			line[len] = '\0';
+			if (add_corpus_file(p_similar,
+					    line + strlen(FILE_MARKER)) ==
+			    ERROR)
+				goto error;
+			continue;
+		}
+
+		if ((line[0] == '#') || (p_similar->file_count == 0) ||
+		    (parse_fingerprint(line, name, &entry) == ERROR))
+			continue;
+
+		if (p_similar->entry_count == entry_alloc) {
+			entry_alloc = entry_alloc ? entry_alloc * 2 : 256;
+			p_entry = (SIMILAR_ENTRY_T *)
+			    realloc(p_similar->p_entry,
+				    entry_alloc * sizeof(SIMILAR_ENTRY_T));
+			if (p_entry == NULL)
+				goto error;
+			p_similar->p_entry = p_entry;
+		}
+
+		entry.file_index = p_similar->file_count - 1;
+		entry.p_name = strdup(name);
+		if (entry.p_name == NULL)
+			goto error;
+		p_similar->p_entry[p_similar->entry_count++] = entry;
+	}
+
+	free(line);
+	line = NULL;
+	fclose(f_in);
+	f_in = NULL;
+
+	if (p_similar->entry_count == 0) {
+		printf("ERROR: function %s() no fingerprints in %s\n", __func__,
+		       filename);
+		cleanup_1B_similar(p_similar);
+		return NULL;
+	}
+
+	if (build_similar_index(p_similar) == ERROR)
+		goto error;
+
+	return p_similar;
+
+ error:
+	printf("ERROR: function %s() unable to allocate memory\n", __func__);
+	free(line);
+	if (f_in != NULL)
+		fclose(f_in);
+	cleanup_1B_similar(p_similar);
+	return NULL;
+}
+
+
+/*
+ * Find the corpus components most similar to the sketch, i.e. the ones
+ * sharing a band bucket with it, and keep the best max_count of them
+ *
+ * return value:
+ * 	number of matches in p_match
+ */
+static u32_t query_sketch(_1B_SIMILAR_T * p_similar, const u32_t * p_sketch,
+			  const char *filename, SIMILAR_MATCH_T * p_match,
+			  u32_t max_count)
+{
+	SIMILAR_ENTRY_T *p_entry = NULL;
+	u32_t band, i, j, equal, count = 0;
+	s32_t e;
+
+	p_similar->query++;
+
+	for (band = 0; band < SIMILAR_BANDS; band++) {
+		e = p_similar->p_bucket[get_band_bucket(p_similar, p_sketch,
+							band)];
+
+		for (; e >= 0;
+		     e = p_similar->p_next[band * p_similar->entry_count + e]) {
+			if (p_similar->p_seen[e] == p_similar->query)
+				continue;
+			p_similar->p_seen[e] = p_similar->query;
+
+			// The components of the queried 1B file itself
+			//
+			p_entry = &(p_similar->p_entry[e]);
+			if (!strcmp(p_similar->p_filename[p_entry->file_index],
+				    filename))
+				continue;
+
+			for (i = 0, equal = 0; i < SIMILAR_SKETCH_LENGTH; i++)
+				equal += (p_entry->sketch[i] == p_sketch[i]);
+
+			if (equal * 100 <
+			    SIMILAR_MIN_PERCENT * SIMILAR_SKETCH_LENGTH)
+				continue;
+
+			// Insert into the matches, best first
+			//
+			for (j = count; (j > 0) && (p_match[j - 1].equal < equal);
+			     j--) {
+				if (j < max_count)
+					p_match[j] = p_match[j - 1];
+			}
+			if (j < max_count) {
+				p_match[j].entry = e;
+				p_match[j].equal = equal;
+				if (count < max_count)
+					count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+
+/*
+ * Find the components of the corpus most similar to the present components
+ * of the 1B file (or only to component component_name) and print them,
+ * best first, with their estimated similarity. Components of a 1B file
+ * with the same name as the queried one are not reported.
+ *
+ * input:
+ * 	p_similar	pointer to corpus read by init_1B_similar()
+ * 	p_data		pointer to initialized _1B_DATA_T (with components data)
+ * 	component_name	name of the component to query, NULL for all
+ * 	max_count	maximum number of matches printed per component
+ *
+ * return value:
+ * 	ERROR 					on error
+ * 	number of components with matches	on success
+ */
+s32_t find_similar_components(_1B_SIMILAR_T * p_similar, _1B_DATA_T * p_data,
+			      const char *component_name, u32_t max_count)
+{
+	u32_t sketch[SIMILAR_SKETCH_LENGTH];
+	SIMILAR_MATCH_T *p_match = NULL;
+	SIMILAR_ENTRY_T *p_entry = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u32_t count, j;
+	s32_t found = 0, queried = 0;
+	u16_t i;
+
+	if ((p_similar == NULL) || (p_data == NULL) || (max_count == 0)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	p_match = (SIMILAR_MATCH_T *) malloc(max_count *
+					     sizeof(SIMILAR_MATCH_T));
+	if (p_match == NULL) {
+		printf("ERROR: function %s() unable to allocate memory\n",
+		       __func__);
+		return ERROR;
+	}
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0) || (p_comp->p_buf == NULL))
+			continue;
+		if ((component_name != NULL) &&
+		    (strcmp(p_comp->name, component_name)))
+			continue;
+		queried++;
+
+		compute_sketch(p_comp->p_buf, p_comp->length, sketch);
+		count = query_sketch(p_similar, sketch, p_data->filename,
+				     p_match, max_count);
+
+		printf("%s (0x%X bytes):\n", p_comp->name, p_comp->length);
+		if (count == 0) {
+			printf("  no similar component\n");
+			continue;
+		}
+
+		for (j = 0; j < count; j++) {
+			p_entry = &(p_similar->p_entry[p_match[j].entry]);
+			printf("  %5.1f%%  %s  %s (0x%X bytes)\n",
+			       p_match[j].equal * 100.0 / SIMILAR_SKETCH_LENGTH,
+			       p_similar->p_filename[p_entry->file_index],
+			       p_entry->p_name, p_entry->length);
+		}
+		found++;
+	}
+
+	free(p_match);
+
+	if ((component_name != NULL) && (queried == 0)) {
+		printf("ERROR: component %s not present in %s\n",
+		       component_name, p_data->filename);
+		return ERROR;
+	}
+
+	return found;
+}
+
+
+void cleanup_1B_similar(_1B_SIMILAR_T * p_similar)
+{
+	u32_t i;
+
+	if (p_similar == NULL)
+		return;
+
+	for (i = 0; i < p_similar->entry_count; i++)
+		free(p_similar->p_entry[i].p_name);
+	for (i = 0; i < p_similar->file_count; i++)
+		free(p_similar->p_filename[i]);
+
+	free(p_similar->p_entry);
+	free(p_similar->p_filename);
+	free(p_similar->p_bucket);
+	free(p_similar->p_next);
+	free(p_similar->p_seen);
+	free(p_similar);
+}
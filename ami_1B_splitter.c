@@ -9,6 +9,7 @@
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -17,12 +18,118 @@
 
 #include "ami_1B.h"
 
+#define BATCH_1B_COUNT	32	// number of 1B files extracted at once in batch mode
+
+#define STDIN_CHUNK_SIZE	(64 * 1024)	// bytes of the 1B file read from stdin at once
+
+#define SIMILAR_MATCH_COUNT	5	// most similar components printed per component
+
+#ifdef _WIN32
+#include <io.h>			/** Required for _setmode() */
+#endif
+
+#ifdef _WIN32
+#define make_directory(dir)	mkdir(dir)
+#else
+#define make_directory(dir)	mkdir(dir, 0755)
+#endif
+
 typedef enum {
 	EXTRACT_ALL = 0,	// Write all 1B components to individual files
 	EXTRACT_ONE = 1,	// Write only one 1B component starting at the passed in offset
 	LIST = 2,
+	MEMORY_IMAGE = 3,	// Write the components at their physical address to one file
+	EXTRACT_ALL_TAR = 4,	// Write all components of one or more 1B files to a tar archive
+	COPY_ALL = 5,		// Copy all 1B components to individual files in-kernel
+	COPY_ONE = 6,		// Copy only one 1B component in-kernel
+	MANIFEST = 7,		// Print the golden manifest of the 1B file
+	EXTRACT_CHANGED = 8,	// Only rewrite the component files which changed
+	STATS = 9,		// Print entropy and padding statistics of the components
+	LOOKUP = 10,		// Translate physical addresses read from stdin to components
+	ACPI_LIST = 11,		// List the ACPI tables in ACPITBL_SEG
+	ACPI_EXTRACT = 12,	// Write one ACPI table to file
+	XREF = 13,		// Print the far call/jump reference graph of the components
 } ACTION;
 
+// Exit code of the manifest verification
+//
+typedef enum {
+	VERIFY_EXIT_MATCH = 0,
+	VERIFY_EXIT_MISMATCH = 1,
+	VERIFY_EXIT_ERROR = 2,
+} VERIFY_EXIT_CODE;
+
+// Exit code of the pattern search (like grep)
+//
+typedef enum {
+	SEARCH_EXIT_FOUND = 0,
+	SEARCH_EXIT_NOT_FOUND = 1,
+	SEARCH_EXIT_ERROR = 2,
+} SEARCH_EXIT_CODE;
+
+
+/*
+ * Callback of the push parser: write each component to a file named after 
+ * the component as soon as its data is complete
+ */
+static STATUS write_parsed_component(PARSER_EVENT event, _1B_DATA_T * p_data,
+				     _1B_COMPONENT_T * p_component,
+				     void *p_context)
+{
+	if (event != PARSER_COMPONENT)
+		return SUCCESS;
+
+	return write_component_data_to_file(p_component);
+}
+
+
+/*
+ * Write all of the 1B components data read from stdin into individual 
+ * files. The 1B file is fed to the push parser as it's read, each 
+ * component is written as soon as it's complete.
+ * 
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS write_all_components_from_stdin(void)
+{
+	_1B_PARSER_T *p_parser = NULL;
+	_1B_DATA_T *p_data = NULL;
+	u8_t buf[STDIN_CHUNK_SIZE];
+	size_t len;
+	STATUS status = SUCCESS;
+
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+	p_parser = init_1B_parser("stdin", write_parsed_component, NULL);
+	if (p_parser == NULL)
+		return ERROR;
+
+	while ((len = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+		status = feed_1B_parser(p_parser, buf, len);
+		if (status == ERROR)
+			break;
+	}
+
+	if (ferror(stdin)) {
+		printf("ERROR: Unable to read 1B file from stdin\n");
+		status = ERROR;
+	}
+
+	if (status == SUCCESS) {
+		p_data = finish_1B_parser(p_parser);
+		if (p_data == NULL)
+			status = ERROR;
+		cleanup_1B_data(p_data);
+	}
+
+	cleanup_1B_parser(p_parser);
+	return status;
+}
+
 
 /*
  * Write all of the 1B components data into individual files. 
@@ -34,35 +141,77 @@ typedef enum {
  * 	ERROR 	on error
  * 	SUCCESS	on success		
  */
-static STATUS write_all_components(_1B_DATA_T * p_data)
+static STATUS write_all_components(_1B_DATA_T * p_data, OUTPUT_MODE mode)
 {
-	u16_t i, component_count;
-	_1B_COMPONENT_T *p_comp = NULL;
-
 	if (p_data == NULL) {
 		printf("ERROR: input 1B data structure is NULL\n");
 		return ERROR;
 	}
 
-	component_count = get_component_count(p_data);
+	// Write each component to one file named after the component
+	//
+	return write_all_components_batch(&p_data, NULL, 1, mode);
+}
 
-	// Write each component to one file (*.bin)
-	for (i = 0; i < component_count; i++) {
-		p_comp = get_component_from_position(p_data, i);
 
-		if (p_comp == NULL) {
-			printf("Empty component at %02Xh\n", i);
-			continue;
+/*
+ * Write all of the components of each 1B file into individual files in 
+ * directory output_dir/<1B_file_basename>. The 1B files are processed in 
+ * groups of BATCH_1B_COUNT files, all component files of one group are 
+ * submitted to the output engine at once.
+ * 
+ * input: 
+ * 	output_dir	name of the output directory
+ * 	count		number of 1B files
+ * 	filenames	names of the 1B files
+ * 	
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS write_all_components_to_dir(const char *output_dir,
+					  int count, char *filenames[])
+{
+	_1B_DATA_T *p_data[BATCH_1B_COUNT];
+	char dir_buf[BATCH_1B_COUNT][MAX_PATH];
+	const char *dir_names[BATCH_1B_COUNT];
+	const char *p_base = NULL;
+	STATUS status = SUCCESS;
+	int i, j, loaded;
+
+	make_directory(output_dir);
+
+	for (i = 0; i < count; i += BATCH_1B_COUNT) {
+		loaded = 0;
+
+		for (j = i; (j < count) && (j < i + BATCH_1B_COUNT); j++) {
+			p_data[loaded] = init_1B_data(filenames[j]);
+			if (p_data[loaded] == NULL) {
+				printf("ERROR: Unable to parse 1B file %s\n",
+				       filenames[j]);
+				status = ERROR;
+				continue;
+			}
+
+			p_base = strrchr(filenames[j], '/');
+			p_base = (p_base == NULL) ? filenames[j] : p_base + 1;
+			snprintf(dir_buf[loaded], MAX_PATH, "%s/%s",
+				 output_dir, p_base);
+			make_directory(dir_buf[loaded]);
+			dir_names[loaded] = dir_buf[loaded];
+			loaded++;
 		}
 
-		if (is_component_data_present(p_comp) == DATA_ABSENT)
-			continue;
+		if ((loaded > 0) &&
+		    (write_all_components_batch(p_data, dir_names, loaded,
+						OUTPUT_ALL) == ERROR))
+			status = ERROR;
 
-		if (write_component_data_to_file(p_comp) == ERROR)
-			continue;
+		for (j = 0; j < loaded; j++)
+			cleanup_1B_data(p_data[j]);
 	}
 
-	return SUCCESS;
+	return status;
 }
 
 
@@ -97,18 +246,594 @@ static STATUS write_one_component(_1B_DATA_T * p_data, off_t file_offset)
 }
 
 
+/*
+ * Copy one component (or all components if file_offset is 0) of the 1B file 
+ * to individual files without reading the components data, see 
+ * copy_component_data_to_file().
+ * 
+ * input: 
+ * 	p_data 		pointer to _1B_DATA_T initialized by init_1B_header()
+ * 	file_offset	file offset of the component, 0 for all components
+ * 	
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS copy_components(_1B_DATA_T * p_data, off_t file_offset)
+{
+	u16_t i, component_count;
+	_1B_COMPONENT_T *p_comp = NULL;
+	STATUS status = SUCCESS;
+
+	if (p_data == NULL) {
+		printf("ERROR: input 1B data structure is NULL\n");
+		return ERROR;
+	}
+
+	if (file_offset != 0) {
+		p_comp = get_component_from_file_offset(p_data, file_offset);
+		if (p_comp == NULL) {
+			printf("ERROR: Invalid file offset. "
+			       "Component not found\n");
+			return ERROR;
+		}
+
+		return copy_component_data_to_file(p_data, p_comp, NULL);
+	}
+
+	component_count = get_component_count(p_data);
+	for (i = 0; i < component_count; i++) {
+		p_comp = get_component_from_position(p_data, i);
+
+		if (is_component_data_present(p_comp) == DATA_ABSENT)
+			continue;
+
+		if (copy_component_data_to_file(p_data, p_comp, NULL) == ERROR)
+			status = ERROR;
+	}
+
+	return status;
+}
+
+
+/*
+ * Write the header, a manifest and all components of each 1B file into one 
+ * tar archive.
+ * 
+ * input: 
+ * 	tar_filename	name of the tar archive, "-" writes to stdout
+ * 	count		number of 1B files
+ * 	filenames	names of the 1B files
+ * 	
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS write_all_components_to_tar(const char *tar_filename,
+					  int count, char *filenames[])
+{
+	_1B_TAR_T *p_tar = NULL;
+	_1B_DATA_T *p_data = NULL;
+	STATUS status = SUCCESS;
+	int i;
+
+	p_tar = init_1B_tar(tar_filename);
+	if (p_tar == NULL)
+		return ERROR;
+
+	for (i = 0; (i < count) && (status == SUCCESS); i++) {
+		p_data = init_1B_data(filenames[i]);
+		if (p_data == NULL) {
+			printf("ERROR: Unable to parse 1B file %s\n",
+			       filenames[i]);
+			status = ERROR;
+			break;
+		}
+
+		status = write_1B_data_to_tar(p_tar, p_data);
+		cleanup_1B_data(p_data);
+	}
+
+	if (close_1B_tar(p_tar) == ERROR)
+		status = ERROR;
+
+	return status;
+}
+
+
+/*
+ * Print the manifest of the 1B file (header fields, components info and 
+ * SHA-256 digests) to stdout
+ * 
+ * input: 
+ * 	p_data 	pointer to initialized _1B_DATA_T 
+ * 	
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS print_manifest(_1B_DATA_T * p_data)
+{
+	char *p_manifest = NULL;
+	u32_t len = 0;
+
+	p_manifest = create_1B_manifest(p_data, &len);
+	if (p_manifest == NULL)
+		return ERROR;
+
+	fwrite(p_manifest, sizeof(char), len, stdout);
+	free(p_manifest);
+	return SUCCESS;
+}
+
+
+/*
+ * Verify each 1B file against the manifest
+ * 
+ * input: 
+ * 	manifest_filename	name of the manifest file
+ * 	mode			verification mode
+ * 	count			number of 1B files
+ * 	filenames		names of the 1B files
+ * 	
+ * return value: 
+ * 	VERIFY_EXIT_MATCH 	if all 1B files match the manifest
+ * 	VERIFY_EXIT_MISMATCH	if any 1B file doesn't match
+ * 	VERIFY_EXIT_ERROR	on error
+ */
+static VERIFY_EXIT_CODE verify_files(const char *manifest_filename,
+				     VERIFY_MODE mode, int count,
+				     char *filenames[])
+{
+	_1B_MANIFEST_T *p_manifest = NULL;
+	VERIFY_EXIT_CODE exit_code = VERIFY_EXIT_MATCH;
+	s32_t mismatches;
+	int i;
+
+	p_manifest = init_1B_manifest(manifest_filename);
+	if (p_manifest == NULL)
+		return VERIFY_EXIT_ERROR;
+
+	for (i = 0; i < count; i++) {
+		mismatches = verify_1B_file(p_manifest, filenames[i], mode);
+
+		if (mismatches == ERROR) {
+			printf("ERROR: %s: unable to verify\n", filenames[i]);
+			exit_code = VERIFY_EXIT_ERROR;
+		} else if (mismatches > 0) {
+			printf("FAILED: %s: %d mismatch(es)\n", filenames[i],
+			       mismatches);
+			if (exit_code == VERIFY_EXIT_MATCH)
+				exit_code = VERIFY_EXIT_MISMATCH;
+		} else {
+			printf("OK: %s\n", filenames[i]);
+		}
+	}
+
+	cleanup_1B_manifest(p_manifest);
+	return exit_code;
+}
+
+
+/*
+ * Search all components of each 1B file for the patterns in the pattern 
+ * file. The automaton is built once for all 1B files.
+ * 
+ * input: 
+ * 	pattern_filename	name of the pattern file
+ * 	count			number of 1B files
+ * 	filenames		names of the 1B files
+ * 	
+ * return value: 
+ * 	SEARCH_EXIT_FOUND 	if any pattern was found
+ * 	SEARCH_EXIT_NOT_FOUND	if no pattern was found
+ * 	SEARCH_EXIT_ERROR	on error
+ */
+static SEARCH_EXIT_CODE search_files(const char *pattern_filename, int count,
+				     char *filenames[])
+{
+	_1B_SEARCH_T *p_search = NULL;
+	_1B_DATA_T *p_data = NULL;
+	s32_t hits, total_hits = 0;
+	int i;
+
+	p_search = init_1B_search(pattern_filename);
+	if (p_search == NULL)
+		return SEARCH_EXIT_ERROR;
+
+	for (i = 0; i < count; i++) {
+		p_data = init_1B_data(filenames[i]);
+		if (p_data == NULL) {
+			printf("ERROR: Unable to parse 1B file %s\n",
+			       filenames[i]);
+			cleanup_1B_search(p_search);
+			return SEARCH_EXIT_ERROR;
+		}
+
+		hits = search_1B_data(p_search, p_data);
+		cleanup_1B_data(p_data);
+
+		if (hits < 0) {
+			cleanup_1B_search(p_search);
+			return SEARCH_EXIT_ERROR;
+		}
+		total_hits += hits;
+	}
+
+	cleanup_1B_search(p_search);
+	return (total_hits > 0) ? SEARCH_EXIT_FOUND : SEARCH_EXIT_NOT_FOUND;
+}
+
+
+/*
+ * Translate the physical addresses read from stdin (one hexadecimal address 
+ * per line) to component, offset in the component and 1B file offset.
+ * 
+ * input: 
+ * 	p_data 	pointer to initialized _1B_DATA_T 
+ * 	
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS lookup_addresses(_1B_DATA_T * p_data)
+{
+	_1B_ADDRESS_INDEX_T *p_index = NULL;
+	char line[128];
+	unsigned int address;
+
+	p_index = init_1B_address_index(p_data);
+	if (p_index == NULL)
+		return ERROR;
+
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		if (sscanf(line, "%X", &address) != 1)
+			continue;
+
+		print_1B_address(p_index, address);
+	}
+
+	cleanup_1B_address_index(p_index);
+	return SUCCESS;
+}
+
+
+/*
+ * Write the 1B files into the pack file pack_filename
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS write_1B_files_to_pack(const char *pack_filename, int count,
+				     char *filenames[])
+{
+	_1B_PACK_T *p_pack = NULL;
+	_1B_DATA_T *p_data = NULL;
+	STATUS status = SUCCESS;
+	int i;
+
+	p_pack = init_1B_pack(pack_filename);
+	if (p_pack == NULL)
+		return ERROR;
+
+	for (i = 0; (i < count) && (status == SUCCESS); i++) {
+		p_data = init_1B_data(filenames[i]);
+		if (p_data == NULL) {
+			printf("ERROR: Unable to parse 1B file %s\n",
+			       filenames[i]);
+			status = ERROR;
+			break;
+		}
+
+		status = write_1B_data_to_pack(p_pack, p_data);
+		cleanup_1B_data(p_data);
+	}
+
+	if (close_1B_pack(p_pack) == ERROR)
+		status = ERROR;
+
+	return status;
+}
+
+
+/*
+ * List the 1B files in the pack file pack_filename. With name, only list
+ * the components of the 1B file named name.
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS list_pack(const char *pack_filename, const char *name)
+{
+	_1B_PACK_T *p_pack = NULL;
+	_1B_DATA_T *p_data = NULL;
+	STATUS status = SUCCESS;
+	u32_t i, count;
+
+	p_pack = open_1B_pack(pack_filename);
+	if (p_pack == NULL)
+		return ERROR;
+
+	count = get_pack_image_count(p_pack);
+	for (i = 0; i < count; i++) {
+		if ((name != NULL) &&
+		    strcmp(name, get_pack_image_name(p_pack, i)))
+			continue;
+
+		p_data = init_1B_data_from_pack(p_pack, i);
+		if (p_data == NULL) {
+			status = ERROR;
+			break;
+		}
+
+		if (name != NULL)
+			list_components(p_data);
+		else
+			printf("%s: 0x%X components, size 0x%lX\n",
+			       get_pack_image_name(p_pack, i),
+			       get_component_count(p_data),
+			       get_1B_size(p_data));
+
+		cleanup_1B_data(p_data);
+	}
+
+	if ((name != NULL) && (find_pack_image(p_pack, name) < 0)) {
+		printf("ERROR: 1B file %s not found in pack %s\n", name,
+		       pack_filename);
+		status = ERROR;
+	}
+
+	close_1B_pack(p_pack);
+	return status;
+}
+
+
+/*
+ * Write the 1B file named name in the pack file pack_filename to
+ * output_filename
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS extract_from_pack(const char *pack_filename, const char *name,
+				const char *output_filename)
+{
+	_1B_PACK_T *p_pack = NULL;
+	_1B_DATA_T *p_data = NULL;
+	STATUS status = ERROR;
+	s32_t index;
+
+	p_pack = open_1B_pack(pack_filename);
+	if (p_pack == NULL)
+		return ERROR;
+
+	index = find_pack_image(p_pack, name);
+	if (index < 0) {
+		printf("ERROR: 1B file %s not found in pack %s\n", name,
+		       pack_filename);
+	} else {
+		p_data = init_1B_data_from_pack(p_pack, index);
+		if (p_data != NULL) {
+			status = write_1B_data_to_file(p_data,
+						       output_filename);
+			cleanup_1B_data(p_data);
+		}
+	}
+
+	close_1B_pack(p_pack);
+	return status;
+}
+
+
+/*
+ * Check the header of each 1B file and print its verdict
+ * 
+ * input: 
+ * 	count		number of 1B files
+ * 	filenames	names of the 1B files
+ *
+ * return value:
+ * 	the verdict of the first 1B file which failed the check, CHECK_OK if 
+ * 	all passed
+ */
+static CHECK_VERDICT check_files(int count, char *filenames[])
+{
+	CHECK_VERDICT verdict, exit_code = CHECK_OK;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		verdict = check_1B_file(filenames[i]);
+		printf("%s: %s\n", get_check_verdict_name(verdict),
+		       filenames[i]);
+
+		if ((verdict != CHECK_OK) && (exit_code == CHECK_OK))
+			exit_code = verdict;
+	}
+
+	return exit_code;
+}
+
+
+/*
+ * Print the similarity fingerprints of the components of each 1B file to 
+ * stdout
+ * 
+ * input: 
+ * 	count		number of 1B files
+ * 	filenames	names of the 1B files
+ * 	
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS print_fingerprints(int count, char *filenames[])
+{
+	_1B_DATA_T *p_data = NULL;
+	char *p_text = NULL;
+	u32_t len = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		p_data = init_1B_data(filenames[i]);
+		if (p_data == NULL) {
+			printf("ERROR: Unable to parse 1B file %s\n",
+			       filenames[i]);
+			return ERROR;
+		}
+
+		p_text = create_1B_fingerprints(p_data, &len);
+		cleanup_1B_data(p_data);
+		if (p_text == NULL)
+			return ERROR;
+
+		fwrite(p_text, sizeof(char), len, stdout);
+		free(p_text);
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Print the components in the corpus of the fingerprint file which are most 
+ * similar to the components of the 1B file
+ * 
+ * input: 
+ * 	fingerprint_filename	name of the fingerprint file
+ * 	filename		name of the 1B file
+ * 	component_name		name of the component, NULL for all
+ * 	
+ * return value: 
+ * 	ERROR 	on error
+ * 	SUCCESS	on success		
+ */
+static STATUS find_similar(const char *fingerprint_filename,
+			   const char *filename, const char *component_name)
+{
+	_1B_SIMILAR_T *p_similar = NULL;
+	_1B_DATA_T *p_data = NULL;
+	s32_t found;
+
+	p_similar = init_1B_similar(fingerprint_filename);
+	if (p_similar == NULL)
+		return ERROR;
+
+	p_data = init_1B_data(filename);
+	if (p_data == NULL) {
+		printf("ERROR: Unable to parse 1B file %s\n", filename);
+		cleanup_1B_similar(p_similar);
+		return ERROR;
+	}
+
+	found = find_similar_components(p_similar, p_data, component_name,
+					SIMILAR_MATCH_COUNT);
+
+	cleanup_1B_data(p_data);
+	cleanup_1B_similar(p_similar);
+	return (found == ERROR) ? ERROR : SUCCESS;
+}
+
+
 static void show_help(char *argv[])
 {
 	printf("Usage:\n"
 	       "%s --extract-all 1B_filename \n"
 	       "%s --extract 	1B_filename  component_offset\n"
-	       "%s --list 	1B_filename\n\n"
+	       "%s --list 	1B_filename\n"
+	       "%s --memory-image 1B_filename  output_filename\n"
+	       "%s --extract-all-tar tar_filename  1B_filename [1B_filename ...]\n"
+	       "%s --extract-all-batch output_dir  1B_filename [1B_filename ...]\n"
+	       "%s --copy-all 	1B_filename \n"
+	       "%s --copy 	1B_filename  component_offset\n"
+	       "%s --manifest 	1B_filename\n"
+	       "%s --verify [--all] manifest_filename  1B_filename [1B_filename ...]\n"
+	       "%s --extract-changed 1B_filename \n"
+	       "%s --pack 	pack_filename  1B_filename [1B_filename ...]\n"
+	       "%s --pack-list pack_filename [1B_name]\n"
+	       "%s --pack-extract pack_filename  1B_name  output_filename\n"
+	       "%s --stats 	1B_filename\n"
+	       "%s --search 	pattern_filename  1B_filename [1B_filename ...]\n"
+	       "%s --lookup 	1B_filename  < address_list\n"
+	       "%s --acpi-list 	1B_filename\n"
+	       "%s --acpi-extract 1B_filename  table_signature  output_filename\n"
+	       "%s --check 	1B_filename [1B_filename ...]\n"
+	       "%s --fingerprint 1B_filename [1B_filename ...]\n"
+	       "%s --similar 	fingerprint_filename  1B_filename [component_name]\n"
+	       "%s --xref 	1B_filename\n"
+	       "%s --direct 	<variant>\n\n"
 	       "In the first variant, this program will extract all components into "
-	       "individual files.\n\n"
+	       "individual files. With 1B_filename -, the 1B file is read from stdin "
+	       "and each component is written as soon as it's read.\n\n"
 	       "In the second variant, this program will extract only ONE component "
 	       "which starts at component_offset in the 1B_file\n\n"
 	       "In the third variant, this program only lists the components inside "
-	       "the 1B file along with their information\n",
+	       "the 1B file along with their information\n\n"
+	       "In the fourth variant, this program writes every present component "
+	       "at its target physical address in output_filename (a sparse memory "
+	       "image) and reports components which overlap in memory\n\n"
+	       "In the fifth variant, this program writes the header, a manifest and "
+	       "all components of each 1B file into the tar archive tar_filename "
+	       "(\"-\" for stdout)\n\n"
+	       "In the sixth variant, this program extracts all components of each "
+	       "1B file into individual files in output_dir/<1B_filename>\n\n"
+	       "The seventh and eighth variants work like the first and second "
+	       "variants, but copy the components in-kernel (reflink or "
+	       "copy_file_range) without reading them into memory\n\n"
+	       "In the ninth variant, this program prints the manifest (components "
+	       "info and SHA-256 digests) of the 1B file\n\n"
+	       "In the tenth variant, this program verifies each 1B file against "
+	       "the manifest, stopping at the first mismatch (or reporting all "
+	       "mismatches with --all). Exit code: 0 match, 1 mismatch, 2 error\n\n"
+	       "In the eleventh variant, this program works like the first variant, "
+	       "but only rewrites the component files which differ from the existing "
+	       "files (a <component>.sha256 sidecar is kept next to each file)\n\n"
+	       "In the twelfth variant, this program stores the 1B files into the "
+	       "pack file pack_filename, identical components are stored once\n\n"
+	       "In the thirteenth variant, this program lists the 1B files in the "
+	       "pack, or the components of 1B_name\n\n"
+	       "In the fourteenth variant, this program writes the 1B file 1B_name "
+	       "in the pack to output_filename\n\n"
+	       "In the fifteenth variant, this program prints the entropy, the "
+	       "longest 0x00/0xFF fill runs and the padding of each component, "
+	       "flags compressed or encrypted components and reports the space "
+	       "for patches in the shadowed BIOS region\n\n"
+	       "In the sixteenth variant, this program searches all components of "
+	       "each 1B file for the patterns (\"text\" or hex bytes, one per "
+	       "line) in pattern_filename in one pass. Exit code: 0 found, "
+	       "1 not found, 2 error\n\n"
+	       "In the seventeenth variant, this program reads physical addresses "
+	       "(hexadecimal, one per line) from stdin and prints the component, "
+	       "the offset in the component and the 1B file offset of each\n\n"
+	       "In the eighteenth variant, this program lists the ACPI tables in "
+	       "the ACPITBL_SEG component\n\n"
+	       "In the nineteenth variant, this program writes the ACPI table "
+	       "table_signature (e.g. DSDT, or SSDT:1 for the second SSDT) to "
+	       "output_filename\n\n"
+	       "In the twentieth variant, this program only checks the header of "
+	       "each 1B file (component count and lengths, overlaps in the file and "
+	       "in memory, file size and component strings) and prints a verdict. "
+	       "Exit code: the verdict of the first bad 1B file (0 if all are "
+	       "OK)\n\n"
+	       "In the twenty-first variant, this program prints the similarity "
+	       "fingerprints (MinHash sketches) of the components of each 1B file, "
+	       "to be saved as the fingerprint file of a corpus\n\n"
+	       "In the twenty-second variant, this program prints the components of "
+	       "the corpus in fingerprint_filename most similar to each component of "
+	       "the 1B file (or to component_name only), with their estimated "
+	       "similarity\n\n"
+	       "In the twenty-third variant, this program prints the components "
+	       "referencing each other through far CALL/JMP instructions (targets "
+	       "resolved by physical address) and, for each component, the "
+	       "components referencing it\n\n"
+	       "With --direct in front of any variant, the 1B files are read "
+	       "bypassing the page cache (O_DIRECT), in a few large aligned reads "
+	       "per 1B file, for scans of large archives\n",
+	       argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+	       argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+	       argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
 	       argv[0], argv[0], argv[0]);
 }
 
@@ -119,8 +844,31 @@ int main(int argc, char *argv[])
  *  	./ami_1B_splitter --extract-all 1B_filename 
  *  	./ami_1B_splitter --extract 	1B_filename  component_offset
  *  	./ami_1B_splitter --list 	1B_filename 
+ *  	./ami_1B_splitter --memory-image 1B_filename  output_filename
+ *  	./ami_1B_splitter --extract-all-tar tar_filename  1B_filename [1B_filename ...]
+ *  	./ami_1B_splitter --extract-all-batch output_dir  1B_filename [1B_filename ...]
+ *  	./ami_1B_splitter --copy-all 	1B_filename 
+ *  	./ami_1B_splitter --copy 	1B_filename  component_offset
+ *  	./ami_1B_splitter --manifest 	1B_filename
+ *  	./ami_1B_splitter --verify [--all] manifest_filename  1B_filename [1B_filename ...]
+ *  	./ami_1B_splitter --extract-changed 1B_filename 
+ *  	./ami_1B_splitter --pack 	pack_filename  1B_filename [1B_filename ...]
+ *  	./ami_1B_splitter --pack-list 	pack_filename [1B_name]
+ *  	./ami_1B_splitter --pack-extract pack_filename  1B_name  output_filename
+ *  	./ami_1B_splitter --stats 	1B_filename
+ *  	./ami_1B_splitter --search 	pattern_filename  1B_filename [1B_filename ...]
+ *  	./ami_1B_splitter --lookup 	1B_filename  < address_list
+ *  	./ami_1B_splitter --acpi-list 	1B_filename
+ *  	./ami_1B_splitter --acpi-extract 1B_filename  table_signature  output_filename
+ *  	./ami_1B_splitter --check 	1B_filename [1B_filename ...]
+ *  	./ami_1B_splitter --fingerprint 1B_filename [1B_filename ...]
+ *  	./ami_1B_splitter --similar 	fingerprint_filename  1B_filename [component_name]
+ *  	./ami_1B_splitter --xref 	1B_filename
+ *  	./ami_1B_splitter --direct 	<variant>
  *
  *  In the first variant, this program will extract all components into individual files. 
+ *  If 1B_filename is -, the 1B file is read from stdin through the push parser and each 
+ *  component is written as soon as its data is complete. 
  *
  *  In the second variant, this program will extract only ONE component which starts at 
  *  component_offset in the 1B_file
@@ -128,11 +876,88 @@ int main(int argc, char *argv[])
  *  In the third variant, this program only lists the components inside the 1B file along with 
  *  their information
  *
+ *  In the fourth variant, this program writes every present component at its target 
+ *  physical address in output_filename and reports components which overlap in memory
+ *
+ *  In the fifth variant, this program writes the header, a manifest and all components of 
+ *  each 1B file into the tar archive tar_filename ("-" for stdout)
+ *
+ *  In the sixth variant, this program extracts all components of each 1B file into 
+ *  individual files in output_dir/<1B_filename>
+ *
+ *  The seventh and eighth variants work like the first and second variants, but copy the 
+ *  components in-kernel (reflink or copy_file_range) without reading them into memory
+ *
+ *  In the ninth variant, this program prints the manifest (components info and SHA-256 
+ *  digests) of the 1B file
+ *
+ *  In the tenth variant, this program verifies each 1B file against the manifest, stopping 
+ *  at the first mismatch (or reporting all mismatches with --all)
+ *
+ *  In the eleventh variant, this program works like the first variant, but only rewrites 
+ *  the component files which differ from the existing files
+ *
+ *  In the twelfth variant, this program stores the 1B files into the pack file pack_filename. 
+ *  Identical headers and components are stored once, an index at the end of the pack gives 
+ *  random access to each 1B file
+ *
+ *  In the thirteenth variant, this program lists the 1B files in the pack, or the components 
+ *  of the 1B file 1B_name, read through a mapping of the pack
+ *
+ *  In the fourteenth variant, this program writes the 1B file 1B_name in the pack to 
+ *  output_filename
+ *
+ *  In the fifteenth variant, this program prints the byte entropy, the longest 0x00/0xFF 
+ *  fill runs and the reclaimable padding of each component, flags compressed or encrypted 
+ *  components and reports the space for patches in the shadowed BIOS region
+ *
+ *  In the sixteenth variant, this program searches all components of each 1B file for all 
+ *  patterns in pattern_filename in one pass and reports the component, offset, file offset 
+ *  and physical address of each hit
+ *
+ *  In the seventeenth variant, this program reads physical addresses from stdin and 
+ *  translates each of them to component, offset in the component and 1B file offset
+ *
+ *  In the eighteenth variant, this program lists the ACPI tables in the ACPITBL_SEG component
+ *
+ *  In the nineteenth variant, this program writes the ACPI table table_signature (e.g. DSDT, 
+ *  or SSDT:1 for the second SSDT) in the ACPITBL_SEG component to output_filename
+ *
+ *  In the twentieth variant, this program triages 1B files by their header alone: the 
+ *  component count and lengths, overlaps in the file and in physical memory, the calculated 
+ *  size against the file size and the component string table. The verdict of each 1B file 
+ *  is printed, the exit code is the verdict of the first bad 1B file 
+ *
+ *  In the twenty-first variant, this program prints the MinHash sketches of the present 
+ *  components of each 1B file (the fingerprint file of a corpus of 1B files)
+ *
+ *  In the twenty-second variant, this program finds the components of the corpus in 
+ *  fingerprint_filename most similar to each component of the 1B file (or to 
+ *  component_name only) through an LSH index, without comparing every component pair
+ *
+ *  In the twenty-third variant, this program scans the code components for far CALL/JMP 
+ *  instructions, resolves their segment:offset targets to components through the physical 
+ *  address index and prints the component to component reference graph, and for each 
+ *  component the components which reference it (affected when it's replaced)
+ *
+ *  With --direct in front of any variant, the 1B files are read bypassing the page cache 
+ *  (O_DIRECT with aligned buffers, or dropping the cached pages where O_DIRECT isn't 
+ *  supported), in as few large aligned reads as possible
+ *
  */
 	off_t component_offset = 0;
 	_1B_DATA_T *p_1b_data;
 	ACTION act;
 
+	// Strip the --direct option, keeping argv[0] for the help text
+	//
+	if ((argc > 1) && (!strcmp(argv[1], "--direct"))) {
+		set_1B_read_mode(READ_DIRECT);
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
+
 	// Parse input parameters
 	//
 	if ((argc == 3) && (!strcmp(argv[1], "--extract-all"))) {
@@ -140,16 +965,153 @@ int main(int argc, char *argv[])
 		printf("argc = 3, --extract-all\n");
 #endif
 		act = EXTRACT_ALL;
+
+		// Stream the 1B file from stdin, nothing to load up front
+		//
+		if (!strcmp(argv[2], "-"))
+			return (write_all_components_from_stdin() ==
+				SUCCESS) ? 0 : 1;
+	} else if ((argc == 3) && (!strcmp(argv[1], "--extract-changed"))) {
+#ifdef DEBUG
+		printf("argc = 3, --extract-changed\n");
+#endif
+		act = EXTRACT_CHANGED;
+	} else if ((argc == 3) && (!strcmp(argv[1], "--copy-all"))) {
+#ifdef DEBUG
+		printf("argc = 3, --copy-all\n");
+#endif
+		act = COPY_ALL;
+	} else if ((argc == 3) && (!strcmp(argv[1], "--stats"))) {
+#ifdef DEBUG
+		printf("argc = 3, --stats\n");
+#endif
+		act = STATS;
+	} else if ((argc == 3) && (!strcmp(argv[1], "--lookup"))) {
+#ifdef DEBUG
+		printf("argc = 3, --lookup\n");
+#endif
+		act = LOOKUP;
+	} else if ((argc == 3) && (!strcmp(argv[1], "--acpi-list"))) {
+#ifdef DEBUG
+		printf("argc = 3, --acpi-list\n");
+#endif
+		act = ACPI_LIST;
+	} else if ((argc == 3) && (!strcmp(argv[1], "--xref"))) {
+#ifdef DEBUG
+		printf("argc = 3, --xref\n");
+#endif
+		act = XREF;
+	} else if ((argc == 5) && (!strcmp(argv[1], "--acpi-extract"))) {
+#ifdef DEBUG
+		printf("argc = 5, --acpi-extract\n");
+#endif
+		act = ACPI_EXTRACT;
+	} else if ((argc == 3) && (!strcmp(argv[1], "--manifest"))) {
+#ifdef DEBUG
+		printf("argc = 3, --manifest\n");
+#endif
+		act = MANIFEST;
+	} else if ((argc >= 5) && (!strcmp(argv[1], "--verify")) &&
+		   (!strcmp(argv[2], "--all"))) {
+#ifdef DEBUG
+		printf("argc >= 5, --verify --all\n");
+#endif
+		return verify_files(argv[3], VERIFY_ALL, argc - 4, &argv[4]);
+	} else if ((argc == 4) && (!strcmp(argv[1], "--verify")) &&
+		   (!strcmp(argv[2], "--all"))) {
+		printf("ERROR: Wrong input parameters!\n");
+		show_help(argv);
+		return VERIFY_EXIT_ERROR;
+	} else if ((argc >= 4) && (!strcmp(argv[1], "--verify"))) {
+#ifdef DEBUG
+		printf("argc >= 4, --verify\n");
+#endif
+		return verify_files(argv[2], VERIFY_FIRST_MISMATCH, argc - 3,
+				    &argv[3]);
 	} else if ((argc == 3) && (!strcmp(argv[1], "--list"))) {
 #ifdef DEBUG
 		printf("argc = 3, --list\n");
 #endif
 		act = LIST;
-	} else if ((argc == 4) && (!strcmp(argv[1], "--extract"))) {
+	} else if ((argc == 4) && (!strcmp(argv[1], "--memory-image"))) {
+#ifdef DEBUG
+		printf("argc = 4, --memory-image\n");
+#endif
+		act = MEMORY_IMAGE;
+	} else if ((argc >= 4) && (!strcmp(argv[1], "--extract-all-tar"))) {
+#ifdef DEBUG
+		printf("argc >= 4, --extract-all-tar\n");
+#endif
+		// Handles any number of 1B files, doesn't share the 
+		// single 1B file path below
+		//
+		if (write_all_components_to_tar(argv[2], argc - 3,
+						&argv[3]) == ERROR)
+			return 1;
+		return 0;
+	} else if ((argc >= 4) && (!strcmp(argv[1], "--extract-all-batch"))) {
+#ifdef DEBUG
+		printf("argc >= 4, --extract-all-batch\n");
+#endif
+		if (write_all_components_to_dir(argv[2], argc - 3,
+						&argv[3]) == ERROR)
+			return 1;
+		return 0;
+	} else if ((argc >= 3) && (!strcmp(argv[1], "--check"))) {
 #ifdef DEBUG
-		printf("argc = 4, --extract\n");
+		printf("argc >= 3, --check\n");
 #endif
-		act = EXTRACT_ONE;
+		return check_files(argc - 2, &argv[2]);
+	} else if ((argc >= 3) && (!strcmp(argv[1], "--fingerprint"))) {
+#ifdef DEBUG
+		printf("argc >= 3, --fingerprint\n");
+#endif
+		if (print_fingerprints(argc - 2, &argv[2]) == ERROR)
+			return 1;
+		return 0;
+	} else if (((argc == 4) || (argc == 5)) &&
+		   (!strcmp(argv[1], "--similar"))) {
+#ifdef DEBUG
+		printf("argc = %d, --similar\n", argc);
+#endif
+		if (find_similar(argv[2], argv[3],
+				 (argc == 5) ? argv[4] : NULL) == ERROR)
+			return 1;
+		return 0;
+	} else if ((argc >= 4) && (!strcmp(argv[1], "--search"))) {
+#ifdef DEBUG
+		printf("argc >= 4, --search\n");
+#endif
+		return search_files(argv[2], argc - 3, &argv[3]);
+	} else if ((argc >= 4) && (!strcmp(argv[1], "--pack"))) {
+#ifdef DEBUG
+		printf("argc >= 4, --pack\n");
+#endif
+		if (write_1B_files_to_pack(argv[2], argc - 3, &argv[3]) ==
+		    ERROR)
+			return 1;
+		return 0;
+	} else if (((argc == 3) || (argc == 4)) &&
+		   (!strcmp(argv[1], "--pack-list"))) {
+#ifdef DEBUG
+		printf("argc = %d, --pack-list\n", argc);
+#endif
+		if (list_pack(argv[2], (argc == 4) ? argv[3] : NULL) == ERROR)
+			return 1;
+		return 0;
+	} else if ((argc == 5) && (!strcmp(argv[1], "--pack-extract"))) {
+#ifdef DEBUG
+		printf("argc = 5, --pack-extract\n");
+#endif
+		if (extract_from_pack(argv[2], argv[3], argv[4]) == ERROR)
+			return 1;
+		return 0;
+	} else if ((argc == 4) && ((!strcmp(argv[1], "--extract")) ||
+				   (!strcmp(argv[1], "--copy")))) {
+#ifdef DEBUG
+		printf("argc = 4, %s\n", argv[1]);
+#endif
+		act = (!strcmp(argv[1], "--copy")) ? COPY_ONE : EXTRACT_ONE;
 		if (sscanf(argv[3], "%lX", &component_offset) == EOF) {
 			printf("component_offset is incorrect\n");
 			return 0;
@@ -168,7 +1130,14 @@ int main(int argc, char *argv[])
 	// fill the 1B data structure with the result of the parsing. 
 	// Then perform the requested action.
 	//
-	p_1b_data = init_1B_data(argv[2]);
+	// The in-kernel copy and the address lookup don't need the 
+	// components data in memory
+	//
+	if ((act == COPY_ALL) || (act == COPY_ONE) || (act == LOOKUP))
+		p_1b_data = init_1B_header(argv[2]);
+	else
+		p_1b_data = init_1B_data(argv[2]);
+
 	if (p_1b_data == NULL) {
 		printf("ERROR: Not enough memory "
 		       "to create 1B data structure!\n");
@@ -178,7 +1147,13 @@ int main(int argc, char *argv[])
 		case EXTRACT_ALL:
 			// Write all components to individual files
 			//
-			write_all_components(p_1b_data);
+			write_all_components(p_1b_data, OUTPUT_ALL);
+			break;
+
+		case EXTRACT_CHANGED:
+			// Only rewrite the component files which changed
+			//
+			write_all_components(p_1b_data, OUTPUT_CHANGED);
 			break;
 
 		case EXTRACT_ONE:
@@ -187,12 +1162,66 @@ int main(int argc, char *argv[])
 			write_one_component(p_1b_data, component_offset);
 			break;
 
+		case MANIFEST:
+			// Print the golden manifest
+			//
+			print_manifest(p_1b_data);
+			break;
+
+		case STATS:
+			// Print the components statistics
+			//
+			print_component_stats(p_1b_data);
+			break;
+
+		case LOOKUP:
+			// Translate physical addresses to components
+			//
+			lookup_addresses(p_1b_data);
+			break;
+
+		case ACPI_LIST:
+			// Display the ACPI tables
+			//
+			list_acpi_tables(p_1b_data);
+			break;
+
+		case XREF:
+			// Display the far call/jump reference graph
+			//
+			print_reference_graph(p_1b_data);
+			break;
+
+		case ACPI_EXTRACT:
+			// Write one ACPI table to file
+			//
+			extract_acpi_table(p_1b_data, argv[3], argv[4]);
+			break;
+
+		case COPY_ALL:
+			// Copy all components to individual files in-kernel
+			//
+			copy_components(p_1b_data, 0);
+			break;
+
+		case COPY_ONE:
+			// Copy only one component to file in-kernel
+			//
+			copy_components(p_1b_data, component_offset);
+			break;
+
 		case LIST:
 			// Display 1B content information
 			//
 			list_components(p_1b_data);
 			break;
 
+		case MEMORY_IMAGE:
+			// Write the relocated memory image
+			//
+			write_memory_image(p_1b_data, argv[3]);
+			break;
+
 		default:
 			printf("ERROR: The input parameter parser "
 			       "is not working correctly\n");
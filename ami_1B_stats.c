@@ -0,0 +1,272 @@
+/*
+ * ami_1B_stats.c
+ *
+ * Per component statistics: byte histogram, Shannon entropy, longest 0x00
+ * and 0xFF fill runs and the padding that could be reclaimed. The kernels
+ * scan the loaded component data a machine word (8 bytes) at a time.
+ *
+ * Components with near random contents are flagged as compressed or
+ * encrypted. The largest fill run of the components which run in the
+ * shadowed legacy BIOS region (0xC0000 - 0xFFFFF, e.g. RUN_CSEG) is
+ * reported as space for patches which doesn't grow the 1B file.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "ami_1B_internal.h"
+
+#define MIN_PADDING_RUN		16	// shortest fill run counted as padding
+
+#define HIGH_ENTROPY		7.5	// entropy (bits per byte) above which the
+					// data is considered compressed or encrypted
+
+#define MIN_ENTROPY_LENGTH	256	// shortest component checked for high entropy
+
+#define SHADOW_REGION_START	0xC0000	// legacy BIOS region shadowed to RAM
+
+#define SHADOW_REGION_END	0x100000
+
+// Fill run (0x00 or 0xFF bytes) in a component
+//
+typedef struct {
+	u32_t offset;
+	u32_t length;
+} FILL_RUN_T;
+
+// Statistics of one component
+//
+typedef struct {
+	u32_t histogram[256];
+	double entropy;		// bits per byte
+	FILL_RUN_T longest_00;	// longest run of 0x00
+	FILL_RUN_T longest_ff;	// longest run of 0xFF
+	u32_t padding;		// bytes in fill runs of at least MIN_PADDING_RUN
+} COMPONENT_STATS_T;
+
+
+static u64_t load_word(const u8_t * p)
+{
+	u64_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+
+/*
+ * Count the bytes of p_buf into histogram. Four sub-histograms are used so
+ * consecutive bytes with the same value don't wait for each other's
+ * counter update.
+ */
+static void count_bytes(const u8_t * p_buf, u32_t len, u32_t * histogram)
+{
+	u32_t count[4][256];
+	u32_t i, j;
+	u64_t w;
+
+	memset(count, 0, sizeof(count));
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		w = load_word(p_buf + i);
+		count[0][w & 0xFF]++;
+		count[1][(w >> 8) & 0xFF]++;
+		count[2][(w >> 16) & 0xFF]++;
+		count[3][(w >> 24) & 0xFF]++;
+		count[0][(w >> 32) & 0xFF]++;
+		count[1][(w >> 40) & 0xFF]++;
+		count[2][(w >> 48) & 0xFF]++;
+		count[3][w >> 56]++;
+	}
+
+	for (; i < len; i++)
+		count[0][p_buf[i]]++;
+
+	for (j = 0; j < 256; j++)
+		histogram[j] = count[0][j] + count[1][j] + count[2][j] +
+		    count[3][j];
+}
+
+
+/*
+ * Find the 0x00 and 0xFF fill runs of p_buf. Words without any 0x00 or
+ * 0xFF byte are skipped, as are words completely inside a run.
+ */
+static void find_fill_runs(const u8_t * p_buf, u32_t len,
+			   COMPONENT_STATS_T * p_stats)
+{
+	FILL_RUN_T *p_longest = NULL;
+	u32_t i = 0, start;
+	u64_t w, fill_word;
+	u8_t fill;
+
+	while (i < len) {
+		// Skip the words which can't start a run
+		//
+		while (i + 8 <= len) {
+			w = load_word(p_buf + i);
+			if (SWAR_HAS_ZERO(w) || SWAR_HAS_ZERO(~w))
+				break;
+			i += 8;
+		}
+
+		while ((i < len) && (p_buf[i] != 0x00) && (p_buf[i] != 0xFF))
+			i++;
+
+		if (i >= len)
+			break;
+
+		start = i;
+		fill = p_buf[i];
+		fill_word = (fill == 0x00) ? 0 : ~0ULL;
+
+		// Extend the run byte by byte up to a word boundary, then a
+		// word at a time
+		//
+		i++;
+		while ((i < len) && (i % 8) && (p_buf[i] == fill))
+			i++;
+		while (((i % 8) == 0) && (i + 8 <= len) &&
+		       (load_word(p_buf + i) == fill_word))
+			i += 8;
+		while ((i < len) && (p_buf[i] == fill))
+			i++;
+
+		p_longest = (fill == 0x00) ? &p_stats->longest_00 :
+		    &p_stats->longest_ff;
+		if (i - start > p_longest->length) {
+			p_longest->offset = start;
+			p_longest->length = i - start;
+		}
+
+		if (i - start >= MIN_PADDING_RUN)
+			p_stats->padding += i - start;
+	}
+}
+
+
+static double calculate_entropy(const u32_t * histogram, u32_t len)
+{
+	double entropy = 0.0, p;
+	u32_t i;
+
+	for (i = 0; i < 256; i++) {
+		if (histogram[i] == 0)
+			continue;
+
+		p = (double) histogram[i] / len;
+		entropy -= p * log2(p);
+	}
+
+	return entropy;
+}
+
+
+/*
+ * Calculate the statistics of component p_component. The component data
+ * must be loaded.
+ */
+static void get_component_stats(_1B_COMPONENT_T * p_component,
+				COMPONENT_STATS_T * p_stats)
+{
+	memset(p_stats, 0, sizeof(COMPONENT_STATS_T));
+
+	count_bytes(p_component->p_buf, p_component->length,
+		    p_stats->histogram);
+	p_stats->entropy = calculate_entropy(p_stats->histogram,
+					     p_component->length);
+	find_fill_runs(p_component->p_buf, p_component->length, p_stats);
+}
+
+
+/*
+ * Print the statistics of the present components of the 1B file, the
+ * total reclaimable padding and the space for patches in the shadowed
+ * BIOS region. The components data must be loaded (see init_1B_data()).
+ *
+ * input:
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS print_component_stats(_1B_DATA_T * p_data)
+{
+	COMPONENT_STATS_T stats;
+	_1B_COMPONENT_T *p_comp = NULL;
+	FILL_RUN_T *p_run = NULL;
+	u64_t total_length = 0, total_padding = 0;
+	u16_t i, high_entropy_count = 0;
+
+	if (p_data == NULL) {
+		printf("ERROR: 1B data structure is NULL\n");
+		return ERROR;
+	}
+
+	printf("Name of 1B file: %s\n", p_data->filename);
+	printf("%-20s %10s %8s %23s %23s %10s\n", "Component", "Length",
+	       "Entropy", "Longest 00 (offset)", "Longest FF (offset)",
+	       "Padding");
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		if (p_comp->p_buf == NULL) {
+			printf("ERROR: function %s() component %s data not "
+			       "loaded\n", __func__, p_comp->name);
+			return ERROR;
+		}
+
+		get_component_stats(p_comp, &stats);
+		total_length += p_comp->length;
+		total_padding += stats.padding;
+
+		printf("%-20s 0x%08X %8.4f 0x%08X (0x%08X) 0x%08X (0x%08X) "
+		       "0x%08X",
+		       p_comp->name, p_comp->length, stats.entropy,
+		       stats.longest_00.length, stats.longest_00.offset,
+		       stats.longest_ff.length, stats.longest_ff.offset,
+		       stats.padding);
+
+		if ((p_comp->length >= MIN_ENTROPY_LENGTH) &&
+		    (stats.entropy > HIGH_ENTROPY)) {
+			printf("  compressed/encrypted");
+			high_entropy_count++;
+		}
+		printf("\n");
+
+		// Space inside code which runs in the shadowed BIOS region
+		//
+		if ((p_comp->physical_address >= SHADOW_REGION_START) &&
+		    (p_comp->physical_address < SHADOW_REGION_END)) {
+			p_run = (stats.longest_00.length >
+				 stats.longest_ff.length) ?
+			    &stats.longest_00 : &stats.longest_ff;
+
+			if (p_run->length >= MIN_PADDING_RUN)
+				printf("%-20s patch space: 0x%X bytes at "
+				       "physical address 0x%X\n", "",
+				       p_run->length,
+				       p_comp->physical_address +
+				       p_run->offset);
+		}
+	}
+
+	printf("Total component data: 0x%llX bytes, reclaimable padding: "
+	       "0x%llX bytes", total_length, total_padding);
+	if (total_length > 0)
+		printf(" (%.1f%%)", total_padding * 100.0 / total_length);
+	printf("\n");
+	printf("Compressed/encrypted components: 0x%X\n", high_entropy_count);
+
+	return SUCCESS;
+}
@@ -0,0 +1,336 @@
+/*
+ * ami_1B_tar.c
+ *
+ * Write the header and the components of one or more 1B files into a
+ * single (POSIX ustar) tar archive, instead of one file per component.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>			/** Required for _setmode() */
+#endif
+
+#include "ami_1B_internal.h"
+
+#define TAR_BLOCK_SIZE		512	// tar archive block size in bytes
+
+#define TAR_NAME_LENGTH		100	// size of the name field of the tar header
+
+#define TAR_PREFIX_LENGTH	155	// size of the prefix field of the tar header
+
+// POSIX ustar header block
+//
+typedef struct {
+	char name[TAR_NAME_LENGTH];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[TAR_PREFIX_LENGTH];
+	char pad[12];
+} TAR_HEADER_T;
+
+struct _1B_TAR_S {
+
+	FILE *f_out;		// the tar archive output file (may be stdout)
+
+	u32_t entry_count;	// number of entries written to the archive
+
+};
+
+
+/*
+ * Split path into the name and prefix fields of the tar header
+ *
+ * input:
+ * 	p_hdr	pointer to the tar header to fill
+ * 	path	path of the archive entry
+ *
+ * return value:
+ * 	ERROR 	if the path doesn't fit into the tar header
+ * 	SUCCESS	on success
+ */
+static STATUS set_tar_entry_path(TAR_HEADER_T * p_hdr, const char *path)
+{
+	size_t len;
+	const char *p_split = NULL;
+
+	len = strlen(path);
+	if (len <= TAR_NAME_LENGTH) {
+		memcpy(p_hdr->name, path, len);
+		return SUCCESS;
+	}
+	// Split at the last '/' which leaves a short enough name
+	//
+	for (p_split = path + len - 1; p_split > path; p_split--) {
+		if ((*p_split == '/') &&
+		    ((size_t) (path + len - p_split - 1) <= TAR_NAME_LENGTH))
+			break;
+	}
+
+	if ((p_split == path) ||
+	    ((size_t) (p_split - path) > TAR_PREFIX_LENGTH)) {
+		printf("ERROR: function %s() path %s is too long\n",
+		       __func__, path);
+		return ERROR;
+	}
+
+	memcpy(p_hdr->prefix, path, p_split - path);
+	memcpy(p_hdr->name, p_split + 1, path + len - p_split - 1);
+	return SUCCESS;
+}
+
+
+/*
+ * Write one regular file entry (header block, data and padding) to the
+ * tar archive. The data is written straight from p_buf.
+ *
+ * input:
+ * 	p_tar	pointer to the tar archive
+ * 	path	path of the entry inside the archive
+ * 	p_buf	pointer to the entry contents
+ * 	len	length of the entry contents in bytes
+ * 	mtime	modification time of the entry
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS write_tar_entry(_1B_TAR_T * p_tar, const char *path,
+			      void *p_buf, u32_t len, time_t mtime)
+{
+	TAR_HEADER_T hdr;
+	u8_t pad[TAR_BLOCK_SIZE];
+	u32_t i, checksum = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (set_tar_entry_path(&hdr, path) == ERROR)
+		return ERROR;
+
+	snprintf(hdr.mode, sizeof(hdr.mode), "%07o", 0644);
+	snprintf(hdr.uid, sizeof(hdr.uid), "%07o", 0);
+	snprintf(hdr.gid, sizeof(hdr.gid), "%07o", 0);
+	snprintf(hdr.size, sizeof(hdr.size), "%011o", len);
+	snprintf(hdr.mtime, sizeof(hdr.mtime), "%011lo",
+		 (unsigned long) mtime);
+	hdr.typeflag = '0';
+	memcpy(hdr.magic, "ustar", 6);
+	memcpy(hdr.version, "00", 2);
+
+	// The checksum is calculated with the checksum field set to spaces
+	//
+	memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+	for (i = 0; i < sizeof(hdr); i++)
+		checksum += ((u8_t *) & hdr)[i];
+	snprintf(hdr.chksum, sizeof(hdr.chksum), "%06o", checksum);
+
+	if (write_buffer_to_file(p_tar->f_out, &hdr, sizeof(hdr)) == ERROR) {
+		printf("ERROR: function %s() unable to write tar header of "
+		       "%s\n", __func__, path);
+		return ERROR;
+	}
+
+	if (len == 0)
+		return SUCCESS;
+
+	if (write_buffer_to_file(p_tar->f_out, p_buf, len) == ERROR) {
+		printf("ERROR: function %s() unable to write tar entry "
+		       "%s\n", __func__, path);
+		return ERROR;
+	}
+	// Pad the entry to the next block boundary
+	//
+	if ((len % TAR_BLOCK_SIZE) != 0) {
+		memset(pad, 0, sizeof(pad));
+		if (write_buffer_to_file(p_tar->f_out, pad,
+					 TAR_BLOCK_SIZE -
+					 (len % TAR_BLOCK_SIZE)) == ERROR) {
+			printf("ERROR: function %s() unable to pad tar entry "
+			       "%s\n", __func__, path);
+			return ERROR;
+		}
+	}
+
+	p_tar->entry_count++;
+	return SUCCESS;
+}
+
+
+/*
+ * Open a tar archive for writing.
+ *
+ * NOTE: You must call close_1B_tar() to finish the archive.
+ *
+ * input:
+ * 	filename	name of the tar archive, "-" writes to stdout
+ *
+ * return value:
+ * 	NULL 				on error
+ * 	pointer to _1B_TAR_T 		on success
+ */
+_1B_TAR_T *init_1B_tar(const char *filename)
+{
+	_1B_TAR_T *p_tar = NULL;
+
+	if (filename == NULL) {
+		printf("ERROR: function %s() invalid filename\n", __func__);
+		return NULL;
+	}
+
+	p_tar = (_1B_TAR_T *) malloc(sizeof(_1B_TAR_T));
+	if (p_tar == NULL) {
+		printf("ERROR: unable to allocate memory for tar archive\n");
+		return NULL;
+	}
+	p_tar->entry_count = 0;
+
+	if (!strcmp(filename, "-")) {
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		p_tar->f_out = stdout;
+	} else {
+		p_tar->f_out = fopen(filename, "wb");
+	}
+
+	if (p_tar->f_out == NULL) {
+		printf("ERROR: function %s() unable to open %s for "
+		       "writing\n", __func__, filename);
+		free(p_tar);
+		return NULL;
+	}
+
+	return p_tar;
+}
+
+
+/*
+ * Write the header, a generated manifest and all present components of the
+ * 1B file to the tar archive. The entries are placed in a directory named
+ * after the 1B file:
+ *
+ * 	<1B_basename>/MANIFEST
+ * 	<1B_basename>/_1B_header
+ * 	<1B_basename>/<component_name>
+ *
+ * input:
+ * 	p_tar	pointer to the tar archive
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS write_1B_data_to_tar(_1B_TAR_T * p_tar, _1B_DATA_T * p_data)
+{
+	char path[MAX_PATH + MAX_COMPONENT_NAME];
+	const char *p_base = NULL;
+	char *p_manifest = NULL;
+	u32_t manifest_len = 0;
+	u16_t i;
+	time_t mtime;
+	struct stat f_stat;
+	_1B_COMPONENT_T *p_comp = NULL;
+
+	if ((p_tar == NULL) || (p_data == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	p_base = strrchr(p_data->filename, '/');
+	p_base = (p_base == NULL) ? p_data->filename : p_base + 1;
+
+	mtime = (stat(p_data->filename, &f_stat) == 0) ?
+	    f_stat.st_mtime : time(NULL);
+
+	p_manifest = create_1B_manifest(p_data, &manifest_len);
+	if (p_manifest == NULL)
+		return ERROR;
+
+	snprintf(path, sizeof(path), "%s/MANIFEST", p_base);
+	if (write_tar_entry(p_tar, path, p_manifest, manifest_len, mtime) ==
+	    ERROR) {
+		free(p_manifest);
+		return ERROR;
+	}
+	free(p_manifest);
+
+	snprintf(path, sizeof(path), "%s/_1B_header", p_base);
+	if (write_tar_entry(p_tar, path, p_data->header.p_buf,
+			    p_data->header.length, mtime) == ERROR)
+		return ERROR;
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+
+		if (p_comp->data_presence != DATA_PRESENT)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", p_base, p_comp->name);
+		if (write_tar_entry(p_tar, path, p_comp->p_buf,
+				    p_comp->length, mtime) == ERROR)
+			return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Finish the tar archive (write the end of archive marker) and close it.
+ *
+ * input:
+ * 	p_tar	pointer to the tar archive
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS close_1B_tar(_1B_TAR_T * p_tar)
+{
+	u8_t end_marker[2 * TAR_BLOCK_SIZE];
+	STATUS status;
+
+	if (p_tar == NULL)
+		return ERROR;
+
+	memset(end_marker, 0, sizeof(end_marker));
+	status = write_buffer_to_file(p_tar->f_out, end_marker,
+				      sizeof(end_marker));
+
+	if (p_tar->f_out == stdout) {
+		if (fflush(stdout) != 0)
+			status = ERROR;
+	} else if (fclose(p_tar->f_out) != 0) {
+		status = ERROR;
+	}
+
+	if (status == ERROR)
+		printf("ERROR: function %s() unable to finish tar "
+		       "archive\n", __func__);
+
+	free(p_tar);
+	return status;
+}
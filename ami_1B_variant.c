@@ -0,0 +1,249 @@
+/*
+ * ami_1B_variant.c
+ *
+ * Copy-on-write variants of one base 1B file, e.g. one 1B file per board
+ * SKU which differ from the base only in a few components. A variant is a
+ * clone of the base 1B data sharing the component buffers of the base; a
+ * shared buffer is only copied when the component is patched, replacing a
+ * component just drops the reference. Each variant file starts as an
+ * in-kernel copy (reflink where supported) of the base 1B file and only the
+ * components which differ from the base are written to it, so writing a
+ * variant costs about the size of its differences. The variants are written
+ * concurrently.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ami_1B_internal.h"
+
+// State shared by the writing threads
+//
+typedef struct {
+	_1B_DATA_T **p_variants;
+	const char **filenames;
+
+	pthread_mutex_t lock;	// protects the member below
+	u32_t failed;		// number of variants which couldn't be written
+} VARIANT_JOB_T;
+
+
+/*
+ * Create a copy-on-write clone of the 1B data. The clone shares the
+ * component buffers with p_data (and with the other clones of p_data), only
+ * the header is copied. Modifying a component of the clone with the library
+ * functions (replace_component_data(), patch_component_data(), ..) leaves
+ * p_data and the other clones untouched. The clone still refers to the 1B
+ * file of p_data until it is written.
+ *
+ * NOTE: The components data of p_data must be loaded (see init_1B_data()).
+ * 	 Don't clone the same 1B data from several threads at once. You must
+ * 	 call cleanup_1B_data() on the clone when you're finished using it,
+ * 	 p_data may be cleaned up before its clones.
+ *
+ * input:
+ * 	p_data	pointer to the 1B data to be cloned
+ *
+ * return value:
+ * 	NULL			on error
+ * 	pointer to the clone	on success
+ */
+_1B_DATA_T *clone_1B_data(_1B_DATA_T * p_data)
+{
+	_1B_DATA_T *p_clone = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	void *p_header = NULL;
+	u16_t i;
+
+	if ((p_data == NULL) || (p_data->header.p_buf == NULL)) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return NULL;
+	}
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->data_presence == DATA_PRESENT) &&
+		    (p_comp->length > 0) && (p_comp->p_buf == NULL)) {
+			printf("ERROR: function %s() data of component %s is "
+			       "not loaded\n", __func__, p_comp->name);
+			return NULL;
+		}
+	}
+
+	p_clone = (_1B_DATA_T *) malloc(sizeof(_1B_DATA_T));
+	p_header = malloc(p_data->header.length);
+	if ((p_clone == NULL) || (p_header == NULL)) {
+		printf("ERROR: function %s() unable to allocate memory\n",
+		       __func__);
+		free(p_clone);
+		free(p_header);
+		return NULL;
+	}
+
+	// Turn the buffers owned by p_data into shared buffers on the first
+	// clone
+	//
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->p_buf == NULL) ||
+		    (p_comp->buf_type != BUFFER_ALLOCATED))
+			continue;
+
+		p_comp->p_refcount = (u32_t *) malloc(sizeof(u32_t));
+		if (p_comp->p_refcount == NULL) {
+			printf("ERROR: function %s() unable to allocate "
+			       "memory\n", __func__);
+			free(p_clone);
+			free(p_header);
+			return NULL;
+		}
+		*(p_comp->p_refcount) = 1;
+		p_comp->buf_type = BUFFER_SHARED;
+	}
+
+	memcpy(p_clone, p_data, sizeof(_1B_DATA_T));
+	memcpy(p_header, p_data->header.p_buf, p_data->header.length);
+	p_clone->header.p_buf = p_header;
+	p_clone->written_filename[0] = '\0';
+
+	for (i = 0; i < p_clone->header.component_info_count; i++) {
+		p_comp = &(p_clone->component[i]);
+		if ((p_comp->p_buf != NULL) &&
+		    (p_comp->buf_type == BUFFER_SHARED))
+			__atomic_add_fetch(p_comp->p_refcount, 1,
+					   __ATOMIC_RELAXED);
+	}
+
+	return p_clone;
+}
+
+
+/*
+ * Write the 1B data to file filename. The 1B file the data refers to is
+ * copied in-kernel and only the components which differ from it are
+ * written. Falls back to writing the whole 1B file if the 1B file changed
+ * on disk or couldn't be copied. Afterwards the 1B data refers to filename.
+ *
+ * return value:
+ * 	ERROR 	on error, e.g. if filename is the 1B file the data refers to
+ * 	SUCCESS	on success
+ */
+STATUS write_1B_data_to_copy(_1B_DATA_T * p_data, const char *filename)
+{
+	char base_filename[MAX_PATH];
+	struct stat f_stat, out_stat;
+
+	// The base 1B file would be truncated while it's the source of the
+	// copy (and of the other variants)
+	//
+	if ((stat(filename, &out_stat) == 0) &&
+	    (stat(p_data->filename, &f_stat) == 0) &&
+	    (out_stat.st_dev == f_stat.st_dev) &&
+	    (out_stat.st_ino == f_stat.st_ino)) {
+		printf("ERROR: function %s() %s is the 1B file %s\n", __func__,
+		       filename, p_data->filename);
+		return ERROR;
+	}
+
+	if ((strlen(filename) >= MAX_PATH) ||
+	    (stat(p_data->filename, &f_stat) != 0) ||
+	    (f_stat.st_size != p_data->size) ||
+	    (copy_file_data(p_data->filename, filename,
+			    (u32_t) p_data->size) == ERROR))
+		return write_1B_data_to_file(p_data, filename);
+
+	// The copy is now the 1B file on disk of the 1B data
+	//
+	strcpy(base_filename, p_data->filename);
+	strcpy(p_data->filename, filename);
+
+	if (update_1B_file(p_data) == ERROR) {
+		strcpy(p_data->filename, base_filename);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Work item of the worker pool: writes variant index
+ */
+static void variant_work(void *p_context, u32_t index)
+{
+	VARIANT_JOB_T *p_job = (VARIANT_JOB_T *) p_context;
+
+	if (write_1B_data_to_copy(p_job->p_variants[index],
+				  p_job->filenames[index]) == SUCCESS)
+		return;
+
+	pthread_mutex_lock(&p_job->lock);
+	p_job->failed++;
+	printf("ERROR: Unable to write variant %s\n", p_job->filenames[index]);
+	pthread_mutex_unlock(&p_job->lock);
+}
+
+
+/*
+ * Write the variants (clones of one base 1B data, see clone_1B_data()) to
+ * their files concurrently. Each file starts as an in-kernel copy of the
+ * base 1B file, then the components which differ from it are written. The
+ * digests of the written data are computed as in write_1B_data_to_file(),
+ * so each variant can be checked with verify_1B_output(). After writing, a
+ * variant refers to its own file, as if it had been read from it.
+ *
+ * input:
+ * 	p_variants	the variants to be written
+ * 	filenames	output filename of each variant
+ * 	count		number of variants
+ *
+ * return value:
+ * 	ERROR 	on error (if any variant couldn't be written)
+ * 	SUCCESS	on success
+ */
+STATUS write_1B_variants(_1B_DATA_T * p_variants[], const char *filenames[],
+			 u32_t count)
+{
+	VARIANT_JOB_T job;
+	u32_t i;
+
+	if ((p_variants == NULL) || (filenames == NULL)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return ERROR;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((p_variants[i] == NULL) || (filenames[i] == NULL)) {
+			printf("ERROR: function %s() invalid variant %u\n",
+			       __func__, i);
+			return ERROR;
+		}
+	}
+
+	job.p_variants = p_variants;
+	job.filenames = filenames;
+	job.failed = 0;
+	pthread_mutex_init(&job.lock, NULL);
+
+	run_worker_pool(count, variant_work, &job);
+
+	pthread_mutex_destroy(&job.lock);
+
+	if (job.failed > 0) {
+		printf("ERROR: %u of %u variants not written\n", job.failed,
+		       count);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
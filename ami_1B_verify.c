@@ -0,0 +1,239 @@
+/*
+ * ami_1B_verify.c
+ *
+ * Verification of a written 1B file against the SHA-256 digests of the
+ * header and components computed while they were written (see
+ * write_1B_data_to_file()). The file is read back once, sequentially and
+ * bypassing the page cache, so the data compared is the data which reached
+ * the disk rather than the copy the kernel still holds in memory. On Linux
+ * the file is read with O_DIRECT; on filesystems without O_DIRECT support
+ * the file is flushed and its cached pages are dropped before reading it.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ami_1B_internal.h"
+
+#define VERIFY_BUFFER_SIZE	(1024 * 1024)	// bytes read at a time
+
+// Part of the 1B file with a known digest
+//
+typedef struct {
+	off_t length;
+	const u8_t *p_digest;	// digest computed while writing
+	_1B_COMPONENT_T *p_component;	// NULL for the header
+} VERIFY_REGION_T;
+
+
+/*
+ * Read the 1B file once and compare the digest of each region with the
+ * digest computed while writing it.
+ *
+ * return value:
+ * 	ERROR		on read error, or EINVAL on the first O_DIRECT read
+ * 			(errno is set, the caller retries without O_DIRECT)
+ * 	MISMATCH	if any region doesn't match
+ * 	SUCCESS		if all regions match
+ */
+static STATUS verify_regions(int fd, const char *filename,
+			     VERIFY_REGION_T * p_region, u32_t count,
+			     u8_t * p_buf, int direct)
+{
+	SHA256_CTX_T ctx;
+	u8_t digest[SHA256_DIGEST_LENGTH];
+	STATUS status = SUCCESS;
+	off_t file_offset = 0, region_done = 0;
+	ssize_t read_size, pos, chunk;
+	u32_t r = 0;
+
+	sha256_init(&ctx);
+
+	while (r < count) {
+		read_size = read(fd, p_buf, VERIFY_BUFFER_SIZE);
+		if (read_size < 0) {
+			if (direct && (errno == EINVAL) &&
+			    (file_offset == 0))
+				return ERROR;
+
+			printf("ERROR: function %s() unable to read %s at "
+			       "offset 0x%lX\n", __func__, filename,
+			       file_offset);
+			errno = 0;
+			return ERROR;
+		}
+
+		if (read_size == 0) {
+			printf("ERROR: function %s() %s is shorter than "
+			       "written\n", __func__, filename);
+			return MISMATCH;
+		}
+
+		// Feed the chunk to the regions it covers
+		//
+		for (pos = 0; (pos < read_size) && (r < count); pos += chunk) {
+			chunk = read_size - pos;
+			if (chunk > p_region[r].length - region_done)
+				chunk = p_region[r].length - region_done;
+
+			sha256_update(&ctx, p_buf + pos, chunk);
+			region_done += chunk;
+
+			if (region_done < p_region[r].length)
+				continue;
+
+			sha256_final(&ctx, digest);
+			if (memcmp(digest, p_region[r].p_digest,
+				   SHA256_DIGEST_LENGTH) != 0) {
+				if (p_region[r].p_component == NULL)
+					printf("ERROR: header of %s doesn't "
+					       "match the written data\n",
+					       filename);
+				else
+					printf("ERROR: component %s of %s "
+					       "doesn't match the written "
+					       "data\n",
+					       p_region[r].p_component->name,
+					       filename);
+				status = MISMATCH;
+			}
+
+			sha256_init(&ctx);
+			region_done = 0;
+			r++;
+		}
+
+		file_offset += read_size;
+	}
+
+	return status;
+}
+
+
+/*
+ * Verify the 1B file written by the last successful call of
+ * write_1B_data_to_file() on p_data. The file is read back bypassing the
+ * page cache and the SHA-256 digests of the header and each present
+ * component are compared with the digests computed while writing them.
+ * Every mismatching part of the file is reported.
+ *
+ * input:
+ * 	p_data	pointer to the 1B data structure which was written
+ *
+ * return value:
+ * 	ERROR		on error (including when p_data wasn't written)
+ * 	MISMATCH	if the file doesn't match the written data
+ * 	SUCCESS		if the file matches the written data
+ */
+STATUS verify_1B_output(_1B_DATA_T * p_data)
+{
+	VERIFY_REGION_T *p_region = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	struct stat f_stat;
+	const char *filename;
+	u8_t *p_buf = NULL;
+	u32_t count = 0, i;
+	int fd, direct;
+	STATUS status;
+
+	if (p_data == NULL) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return ERROR;
+	}
+
+	filename = p_data->written_filename;
+	if (filename[0] == '\0') {
+		printf("ERROR: function %s() the 1B data wasn't written to "
+		       "a file\n", __func__);
+		return ERROR;
+	}
+
+	p_region = (VERIFY_REGION_T *)
+	    malloc((p_data->header.component_info_count + 1) *
+		   sizeof(VERIFY_REGION_T));
+	p_buf = (u8_t *) alloc_aligned_buffer(VERIFY_BUFFER_SIZE);
+	if ((p_region == NULL) || (p_buf == NULL)) {
+		printf("ERROR: function %s() unable to allocate memory\n",
+		       __func__);
+		free(p_region);
+		free(p_buf);
+		return ERROR;
+	}
+
+	// The header, then the present components in the order of the header
+	// entries
+	//
+	p_region[count].length = p_data->header.length;
+	p_region[count].p_digest = p_data->written_header_digest;
+	p_region[count].p_component = NULL;
+	count++;
+
+	for (i = 0; i < p_data->header.component_info_count; i++) {
+		p_comp = &(p_data->component[i]);
+		if ((p_comp->data_presence != DATA_PRESENT) ||
+		    (p_comp->length == 0))
+			continue;
+
+		p_region[count].length = p_comp->length;
+		p_region[count].p_digest = p_comp->written_digest;
+		p_region[count].p_component = p_comp;
+		count++;
+	}
+
+	printf("%s: Verifying %s ..\n", __func__, filename);
+
+	fd = open_uncached_file(filename, 1, &direct);
+	if (fd < 0) {
+		printf("ERROR: function %s() unable to open %s\n", __func__,
+		       filename);
+		free(p_region);
+		free(p_buf);
+		return ERROR;
+	}
+
+	if ((fstat(fd, &f_stat) == 0) &&
+	    (f_stat.st_size != p_data->calculated_size)) {
+		printf("ERROR: size of %s is 0x%lX bytes, 0x%lX bytes were "
+		       "written\n", filename, (off_t) f_stat.st_size,
+		       p_data->calculated_size);
+		status = MISMATCH;
+	} else {
+		status = verify_regions(fd, filename, p_region, count, p_buf,
+					direct);
+
+		// The filesystem accepted O_DIRECT on open but not on read
+		//
+		if ((status == ERROR) && direct && (errno == EINVAL)) {
+			close(fd);
+			fd = open_uncached_file(filename, 0, &direct);
+			if (fd < 0) {
+				printf("ERROR: function %s() unable to "
+				       "open %s\n", __func__, filename);
+			} else {
+				status = verify_regions(fd, filename,
+							p_region, count,
+							p_buf, direct);
+			}
+		}
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(p_region);
+	free(p_buf);
+
+	if (status == SUCCESS)
+		printf("%s: %s matches the written data (%s read)\n",
+		       __func__, filename, direct ? "direct" : "uncached");
+
+	return status;
+}
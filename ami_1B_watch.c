@@ -0,0 +1,292 @@
+/*
+ * ami_1B_watch.c
+ *
+ * Watch the directory of extracted component files (as written by
+ * ami_1b_splitter --extract-all) and re-insert the components whose files
+ * change into the resident 1B data. The 1B file is parsed once; after each
+ * change only the changed components are replaced, so the 1B file can be
+ * rewritten incrementally right away (see write_1B_data_to_file()). On
+ * Linux the directory is watched with inotify; a burst of events (e.g. an
+ * editor saving through a temporary file) is coalesced into one update.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "ami_1B_internal.h"
+
+#define WATCH_SETTLE_TIME	20	// milliseconds without events which end
+					// a burst of events
+
+#define WATCH_EVENT_BUFFER_SIZE	4096	// size of the inotify event buffer
+
+struct _1B_WATCH_S {
+
+	_1B_DATA_T *p_data;	// the resident 1B data
+
+	char component_dir[MAX_PATH];	// watched directory
+
+	int fd;			// inotify file descriptor
+
+	u8_t changed[MAX_COMPONENT];	// components with changed files
+
+};
+
+
+/*
+ * Start watching the component files in component_dir for the components
+ * of p_data.
+ *
+ * NOTE: You must call cleanup_1B_watch() when you're finished watching,
+ * 	 p_data must stay valid until then.
+ *
+ * input:
+ * 	p_data		pointer to initialized _1B_DATA_T (with components data)
+ * 	component_dir	directory with one file per component, named after
+ * 			the component
+ *
+ * return value:
+ * 	NULL 			on error (or if not supported on this platform)
+ * 	pointer to _1B_WATCH_T	on success
+ */
+_1B_WATCH_T *init_1B_watch(_1B_DATA_T * p_data, const char *component_dir)
+{
+#ifdef __linux__
+	_1B_WATCH_T *p_watch = NULL;
+
+	if ((p_data == NULL) || (component_dir == NULL) ||
+	    (strlen(component_dir) >= MAX_PATH)) {
+		printf("ERROR: function %s() invalid input parameter(s)\n",
+		       __func__);
+		return NULL;
+	}
+
+	p_watch = (_1B_WATCH_T *) malloc(sizeof(_1B_WATCH_T));
+	if (p_watch == NULL) {
+		printf("ERROR: function %s() unable to allocate memory\n",
+		       __func__);
+		return NULL;
+	}
+
+	p_watch->fd = inotify_init1(IN_CLOEXEC);
+	if (p_watch->fd < 0) {
+		printf("ERROR: function %s() unable to initialize inotify\n",
+		       __func__);
+		free(p_watch);
+		return NULL;
+	}
+
+	// Files written in place and files renamed into the directory
+	//
+	if (inotify_add_watch(p_watch->fd, component_dir,
+			      IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf("ERROR: function %s() unable to watch %s\n", __func__,
+		       component_dir);
+		close(p_watch->fd);
+		free(p_watch);
+		return NULL;
+	}
+
+	p_watch->p_data = p_data;
+	strcpy(p_watch->component_dir, component_dir);
+	memset(p_watch->changed, 0, sizeof(p_watch->changed));
+
+	return p_watch;
+#else
+	printf("ERROR: function %s() watching is not supported on this "
+	       "platform\n", __func__);
+	return NULL;
+#endif
+}
+
+
+#ifdef __linux__
+/*
+ * Read the pending inotify events and mark the components whose files
+ * changed
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS read_watch_events(_1B_WATCH_T * p_watch)
+{
+	u8_t buf[WATCH_EVENT_BUFFER_SIZE]
+	    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *p_event = NULL;
+	_1B_DATA_T *p_data = p_watch->p_data;
+	ssize_t len, pos;
+	u16_t i;
+
+	len = read(p_watch->fd, buf, sizeof(buf));
+	if (len < 0) {
+		if (errno == EINTR)
+			return SUCCESS;
+		printf("ERROR: function %s() unable to read inotify events\n",
+		       __func__);
+		return ERROR;
+	}
+
+	for (pos = 0; pos < len;
+	     pos += sizeof(struct inotify_event) + p_event->len) {
+		p_event = (const struct inotify_event *) (buf + pos);
+		if (p_event->len == 0)
+			continue;
+
+		for (i = 0; i < p_data->header.component_info_count; i++) {
+			if ((p_data->component[i].data_presence ==
+			     DATA_PRESENT) &&
+			    (!strcmp(p_data->component[i].name,
+				     p_event->name)))
+				p_watch->changed[i] = 1;
+		}
+	}
+
+	return SUCCESS;
+}
+
+
+/*
+ * Replace the component with the contents of its file if they differ
+ *
+ * output:
+ * 	p_replaced	non-zero if the component was replaced
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+static STATUS reinsert_component(_1B_WATCH_T * p_watch,
+				 _1B_COMPONENT_T * p_comp, int *p_replaced)
+{
+	char path[MAX_PATH * 2];
+	struct stat f_stat;
+	void *p_buf = NULL;
+
+	*p_replaced = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", p_watch->component_dir,
+		 p_comp->name);
+
+	if ((stat(path, &f_stat) != 0) || (f_stat.st_size == 0)) {
+		printf("ERROR: Unable to read component file %s\n", path);
+		return ERROR;
+	}
+
+	p_buf = init_file_chunk_buffer(path, 0, f_stat.st_size);
+	if (p_buf == NULL)
+		return ERROR;
+
+	// Saving a file without changes doesn't modify the 1B file
+	//
+	if ((f_stat.st_size == p_comp->length) &&
+	    (!memcmp(p_buf, p_comp->p_buf, p_comp->length))) {
+		free(p_buf);
+		return SUCCESS;
+	}
+
+	if (replace_component_data_from_buffer(p_watch->p_data, p_comp,
+					       p_buf, f_stat.st_size,
+					       BUFFER_TAKE) == ERROR) {
+		free(p_buf);
+		return ERROR;
+	}
+
+	printf("%s: Re-inserted component %s (0x%X bytes)\n", __func__,
+	       p_comp->name, p_comp->length);
+	*p_replaced = 1;
+	return SUCCESS;
+}
+#endif
+
+
+/*
+ * Wait until component files change and replace the changed components in
+ * the 1B data. Returns after a burst of changes with at least one component
+ * replaced; files which changed without changing their contents are
+ * ignored. The caller writes the 1B data afterwards.
+ *
+ * input:
+ * 	p_watch	pointer to _1B_WATCH_T created by init_1B_watch()
+ *
+ * return value:
+ * 	ERROR 				on error
+ * 	number of replaced components	on success
+ */
+s32_t wait_1B_watch(_1B_WATCH_T * p_watch)
+{
+#ifdef __linux__
+	struct pollfd pfd;
+	_1B_DATA_T *p_data = NULL;
+	s32_t replaced = 0;
+	int component_replaced;
+	u16_t i;
+
+	if (p_watch == NULL) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return ERROR;
+	}
+	p_data = p_watch->p_data;
+
+	pfd.fd = p_watch->fd;
+	pfd.events = POLLIN;
+
+	while (replaced == 0) {
+		// Block until the first event, then collect the rest of the
+		// burst
+		//
+		if (read_watch_events(p_watch) == ERROR)
+			return ERROR;
+
+		while (poll(&pfd, 1, WATCH_SETTLE_TIME) > 0) {
+			if (read_watch_events(p_watch) == ERROR)
+				return ERROR;
+		}
+
+		for (i = 0; i < p_data->header.component_info_count; i++) {
+			if (!p_watch->changed[i])
+				continue;
+			p_watch->changed[i] = 0;
+
+			// A component file which can't be read (e.g. removed
+			// right after the event) is skipped
+			//
+			if ((reinsert_component(p_watch,
+						&(p_data->component[i]),
+						&component_replaced) ==
+			     SUCCESS) && component_replaced)
+				replaced++;
+		}
+	}
+
+	return replaced;
+#else
+	return ERROR;
+#endif
+}
+
+
+void cleanup_1B_watch(_1B_WATCH_T * p_watch)
+{
+	if (p_watch == NULL)
+		return;
+
+#ifdef __linux__
+	close(p_watch->fd);
+#endif
+	free(p_watch);
+}
@@ -0,0 +1,221 @@
+/*
+ * ami_1B_xref.c
+ *
+ * Inter-component reference graph. Every component has a known target
+ * physical address, so a real mode far CALL (9A) or far JMP (EA) with an
+ * immediate segment:offset pointer which lands in the physical address
+ * range of another component is a reference from one component to the
+ * other. The code components (*CSEG, or all components if the header has
+ * no component names) are scanned for the two opcodes, the far pointers are
+ * resolved to code components (present or not) through the physical
+ * address index (see ami_1B_address.c) and the references are printed as a
+ * component to component graph, followed by the components which reference
+ * each component, i.e. the components affected when it's replaced.
+ *
+ * The scan is static: opcode bytes inside data or inside other
+ * instructions can produce false references.
+ *
+ * Copyright (C) 2010 Darmawan Salihun <darmawan_salihun@yahoo.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ami_1B_internal.h"
+
+#define OPCODE_CALL_FAR		0x9A	// CALL ptr16:16
+#define OPCODE_JMP_FAR		0xEA	// JMP ptr16:16
+
+#define FAR_BRANCH_LENGTH	5	// opcode, offset, segment
+
+#define CODE_COMPONENT_MARKER	"CSEG"	// in the name of code components
+
+// References from one component to another
+//
+typedef struct {
+	u32_t calls;
+	u32_t jumps;
+} XREF_COUNT_T;
+
+
+/*
+ * Check whether the component holds code, judging by its name
+ */
+static int is_code_component(_1B_DATA_T * p_data, _1B_COMPONENT_T * p_comp)
+{
+	if (p_data->header.string_status != STRING_PRESENT)
+		return 1;
+
+	return strstr(p_comp->name, CODE_COMPONENT_MARKER) != NULL;
+}
+
+
+/*
+ * Scan the component for far CALL/JMP instructions and count the
+ * components their targets land in
+ *
+ * input:
+ * 	p_index		physical address index of the 1B data
+ * 	source		position of the component
+ *
+ * output:
+ * 	p_count		references from the component to each component
+ * 			(MAX_COMPONENT entries)
+ */
+static void scan_component(_1B_DATA_T * p_data, _1B_ADDRESS_INDEX_T * p_index,
+			   u16_t source, XREF_COUNT_T * p_count)
+{
+	_1B_COMPONENT_T *p_target[MAX_COMPONENT];
+	_1B_COMPONENT_T *p_comp = &(p_data->component[source]);
+	const u8_t *p = (const u8_t *) p_comp->p_buf;
+	const u64_t call = SWAR_ONES * OPCODE_CALL_FAR;
+	const u64_t jmp = SWAR_ONES * OPCODE_JMP_FAR;
+	u32_t end = p_comp->length - FAR_BRANCH_LENGTH + 1;
+	u32_t i = 0, j, count, address, target;
+	u64_t v;
+
+	while (i < end) {
+		// Skip 8 bytes at a time while none of them is an opcode
+		//
+		if (i + 8 <= end) {
+			memcpy(&v, p + i, 8);
+			if (!(SWAR_HAS_ZERO(v ^ call) | SWAR_HAS_ZERO(v ^ jmp))) {
+				i += 8;
+				continue;
+			}
+		}
+
+		for (j = i + 8; i < end && i < j; i++) {
+			if ((p[i] != OPCODE_CALL_FAR) && (p[i] != OPCODE_JMP_FAR))
+				continue;
+
+			// segment * 16 + offset
+			//
+			address = ((u32_t) (p[i + 3] | (p[i + 4] << 8)) << 4) +
+			    (p[i + 1] | (p[i + 2] << 8));
+
+			count = lookup_1B_address(p_index, address, p_target,
+						  MAX_COMPONENT);
+			if (count > MAX_COMPONENT)
+				count = MAX_COMPONENT;
+
+			while (count-- > 0) {
+				target = p_target[count] - p_data->component;
+
+				// Far branches into data components are opcode
+				// bytes in something else
+				//
+				if ((target == source) ||
+				    (!is_code_component(p_data, p_target[count])))
+					continue;
+
+				if (p[i] == OPCODE_CALL_FAR)
+					p_count[target].calls++;
+				else
+					p_count[target].jumps++;
+			}
+		}
+	}
+}
+
+
+/*
+ * Print the far CALL/JMP reference graph of the components of the 1B file:
+ * one line per referencing component and referenced component with the
+ * number of calls and jumps, then the components referencing each
+ * component. The components data must be loaded (see init_1B_data()).
+ *
+ * input:
+ * 	p_data	pointer to initialized _1B_DATA_T
+ *
+ * return value:
+ * 	ERROR 	on error
+ * 	SUCCESS	on success
+ */
+STATUS print_reference_graph(_1B_DATA_T * p_data)
+{
+	_1B_ADDRESS_INDEX_T *p_index = NULL;
+	XREF_COUNT_T *p_count = NULL, *p_edge = NULL;
+	_1B_COMPONENT_T *p_comp = NULL;
+	u16_t count, source, target;
+	u32_t edges = 0, referrers;
+
+	if (p_data == NULL) {
+		printf("ERROR: function %s() invalid input parameter\n",
+		       __func__);
+		return ERROR;
+	}
+	count = p_data->header.component_info_count;
+
+	p_index = init_1B_address_index(p_data);
+	if (p_index == NULL)
+		return ERROR;
+
+	// p_count[source * count + target]
+	//
+	p_count = (XREF_COUNT_T *) calloc((size_t) count * count,
+					  sizeof(XREF_COUNT_T));
+	if (p_count == NULL) {
+		printf("ERROR: function %s() unable to allocate memory\n",
+		       __func__);
+		cleanup_1B_address_index(p_index);
+		return ERROR;
+	}
+
+	for (source = 0; source < count; source++) {
+		p_comp = &(p_data->component[source]);
+		if ((p_comp->data_presence == DATA_PRESENT) &&
+		    (p_comp->p_buf != NULL) &&
+		    (p_comp->length >= FAR_BRANCH_LENGTH) &&
+		    (is_code_component(p_data, p_comp)))
+			scan_component(p_data, p_index, source,
+				       &(p_count[source * count]));
+	}
+	cleanup_1B_address_index(p_index);
+
+	printf("Far call/jump references in %s:\n", p_data->filename);
+	for (source = 0; source < count; source++) {
+		for (target = 0; target < count; target++) {
+			p_edge = &(p_count[source * count + target]);
+			if ((p_edge->calls == 0) && (p_edge->jumps == 0))
+				continue;
+
+			printf("%s -> %s: %u call(s), %u jump(s)\n",
+			       p_data->component[source].name,
+			       p_data->component[target].name, p_edge->calls,
+			       p_edge->jumps);
+			edges++;
+		}
+	}
+
+	if (edges == 0) {
+		printf("No far call/jump references between components\n");
+		free(p_count);
+		return SUCCESS;
+	}
+
+	printf("\nReferenced by:\n");
+	for (target = 0; target < count; target++) {
+		referrers = 0;
+		for (source = 0; source < count; source++) {
+			p_edge = &(p_count[source * count + target]);
+			if ((p_edge->calls == 0) && (p_edge->jumps == 0))
+				continue;
+
+			if (referrers == 0)
+				printf("%s <- %s",
+				       p_data->component[target].name,
+				       p_data->component[source].name);
+			else
+				printf(", %s", p_data->component[source].name);
+			referrers++;
+		}
+		if (referrers > 0)
+			printf("\n");
+	}
+
+	free(p_count);
+	return SUCCESS;
+}